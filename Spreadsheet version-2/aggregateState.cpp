@@ -0,0 +1,115 @@
+#include "aggregateState.h"
+#include <cmath>
+
+namespace utils {
+
+// Creates an empty state
+AggregateState::AggregateState() : count(0), sum(0.0), compensation(0.0), min(0.0), max(0.0), mean(0.0), m2(0.0), exactExtremes(true) {}
+
+// Adds one value (Welford update for the mean and M2)
+void AggregateState::add(double x) {
+    if (count == 0 || x < min) min = x;
+    if (count == 0 || x > max) max = x;
+    count++;
+    addToSum(x);
+    double delta = x - mean;
+    mean += delta / count;
+    m2 += delta * (x - mean);
+}
+
+// Removes one value (inverse of the Welford update)
+void AggregateState::remove(double x) {
+    if (count <= 1) {
+        *this = AggregateState();
+        return;
+    }
+    if (x <= min || x >= max)
+        exactExtremes = false;
+    count--;
+    addToSum(-x);
+    double delta = x - mean;
+    mean -= delta / count;
+    m2 -= delta * (x - mean);
+}
+
+// Combines another state into this one (Chan et al. pairwise update)
+void AggregateState::merge(const AggregateState& other) {
+    if (other.count == 0)
+        return;
+    if (count == 0) {
+        *this = other;
+        return;
+    }
+
+    long long total = count + other.count;
+    double delta = other.mean - mean;
+    mean += delta * other.count / total;
+    m2 += other.m2 + delta * delta * ((double)count * other.count / total);
+    if (other.min < min) min = other.min;
+    if (other.max > max) max = other.max;
+    exactExtremes = exactExtremes && other.exactExtremes;
+    addToSum(other.sum);
+    addToSum(other.compensation);
+    count = total;
+}
+
+// Builds the state of a chunk whose moments were computed by the range kernels
+AggregateState AggregateState::fromMoments(long long count, double sum, double min, double max, double m2) {
+    AggregateState state;
+    if (count == 0)
+        return state;
+    state.count = count;
+    state.sum = sum;
+    state.min = min;
+    state.max = max;
+    state.mean = sum / count;
+    state.m2 = m2;
+    return state;
+}
+
+// Number of values added so far
+long long AggregateState::getCount() const {
+    return count;
+}
+
+// Compensated sum of the values
+double AggregateState::getSum() const {
+    return sum + compensation;
+}
+
+// Arithmetic mean of the values
+double AggregateState::getMean() const {
+    return count == 0 ? 0.0 : getSum() / count;
+}
+
+// Smallest value
+double AggregateState::getMin() const {
+    return min;
+}
+
+// Largest value
+double AggregateState::getMax() const {
+    return max;
+}
+
+// Population variance of the values
+double AggregateState::getVariance() const {
+    return (count == 0 || m2 < 0) ? 0.0 : m2 / count;
+}
+
+// False once a value equal to an extreme has been removed
+bool AggregateState::hasExactExtremes() const {
+    return exactExtremes;
+}
+
+// Neumaier compensated addition
+void AggregateState::addToSum(double x) {
+    double t = sum + x;
+    if (fabs(sum) >= fabs(x))
+        compensation += (sum - t) + x;
+    else
+        compensation += (x - t) + sum;
+    sum = t;
+}
+
+}
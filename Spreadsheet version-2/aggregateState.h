@@ -0,0 +1,64 @@
+#ifndef AGGREGATE_STATE_H
+#define AGGREGATE_STATE_H
+
+using namespace std;
+
+namespace utils {
+
+// Running statistics of a set of numbers, computed in a single pass.
+// States can be updated one value at a time and merged with the state of another chunk,
+// so a range can be split across threads and the partial results combined afterwards.
+// The sum is compensated (Neumaier) and the variance uses Welford's mean / M2 update.
+class AggregateState {
+public:
+    // Creates an empty state
+    AggregateState();
+
+    // Adds one value to the state
+    void add(double x);
+
+    // Removes one value that was added before (inverse Welford update).
+    // Removing the current minimum or maximum makes the extremes inexact until the range is rescanned.
+    void remove(double x);
+
+    // Combines the state of another, disjoint set of values into this one
+    void merge(const AggregateState& other);
+
+    // Builds the state of a chunk from its count, sum, extremes and sum of squared deviations from its mean
+    static AggregateState fromMoments(long long count, double sum, double min, double max, double m2);
+
+    // Number of values added so far
+    long long getCount() const;
+
+    // Compensated sum of the values
+    double getSum() const;
+
+    // Arithmetic mean of the values (0 if empty)
+    double getMean() const;
+
+    // Smallest and largest values (0 if empty)
+    double getMin() const;
+    double getMax() const;
+
+    // Population variance of the values (0 if empty)
+    double getVariance() const;
+
+    // False once a value equal to an extreme has been removed
+    bool hasExactExtremes() const;
+
+private:
+    // Adds x to the compensated sum
+    void addToSum(double x);
+
+    long long count;     // Number of values
+    double sum;          // Running sum
+    double compensation; // Low order bits lost by the running sum
+    double min, max;     // Extremes
+    double mean;         // Welford running mean
+    double m2;           // Welford sum of squared deviations from the mean
+    bool exactExtremes;  // min / max are known to be the true extremes
+};
+
+}
+
+#endif
@@ -33,28 +33,55 @@ void Cell::setPosition(int r, int c) {
 
 
 // Adds a dependent cell to the current cell's dependents list
-void Cell::addDependents(Cell* add) {
-    int flag = 1;  // Flag to check if the dependent cell is already added
-    for (Cell * c : dependents) {
-        // If the dependent cell is already in the list, set the flag to 0
-        if (*c == *add) {
-            flag = 0;
+void Cell::addDependents(Cell* add, bool checked) {
+    if (this == add) {
+        return;  // A cell is never its own dependent
+    }
+    if (dependentSet) {
+        // Many cells read this one (like a fixed reference filled down a column), the set is asked instead
+        if (dependentSet->count(add)) {
+            return;
+        }
+    }
+    else {
+        for (Cell * c : dependents) {
+            // If the dependent cell is already in the list, it is not added again (cells on other sheets share addresses)
+            if (c == add) {
+                return;
+            }
         }
     }
-    // If not already added and not the same cell, add it to the dependents list
-    if (flag == 1 && this != add && !add->checkCyclicDependency(this)) {
+    // If adding it closes no cycle, add it to the dependents list
+    if (checked || !add->checkCyclicDependency(this)) {
         dependents.push_back(add);
+        if (dependentSet) {
+            dependentSet->insert(add);
+        }
+        else if (dependents.size() > DEPENDENT_SET_THRESHOLD) {
+            indexDependents();
+        }
     }
 }
 
 // Getter for all dependent cells of the current cell
-Container<Cell*> Cell::getDependents() const {
+const Container<Cell*>& Cell::getDependents() const {
     return dependents;
 }
 
 // Setter to update the list of dependent cells
 void Cell::setDependents(const Container<Cell*>& newDependents) {
     dependents = newDependents;
+    indexDependents();
+}
+
+// Keeps the hash set only for cells with more than DEPENDENT_SET_THRESHOLD dependents
+void Cell::indexDependents() {
+    if (dependents.size() > DEPENDENT_SET_THRESHOLD) {
+        dependentSet = make_unique<unordered_set<Cell*>>(dependents.begin(), dependents.end());
+    }
+    else {
+        dependentSet.reset();
+    }
 }
 
 // Checks if there's a cyclic dependency involving the current cell
@@ -74,45 +101,67 @@ bool Cell::checkCyclicDependency(Cell* target) {
     return false; // No cyclic dependency found
 }
 
-// Notifies all dependent cells that the value of the current cell has changed
+// Notifies all dependent cells that the value of the current cell has changed.
+// The sheet publishes the new value and recalculates every formula that reads it once, in dependency order.
 void Cell::notifyDependents(SpreadSheet& spreadsheet) {
-    if (dependents.size() != 0) {
-        for (auto& dep : dependents) {
-            // If the dependent cell is a formula, update its value
-            if (dep->getType() == Type::formula) {
-                dep->updateValue(spreadsheet); // Update the value of each dependent cell
-            }   
-        }
-    }
+    spreadsheet.recalculate(vector<Cell*>(1, this), false);
 }
 
 // Removes a dependent cell from the dependents list
 void Cell::remove(Cell* cell) {
+    if (dependentSet && !dependentSet->count(cell)) {
+        return;  // Not a dependent, the list is not scanned
+    }
     auto it = std::remove(dependents.begin(), dependents.end(), cell);
     if (it != dependents.end()) {
         dependents.erase(it); // Remove the cell from the list
+        if (dependentSet) {
+            dependentSet->erase(cell);
+        }
+    }
+}
+
+// Removes every dependent cell found in the set
+void Cell::removeDependents(const unordered_set<Cell*>& cells) {
+    Container<Cell*> kept;
+    for (Cell* cell : dependents)
+        if (!cells.count(cell))
+            kept.push_back(cell);
+    if (kept.size() != dependents.size()) {
+        dependents = kept;
+        indexDependents();
     }
 }
 
-// Updates the value of the current cell based on its formula/content
+// Updates the value of the current cell based on its formula/content.
+// The dependents are not notified, the recalculation of the sheet visits them in order.
 void Cell::updateValue(SpreadSheet& table) {
     try {
         // Parse and evaluate the formula for this cell
         FormulaParser::parserFormula(this, table);
-        
-        // Print the updated value in the terminal at the given position (row, col)
-        if(row < SPRERAD_ROW_SIZE + 4 && col < 7 * SPRERAD_COL_SIZE - 2)
-            cout << "\033[" << row << ";" << col << "H" << " " << getValue().substr(0, CELL_SIZE - 1) << std::flush;
-        
-        // Notify dependent cells of the update
-        notifyDependents(table);
+        if (table.isShown())
+            show();
     }
     catch(exception& e) {
-        // If an error occurs during formula parsing, notify the user
-        table.inputFunc(row, col, 1, e.what());
+        // If an error occurs during formula parsing, notify the user (of the sheet on screen)
+        if (table.isShown())
+            table.inputFunc(row, col, 1, e.what());
     }
 }
 
+// Print the value in the terminal at the given position (row, col) if it is on screen
+void Cell::show() const {
+    if(row < SPRERAD_ROW_SIZE + 4 && col < 7 * SPRERAD_COL_SIZE - 2 && getError() != ErrorCode::none)
+        cout << "\033[" << row << ";" << col << "H" << getValue().substr(0, CELL_SIZE) << std::flush;
+    else if(row < SPRERAD_ROW_SIZE + 4 && col < 7 * SPRERAD_COL_SIZE - 2)
+        cout << "\033[" << row << ";" << col << "H" << " " << getValue().substr(0, CELL_SIZE - 1) << std::flush;
+}
+
+// Only formulas can hold error values
+ErrorCode Cell::getError() const {
+    return ErrorCode::none;
+}
+
 // Equality operator to compare two cells based on their row and column
 bool Cell::operator==(const Cell& o) const {
     return (row == o.row && col == o.col);  // Cells are equal if their row and column match
@@ -120,16 +169,30 @@ bool Cell::operator==(const Cell& o) const {
 
 // FormulaCell class methods
 
-// Returns the formula content as a string
+// Returns the formula content as a string; a formula of a family writes the template at its own position
 string FormulaCell::getContent() const {
+    if (shape != nullptr)
+        return FormulaCompiler::fromTemplate(shape->text, row - 4, (col - 4) / CELL_SIZE);
     return formula;
 }
 
-// Returns the evaluated value of the formula
+// Returns the evaluated value of the formula, or the text of its error value
 string FormulaCell::getValue() const {
+    if (error != ErrorCode::none)
+        return ErrorValue::toString(error);
+    return to_string(result);
+}
+
+// Returns the evaluated value of the formula as a number
+double FormulaCell::getNumber() const {
     return result;
 }
 
+// Returns the error value of the last evaluation
+ErrorCode FormulaCell::getError() const {
+    return error;
+}
+
 // Returns the type as 'formula'
 Type FormulaCell::getType() const {
     return Type::formula;
@@ -138,19 +201,221 @@ Type FormulaCell::getType() const {
 // Sets the formula content and re-evaluates the formula
 void FormulaCell::setContent(const string& str, SpreadSheet& table) {
     formula = str;
-    result = "0";  // Default value before formula evaluation
+    result = 0;  // Default value before formula evaluation
+    error = ErrorCode::none;
+    cyclic = false;
+    program.reset();  // The new formula is compiled on its first evaluation
+    shape.reset();
     try {
         FormulaParser::parserFormula(this, table);
         notifyDependents(table);  // Notify dependents of the update
     }
     catch(exception& e) {
-        table.inputFunc(row, col, 1, e.what());
+        if (table.isShown())
+            table.inputFunc(row, col, 1, e.what());
     }
 }
 
 // Sets the evaluated result of the formula
 void FormulaCell::setValue(const string& str) {
-    result = str;
+    result = stod(str);
+    error = ErrorCode::none;
+}
+
+// Sets the evaluated result (or error value) of the formula without going through a string
+void FormulaCell::setResult(double value, ErrorCode code) {
+    result = value;
+    error = code;
+}
+
+// Sets the formula and its already compiled program, the cell is evaluated later (used by fills)
+void FormulaCell::setFormula(const string& str, const CompiledFormula& compiled) {
+    formula = str;
+    program = make_unique<CompiledFormula>(compiled);
+    shape.reset();
+    result = 0;
+    error = ErrorCode::none;
+    cyclic = false;
+}
+
+// Makes the cell a member of the family of the template, the cell is evaluated later (used by fills)
+void FormulaCell::setTemplate(const shared_ptr<const FormulaTemplate>& family) {
+    formula.clear();
+    program.reset();
+    shape = family;
+    result = 0;
+    error = ErrorCode::none;
+    cyclic = false;
+}
+
+// Marks the formula as reading itself through its references
+void FormulaCell::setCyclic(bool value) {
+    cyclic = value;
+}
+
+// Returns true if the formula reads itself through its references
+bool FormulaCell::isCyclic() const {
+    return cyclic;
+}
+
+// Evaluates an array program into the elements of the result; the formula itself shows the first element
+void FormulaCell::evaluateArray(SpreadSheet& table) {
+    const CompiledFormula& program = getProgram();
+    size_t size = (size_t)program.getRows() * program.getCols();
+    elements.resize(size);
+    elementErrors.resize(size);
+    program.evaluateArray(table, elements.data(), elementErrors.data());
+    result = elements[0];
+    error = elementErrors[0];
+}
+
+// Returns an element of the array result, #REF! if the result has no such element
+double FormulaCell::getElement(int index, ErrorCode& code) const {
+    if (!getProgram().isArray() || index < 0 || index >= (int)elements.size()) {
+        code = ErrorCode::ref;
+        return 0;
+    }
+    if (error == ErrorCode::cycle || error == ErrorCode::spill) {
+        code = error;  // The whole result failed
+        return 0;
+    }
+    code = elementErrors[index];
+    return elements[index];
+}
+
+// Marks the cells of the array result as placed on the sheet
+void FormulaCell::setSpilled(bool value) {
+    spilled = value;
+}
+
+// Returns true if the cells of the array result are placed on the sheet
+bool FormulaCell::isSpilled() const {
+    return spilled;
+}
+
+// Compiles the formula text into its postfix program. A formula of the same shape as one on the sheet joins
+// its family without being compiled; a new formula whose program can be shared starts a family of its own.
+void FormulaCell::compile(SpreadSheet& table) {
+    shared_ptr<const FormulaTemplate> family = table.findTemplate(formula, row - 4, (col - 4) / CELL_SIZE);
+    if (family == nullptr) {
+        CompiledFormula compiled = FormulaCompiler::compile(formula, table);
+        if (!compiled.isShareable()) {
+            program = make_unique<CompiledFormula>(move(compiled));
+            return;
+        }
+        family = table.addTemplate(formula, row - 4, (col - 4) / CELL_SIZE, move(compiled));
+    }
+    formula.clear();
+    program.reset();
+    shape = family;
+}
+
+// Leaves the family: the cell gets the formula text and the program moved to its own position,
+// so they stay the same when the cell is moved (like by a sort)
+void FormulaCell::detach(SpreadSheet& table) {
+    if (shape == nullptr)
+        return;
+    int rows, cols;
+    getOffset(rows, cols);
+    formula = getContent();
+    program = make_unique<CompiledFormula>(FormulaCompiler::relocate(shape->program, rows, cols, table));
+    shape.reset();
+}
+
+// Returns the compiled program of the formula, the template's for a formula of a family
+const CompiledFormula& FormulaCell::getProgram() const {
+    static const CompiledFormula none;
+    if (shape != nullptr)
+        return shape->program;
+    return program != nullptr ? *program : none;
+}
+
+// Returns the template of the family of the formula
+const shared_ptr<const FormulaTemplate>& FormulaCell::getTemplate() const {
+    return shape;
+}
+
+// Returns how far the cell is from the cell its program was compiled for: (0, 0) but in a family
+void FormulaCell::getOffset(int& rows, int& cols) const {
+    rows = cols = 0;
+    if (shape != nullptr) {
+        rows = row - 4 - shape->row;
+        cols = (col - 4) / CELL_SIZE - shape->col;
+    }
+}
+
+// SpillCell class methods
+
+// Creates the cell of an element of an array result
+SpillCell::SpillCell(int anchorRow, int anchorCol, int index) : anchorRow(anchorRow), anchorCol(anchorCol), index(index) {}
+
+// Spilled cells have no content of their own
+string SpillCell::getContent() const {
+    return "";
+}
+
+// Returns the element, or the text of its error value
+string SpillCell::getValue() const {
+    if (error != ErrorCode::none)
+        return ErrorValue::toString(error);
+    return to_string(value);
+}
+
+// Returns the element as a number
+double SpillCell::getNumber() const {
+    return value;
+}
+
+// Returns the error value of the element
+ErrorCode SpillCell::getError() const {
+    return error;
+}
+
+// Returns the type as 'spill'
+Type SpillCell::getType() const {
+    return Type::spill;
+}
+
+// Spilled cells are replaced by the sheet when something is entered into them
+void SpillCell::setContent(const string&, SpreadSheet&) {
+    // Nothing to keep: the element comes from the array formula, the content typed in goes to the new cell
+}
+
+// Sets the element
+void SpillCell::setValue(const string& str) {
+    value = stod(str);
+    error = ErrorCode::none;
+}
+
+// Copies the element from the anchor formula (nullptr if the cell at the anchor is no longer a formula);
+// if the anchor is no longer an array formula, the element is #REF!.
+// Returns true if the element changed (or was never copied before).
+bool SpillCell::pull(const FormulaCell* anchor) {
+    ErrorCode code = ErrorCode::ref;
+    double element = (anchor != nullptr) ? anchor->getElement(index, code) : 0.0;
+    if (code != ErrorCode::none)
+        element = 0.0;
+
+    bool changed = fresh || element != value || code != error;
+    fresh = false;
+    setResult(element, code);
+    return changed;
+}
+
+// Sets the element (or error value) without going through a string
+void SpillCell::setResult(double number, ErrorCode code) {
+    value = number;
+    error = code;
+}
+
+// Returns the row of the anchor formula
+int SpillCell::getAnchorRow() const {
+    return anchorRow;
+}
+
+// Returns the column of the anchor formula
+int SpillCell::getAnchorCol() const {
+    return anchorCol;
 }
 
 // IntValueCell class methods
@@ -171,6 +436,11 @@ void IntValueCell::setContent(const string& str, SpreadSheet& table) {
     notifyDependents(table);  // Notify dependents of the update
 }
 
+// Returns the integer value as a number
+double IntValueCell::getNumber() const {
+    return value;
+}
+
 // Sets the integer value directly
 void IntValueCell::setValue(const string& str) {
     value = stoi(str);
@@ -204,6 +474,11 @@ string StringValueCell::getValue() const {
     return value;
 }
 
+// Strings count as 0 in arithmetic
+double StringValueCell::getNumber() const {
+    return 0;
+}
+
 // Sets the string value directly
 void StringValueCell::setValue(const string& str) {
     value = str;
@@ -227,6 +502,11 @@ void DoubleValueCell::setContent(const string& str, SpreadSheet& table) {
     notifyDependents(table);  // Notify dependents of the update
 }
 
+// Returns the double value as a number
+double DoubleValueCell::getNumber() const {
+    return value;
+}
+
 // Sets the double value directly
 void DoubleValueCell::setValue(const string& str) {
     value = stod(str);
@@ -255,6 +535,11 @@ void EmptyValueCell::setContent(const string& str, SpreadSheet& table) {
     notifyDependents(table);  // Notify dependents of the update
 }
 
+// Empty cells count as 0 in arithmetic
+double EmptyValueCell::getNumber() const {
+    return 0;
+}
+
 // Sets the value of the empty cell (empty string)
 void EmptyValueCell::setValue(const string& str) {
     value = str;
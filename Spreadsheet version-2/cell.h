@@ -4,7 +4,9 @@
 #include <string>
 #include <vector>
 #include <memory>
+#include <unordered_set>
 #include "container.h"
+#include "formulaCompiler.h"
 
 using namespace std;
 using namespace utils;
@@ -17,7 +19,8 @@ namespace spreadsheet {
         empty,   // Cell is empty
         formula, // Cell contains a formula
         string,  // Cell contains a string
-        value    // Cell contains a numeric value
+        value,   // Cell contains a numeric value
+        spill    // Cell shows an element of the result of an array formula
     };
 
     // Base class representing a generic Cell
@@ -31,6 +34,12 @@ namespace spreadsheet {
         // Pure virtual function to get the value of the cell (used in derived classes)
         virtual string getValue() const = 0;
 
+        // Pure virtual function to get the numeric value of the cell (0 for strings and empty cells)
+        virtual double getNumber() const = 0;
+
+        // Virtual function to get the error value of the cell (only formulas can hold one)
+        virtual ErrorCode getError() const;
+
         // Virtual function to return the type of the cell
         virtual Type getType() const = 0 ;
 
@@ -48,14 +57,15 @@ namespace spreadsheet {
         // Setter functions to set the row and column position of the cell
         void setPosition(int r, int c);
 
-        // Function to add a dependent cell to the current cell's list of dependents
-        void addDependents(Cell* dependent);
+        // Function to add a dependent cell to the current cell's list of dependents.
+        // 'checked' skips the cycle check, for callers that have already walked from the dependent.
+        void addDependents(Cell* dependent, bool checked = false);
 
         // Equality operator to compare two cells
         bool operator==(const Cell& other) const;
 
-        // Function to retrieve all dependent cells
-        Container<Cell*> getDependents() const;
+        // Function to retrieve all dependent cells (without copying them)
+        const Container<Cell*>& getDependents() const;
 
         // Setter function to update the list of dependent cells
         void setDependents(const Container<Cell*>& newDependents);
@@ -63,17 +73,30 @@ namespace spreadsheet {
         // Notify all dependents when a change occurs
         void notifyDependents(SpreadSheet&);
 
-        // Update the cell's value based on the content/formula
+        // Update the cell's value based on the content/formula (dependents are not notified)
         void updateValue(SpreadSheet&);
 
+        // Print the value of the cell in the terminal at its position, if it is on screen
+        void show() const;
+
         // Check if there is a cyclic dependency involving the current cell
         bool checkCyclicDependency(Cell* target);
 
         // Remove a dependent cell
         void remove(Cell* cell);
 
+        // Remove every dependent cell found in the set
+        void removeDependents(const unordered_set<Cell*>& cells);
+
     protected:
+        // Dependents past which they are also kept in a hash set, so that adding one does not scan the list
+        static const int DEPENDENT_SET_THRESHOLD = 32;
+
+        // Rebuilds the hash set of the dependents, or drops it when there are few of them
+        void indexDependents();
+
         Container<Cell*> dependents; // Container to hold all dependent cells
+        unique_ptr<unordered_set<Cell*>> dependentSet; // The same cells, once there are many of them
         int row, col; // Row and column position of the cell
     };
 
@@ -82,14 +105,68 @@ namespace spreadsheet {
     public:
         string getContent() const override; // Return the formula as content
         string getValue() const override;   // Return the evaluated value of the formula
+        double getNumber() const override;  // Return the evaluated value as a number
+        ErrorCode getError() const override; // Return the error value of the last evaluation
         Type getType() const override;      // Return the type as 'formula'
 
         void setContent(const string&, SpreadSheet&) override; // Set the formula content
         void setValue(const string&) override; // Set the evaluated value of the formula
 
+        void setResult(double, ErrorCode);           // Set the evaluated value (or error) without string conversion
+        void setFormula(const string&, const CompiledFormula&); // Set the formula and its program without evaluating
+        void setTemplate(const shared_ptr<const FormulaTemplate>&); // Join a family: share its formula and program
+        void compile(SpreadSheet&);                  // Compile the formula text into its program (or join a family)
+        void detach(SpreadSheet&);                   // Take a copy of the shared formula and program for the cell alone
+        const CompiledFormula& getProgram() const;   // Return the compiled form of the formula (see getOffset)
+        const shared_ptr<const FormulaTemplate>& getTemplate() const; // Return the template of the family, or nullptr
+        void getOffset(int&, int&) const;            // Offset of the cell from the cell its program was compiled for
+        void setCyclic(bool);                        // Mark the formula as reading itself through its references
+        bool isCyclic() const;                       // True if the formula evaluates to #CYCLE!
+
+        void evaluateArray(SpreadSheet&);            // Evaluate an array program into the elements of the result
+        double getElement(int, ErrorCode&) const;    // Return an element of an array result (column by column)
+        void setSpilled(bool);                       // Mark the cells of the result as placed on the sheet
+        bool isSpilled() const;                      // True if the result of an array formula is shown
+
+    private:
+        string formula;          // The formula string (empty in a family, whose text is the template's)
+        double result = 0;       // The evaluated result of the formula
+        ErrorCode error = ErrorCode::none; // Error value of the last evaluation
+        bool cyclic = false;     // Set when the formula was entered, until it is entered again
+        unique_ptr<CompiledFormula> program;     // The formula compiled once when the content is set
+        shared_ptr<const FormulaTemplate> shape; // Template shared with the family of the formula, or nullptr
+        vector<double> elements;         // Elements of an array result, column by column (element 0 is 'result')
+        vector<ErrorCode> elementErrors; // Error values of the elements
+        bool spilled = false;    // The cells of the array result are placed on the sheet
+    };
+
+    // Cell covered by the result of an array formula. It has no content of its own: it holds one element of
+    // the result, copied from the formula (its "anchor") each time the formula is evaluated.
+    // Formulas read it like a value cell.
+    class SpillCell : public Cell {
+    public:
+        SpillCell(int anchorRow, int anchorCol, int index); // Element 'index' of the formula at (anchorRow, anchorCol)
+
+        string getContent() const override;  // Spilled cells have no content
+        string getValue() const override;    // Return the element, or the text of its error value
+        double getNumber() const override;   // Return the element as a number
+        ErrorCode getError() const override; // Return the error value of the element
+        Type getType() const override;       // Return the type as 'spill'
+
+        void setContent(const string&, SpreadSheet&) override; // Spilled cells are replaced, not edited
+        void setValue(const string&) override; // Set the element
+
+        bool pull(const FormulaCell*);       // Copy the element from the anchor formula; true if it changed
+        void setResult(double, ErrorCode);   // Set the element (or error) without string conversion
+        int getAnchorRow() const;            // Zero based position of the anchor formula
+        int getAnchorCol() const;
+
     private:
-        string formula; // The formula string
-        string result;  // The evaluated result of the formula
+        int anchorRow, anchorCol; // Zero based position of the anchor formula
+        int index;                // Element of the result, column by column
+        double value = 0;         // Copy of the element
+        ErrorCode error = ErrorCode::none; // Error value of the element
+        bool fresh = true;        // The element was never copied (the sheet has not seen it yet)
     };
 
     // Abstract base class representing a value cell (numeric or string)
@@ -97,6 +174,7 @@ namespace spreadsheet {
     public:
         virtual string getContent() const = 0; // Get the content as a string
         virtual string getValue() const = 0;   // Get the value as a string
+        virtual double getNumber() const = 0;  // Get the value as a number
         virtual Type getType() const = 0;      // Return the type of the value cell
         virtual void setContent(const string&, SpreadSheet&) = 0; // Set the content of the value cell
         virtual void setValue(const string&) = 0; // Set the value of the value cell
@@ -107,6 +185,7 @@ namespace spreadsheet {
     public:
         string getContent() const override; // Return the integer value as a string
         string getValue() const override;   // Return the integer value as a string
+        double getNumber() const override;  // Return the integer value as a number
         Type getType() const override;      // Return the type as 'value'
 
         void setContent(const string&, SpreadSheet&) override; // Set the content as an integer value
@@ -121,6 +200,7 @@ namespace spreadsheet {
     public:
         Type getType() const override;        // Return the type as 'value'
         string getValue() const override;     // Return the string value
+        double getNumber() const override;    // Strings count as 0 in arithmetic
         string getContent() const override;   // Return the string value as content
         void setContent(const string&, SpreadSheet&) override; // Set the content as a string
         void setValue(const string&) override; // Set the string value
@@ -134,6 +214,7 @@ namespace spreadsheet {
     public:
         string getContent() const override; // Return the double value as a string
         string getValue() const override;   // Return the double value as a string
+        double getNumber() const override;  // Return the double value
         Type getType() const override;      // Return the type as 'value'
         void setContent(const string&, SpreadSheet&) override; // Set the content as a double value
         void setValue(const string&) override; // Set the double value
@@ -147,6 +228,7 @@ namespace spreadsheet {
     public:
         string getContent() const override; // Return an empty string as content
         string getValue() const override;   // Return an empty string as value
+        double getNumber() const override;  // Empty cells count as 0 in arithmetic
         Type getType() const override;      // Return the type as 'empty'
         void setContent(const string&, SpreadSheet&) override; // Set the content as empty
         void setValue(const string&) override; // Set the value as empty
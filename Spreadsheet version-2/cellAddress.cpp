@@ -0,0 +1,96 @@
+#include "cellAddress.h"
+#include <vector>
+#include <algorithm>
+#include <climits>
+
+namespace utils {
+
+// Reads the column letters
+int CellAddress::readColumn(const string& text, size_t& pos) {
+    const char* p = text.data() + pos;
+    const char* end = text.data() + text.size();
+    const char* start = p;
+    int col = 0;
+
+    // Each letter is a digit of 1..26; the count is checked once at the end, letters past the limit are only skipped
+    while (p < end && (unsigned char)(*p - 'A') < 26) {
+        if (p - start < MAX_LETTERS)
+            col = col * 26 + (*p - 'A' + 1);
+        p++;
+    }
+    size_t letters = p - start;
+
+    pos += letters;
+    return (letters == 0 || letters > MAX_LETTERS) ? -1 : col;
+}
+
+// Reads the row digits
+int CellAddress::readRow(const string& text, size_t& pos) {
+    const char* p = text.data() + pos;
+    const char* end = text.data() + text.size();
+    const char* start = p;
+    long long row = 0;
+
+    while (p < end && (unsigned char)(*p - '0') < 10) {
+        if (p - start < MAX_DIGITS)
+            row = row * 10 + (*p - '0');
+        p++;
+    }
+    size_t digits = p - start;
+
+    pos += digits;
+    if (digits == 0)
+        return -1;
+    return digits > MAX_DIGITS ? INT_MAX : (int)row;
+}
+
+// Reads a whole reference
+bool CellAddress::parse(const string& text, int& row, int& col) {
+    size_t pos = 0;
+    col = readColumn(text, pos) - 1;
+    row = readRow(text, pos) - 1;
+    return col >= 0 && row >= 0 && pos == text.size();
+}
+
+// Returns the label of a column, from the table for the first MAX_COLS
+string CellAddress::columnLabel(int col) {
+    if (col >= 0 && col < MAX_COLS)
+        return string(labels() + col * 4);
+    char buffer[8];
+    char* start = encode(col, buffer + sizeof(buffer));
+    return string(start, buffer + sizeof(buffer));
+}
+
+// Returns the reference of a cell
+string CellAddress::toString(int row, int col) {
+    return columnLabel(col) + to_string(row + 1);
+}
+
+// Builds the label table on first use (static locals are initialized once, also across threads)
+const char* CellAddress::labels() {
+    static const vector<char> table = [] {
+        vector<char> result(MAX_COLS * 4, 0);
+        char buffer[8];
+        for (int col = 0; col < MAX_COLS; col++) {
+            char* start = encode(col, buffer + sizeof(buffer));
+            copy(start, buffer + sizeof(buffer), result.begin() + col * 4);
+        }
+        return result;
+    }();
+    return table.data();
+}
+
+// Writes the letters from the last one backwards: in bijective base 26 the digits are 1..26, so one is taken
+// off before each division
+char* CellAddress::encode(int col, char* end) {
+    unsigned int n = (unsigned int)col + 1;
+    char* p = end;
+    while (n > 0) {
+        n--;
+        *--p = (char)('A' + n % 26);
+        n /= 26;
+    }
+    return p;
+}
+
+}
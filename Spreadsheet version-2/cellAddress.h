@@ -0,0 +1,50 @@
+#ifndef CELL_ADDRESS_H
+#define CELL_ADDRESS_H
+
+#include <string>
+
+using namespace std;
+
+namespace utils {
+
+// A1 addressing shared by the formulas, the commands and the screen. Columns are written in bijective
+// base 26 (A..Z, AA..ZZ, AAA..XFD and on) and rows as numbers from 1. The readers test characters with one
+// unsigned compare instead of the character classes, and column labels come from a table built once.
+class CellAddress {
+public:
+    // Longest column label and row number read
+    static const int MAX_LETTERS = 3;
+    static const int MAX_DIGITS = 9;
+
+    // Columns whose labels are kept in the table (A..XFD)
+    static const int MAX_COLS = 16384;
+
+    // Reads the capital letters at 'pos' and returns the column number (A = 1), or -1 if there are none or
+    // more than MAX_LETTERS. 'pos' is moved past the letters.
+    static int readColumn(const string& text, size_t& pos);
+
+    // Reads the digits at 'pos' and returns the row number, or -1 if there are none. Numbers of more than
+    // MAX_DIGITS digits read as a row no sheet has. 'pos' is moved past the digits.
+    static int readRow(const string& text, size_t& pos);
+
+    // Reads a whole reference like "XFD1048576" into a zero based row and column. Returns false if the text
+    // is anything else (the position is not checked against a sheet).
+    static bool parse(const string& text, int& row, int& col);
+
+    // Returns the label of a zero based column ("A", ..., "Z", "AA", ..., "XFD")
+    static string columnLabel(int col);
+
+    // Returns the reference of a zero based cell ("A1")
+    static string toString(int row, int col);
+
+private:
+    // Labels of the first MAX_COLS columns, four characters each (ended by zeros)
+    static const char* labels();
+
+    // Writes the label of a zero based column so that it ends before 'end' (up to seven letters); returns its start
+    static char* encode(int col, char* end);
+};
+
+}
+
+#endif
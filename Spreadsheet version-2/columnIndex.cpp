@@ -0,0 +1,121 @@
+#include "columnIndex.h"
+#include <algorithm>
+#include <limits>
+
+using namespace utils;
+
+namespace spreadsheet {
+
+// Builds the index of a column of the given number of rows
+ColumnIndex::ColumnIndex(const double* values, const unsigned char* mask, int rows)
+    : rows(rows), shift(0), edits(0), counts(rows + 1), sums(rows + 1), squares(rows + 1),
+      minima(2 * rows), maxima(2 * rows) {
+    build(values, mask);
+}
+
+// Rebuilds every tree from the column in O(n)
+void ColumnIndex::build(const double* values, const unsigned char* mask) {
+    const double inf = numeric_limits<double>::infinity();
+    double total = 0;
+    int numbers = 0;
+    for (int i = 0; i < rows; i++) {
+        total += values[i];
+        numbers += mask[i];
+    }
+    shift = numbers ? total / numbers : 0;
+    edits = 0;
+
+    // Fenwick trees: place every entry at its own slot, then push each slot into its parent once
+    for (int i = 1; i <= rows; i++) {
+        double d = mask[i - 1] ? values[i - 1] - shift : 0;
+        counts[i] = mask[i - 1];
+        sums[i] = d;
+        squares[i] = d * d;
+    }
+    for (int i = 1; i <= rows; i++) {
+        int parent = i + (i & -i);
+        if (parent <= rows) {
+            counts[parent] += counts[i];
+            sums[parent] += sums[i];
+            squares[parent] += squares[i];
+        }
+    }
+
+    // Segment trees: leaves first, then every inner node from its two children
+    for (int i = 0; i < rows; i++) {
+        minima[rows + i] = mask[i] ? values[i] : inf;
+        maxima[rows + i] = mask[i] ? values[i] : -inf;
+    }
+    for (int i = rows - 1; i > 0; i--) {
+        minima[i] = min(minima[2 * i], minima[2 * i + 1]);
+        maxima[i] = max(maxima[2 * i], maxima[2 * i + 1]);
+    }
+}
+
+// Replaces the entry of a row
+bool ColumnIndex::update(int row, double oldValue, bool wasNumber, double newValue, bool isNumber) {
+    const double inf = numeric_limits<double>::infinity();
+    double before = wasNumber ? oldValue - shift : 0;
+    double after = isNumber ? newValue - shift : 0;
+    addToTrees(row, (double)isNumber - (double)wasNumber, after - before, after * after - before * before);
+    setLeaf(row, isNumber ? newValue : inf, isNumber ? newValue : -inf);
+    return ++edits >= rows;
+}
+
+// Statistics of the rows row..lastRow
+AggregateState ColumnIndex::query(int row, int lastRow) const {
+    const double inf = numeric_limits<double>::infinity();
+    long long count = (long long)(prefix(counts, lastRow + 1) - prefix(counts, row) + 0.5);
+    if (count <= 0)
+        return AggregateState();
+
+    double sum = prefix(sums, lastRow + 1) - prefix(sums, row);
+    double square = prefix(squares, lastRow + 1) - prefix(squares, row);
+    double m2 = square - sum * sum / count;
+
+    // Bottom-up segment tree walk over the half open interval [row, lastRow + 1)
+    double low = inf, high = -inf;
+    for (int l = row + rows, r = lastRow + 1 + rows; l < r; l /= 2, r /= 2) {
+        if (l & 1) {
+            low = min(low, minima[l]);
+            high = max(high, maxima[l]);
+            l++;
+        }
+        if (r & 1) {
+            r--;
+            low = min(low, minima[r]);
+            high = max(high, maxima[r]);
+        }
+    }
+    return AggregateState::fromMoments(count, sum + count * shift, low, high, m2 > 0 ? m2 : 0);
+}
+
+// Adds the deltas to the Fenwick trees at a zero based row
+void ColumnIndex::addToTrees(int row, double count, double sum, double square) {
+    for (int i = row + 1; i <= rows; i += i & -i) {
+        counts[i] += count;
+        sums[i] += sum;
+        squares[i] += square;
+    }
+}
+
+// Sets a leaf of the min / max segment trees and updates its ancestors
+void ColumnIndex::setLeaf(int row, double low, double high) {
+    int i = row + rows;
+    minima[i] = low;
+    maxima[i] = high;
+    for (i /= 2; i > 0; i /= 2) {
+        minima[i] = min(minima[2 * i], minima[2 * i + 1]);
+        maxima[i] = max(maxima[2 * i], maxima[2 * i + 1]);
+    }
+}
+
+// Sum of the Fenwick tree over rows 0..row-1
+double ColumnIndex::prefix(const vector<double>& tree, int row) {
+    double result = 0;
+    for (int i = row; i > 0; i -= i & -i)
+        result += tree[i];
+    return result;
+}
+
+}
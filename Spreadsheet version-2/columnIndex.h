@@ -0,0 +1,53 @@
+#ifndef COLUMN_INDEX_H
+#define COLUMN_INDEX_H
+
+#include <vector>
+#include "aggregateState.h"
+
+using namespace std;
+
+namespace spreadsheet {
+
+// Auxiliary index of one column of the ColumnStore that answers range statistics in O(log n).
+// Fenwick trees keep prefix counts, sums and sums of squares; two segment trees keep minima and maxima.
+// Sums of squares are taken around a shift (the column mean at build time) to limit cancellation
+// when the variance is small compared to the values. Every edit updates the trees in O(log n),
+// and the trees are rebuilt from the column after as many edits as the column has rows, which keeps
+// floating point drift bounded at O(1) amortized cost per edit.
+class ColumnIndex {
+public:
+    // Builds the index of a column of the given number of rows
+    ColumnIndex(const double* values, const unsigned char* mask, int rows);
+
+    // Rebuilds every tree from the column in O(n)
+    void build(const double* values, const unsigned char* mask);
+
+    // Replaces the entry of a row. Returns true if the index should be rebuilt.
+    bool update(int row, double oldValue, bool wasNumber, double newValue, bool isNumber);
+
+    // Statistics of the rows row..lastRow
+    utils::AggregateState query(int row, int lastRow) const;
+
+private:
+    // Adds the deltas to the Fenwick trees at a zero based row
+    void addToTrees(int row, double count, double sum, double square);
+
+    // Sets a leaf of the min / max segment trees and updates its ancestors
+    void setLeaf(int row, double low, double high);
+
+    // Sum of the Fenwick tree over rows 0..row-1
+    static double prefix(const vector<double>& tree, int row);
+
+    int rows;              // Number of rows of the column
+    double shift;          // Value subtracted before summing squares
+    int edits;             // Updates since the last build
+    vector<double> counts;  // Fenwick tree of the number of numeric entries
+    vector<double> sums;    // Fenwick tree of (x - shift)
+    vector<double> squares; // Fenwick tree of (x - shift)^2
+    vector<double> minima;  // Segment tree of minima, leaves at rows + i (+infinity if not numeric)
+    vector<double> maxima;  // Segment tree of maxima, leaves at rows + i (-infinity if not numeric)
+};
+
+}
+
+#endif
@@ -0,0 +1,99 @@
+#include "columnStore.h"
+
+using namespace utils;
+
+namespace spreadsheet {
+
+// Creates a store for the given number of rows and columns, all entries empty
+ColumnStore::ColumnStore(int rows, int cols)
+    : numbers(cols, vector<double>(rows, 0.0)), valid(cols, vector<unsigned char>(rows, 0)),
+      errors(cols, vector<ErrorCode>(rows, ErrorCode::none)), texts(cols, vector<int>(rows, 0)),
+      errorCounts(cols, 0), indexes(cols) {}
+
+// Stores a numeric value at the given position
+void ColumnStore::set(int row, int col, double value) {
+    write(row, col, value, true, ErrorCode::none);
+}
+
+// Marks the given position as non numeric
+void ColumnStore::clear(int row, int col) {
+    write(row, col, 0.0, false, ErrorCode::none);
+}
+
+// Marks the given position as holding an error value
+void ColumnStore::setError(int row, int col, ErrorCode code) {
+    write(row, col, 0.0, false, code);
+}
+
+// Marks the given position as holding a text
+void ColumnStore::setText(int row, int col, int id) {
+    write(row, col, 0.0, false, ErrorCode::none);
+    texts[col][row] = id;
+}
+
+// Returns the first error value found in the block
+ErrorCode ColumnStore::firstError(int row, int col, int lastRow, int lastCol) const {
+    for (int c = col; c <= lastCol; c++) {
+        if (errorCounts[c] == 0)
+            continue;
+        for (int r = row; r <= lastRow; r++)
+            if (errors[c][r] != ErrorCode::none)
+                return errors[c][r];
+    }
+    return ErrorCode::none;
+}
+
+// Writes an entry and keeps the index of its column up to date
+void ColumnStore::write(int row, int col, double value, bool isNumber, ErrorCode error) {
+    double oldValue = numbers[col][row];
+    bool wasNumber = valid[col][row];
+    numbers[col][row] = value;
+    valid[col][row] = isNumber;
+
+    errorCounts[col] += (error != ErrorCode::none) - (errors[col][row] != ErrorCode::none);
+    errors[col][row] = error;
+    texts[col][row] = 0;
+
+    ColumnIndex* columnIndex = indexes[col].get();
+    if (columnIndex && columnIndex->update(row, oldValue, wasNumber, value, isNumber))
+        columnIndex->build(values(col), mask(col));
+}
+
+// Returns a pointer to the values of a column, starting at the given row
+const double* ColumnStore::values(int col, int row) const {
+    return numbers[col].data() + row;
+}
+
+// Returns a pointer to the validity mask of a column, starting at the given row
+const unsigned char* ColumnStore::mask(int col, int row) const {
+    return valid[col].data() + row;
+}
+
+// Returns a pointer to the error values of a column, starting at the given row
+const ErrorCode* ColumnStore::errorCodes(int col, int row) const {
+    return errors[col].data() + row;
+}
+
+// Returns a pointer to the text ids of a column, starting at the given row
+const int* ColumnStore::textIds(int col, int row) const {
+    return texts[col].data() + row;
+}
+
+// Builds the auxiliary index of a column
+void ColumnStore::buildIndex(int col) {
+    if (!indexes[col])
+        indexes[col].reset(new ColumnIndex(values(col), mask(col), numbers[col].size()));
+}
+
+// Returns the auxiliary index of a column, nullptr if it has none
+const ColumnIndex* ColumnStore::index(int col) const {
+    return indexes[col].get();
+}
+
+// Drops the auxiliary indexes of every column
+void ColumnStore::clearIndexes() {
+    for (unique_ptr<ColumnIndex>& columnIndex : indexes)
+        columnIndex.reset();
+}
+
+}
@@ -0,0 +1,87 @@
+#ifndef COLUMN_STORE_H
+#define COLUMN_STORE_H
+
+#include <vector>
+#include <memory>
+#include "columnIndex.h"
+#include "errorValue.h"
+
+using namespace std;
+
+namespace spreadsheet {
+
+// Describes a change of one cell, taken from the column store when the cell notifies its dependents.
+// Cached range statistics use it to update themselves instead of rescanning the range.
+struct CellChange {
+    int row, col;         // Zero based position of the changed cell
+    double oldValue;      // Numeric value before the change
+    double newValue;      // Numeric value after the change
+    bool wasNumber;       // The cell took part in aggregates before the change
+    bool isNumber;        // The cell takes part in aggregates after the change
+};
+
+// Column-major mirror of the numeric values of the sheet.
+// Each column is a contiguous array of doubles plus a validity mask (1 = number, 0 = empty or string),
+// so range functions can run over plain memory spans instead of fetching cells one by one.
+// Invalid entries always hold 0, which lets sums skip the mask entirely.
+// Error values of formulas are kept beside the numbers; erroring cells do not count as numeric.
+// Text cells are kept as the interned id of their lower case text (see StringPool), so conditional
+// functions compare texts as integers.
+// Columns can also carry a ColumnIndex, kept up to date on every write, for O(log n) range queries.
+class ColumnStore {
+public:
+    // Creates a store for the given number of rows and columns, all entries empty
+    ColumnStore(int rows, int cols);
+
+    // Stores a numeric value at the given position
+    void set(int row, int col, double value);
+
+    // Marks the given position as non numeric
+    void clear(int row, int col);
+
+    // Marks the given position as holding an error value (non numeric)
+    void setError(int row, int col, utils::ErrorCode code);
+
+    // Marks the given position as holding a text, given by its interned id (non numeric)
+    void setText(int row, int col, int id);
+
+    // Returns the first error value found in the block, ErrorCode::none if it has none.
+    // Columns without errors are skipped without looking at their entries.
+    utils::ErrorCode firstError(int row, int col, int lastRow, int lastCol) const;
+
+    // Returns a pointer to the values of a column, starting at the given row
+    const double* values(int col, int row = 0) const;
+
+    // Returns a pointer to the validity mask of a column, starting at the given row
+    const unsigned char* mask(int col, int row = 0) const;
+
+    // Returns a pointer to the error values of a column (ErrorCode::none where there is none), starting at the given row
+    const utils::ErrorCode* errorCodes(int col, int row = 0) const;
+
+    // Returns a pointer to the text ids of a column (0 where there is no text), starting at the given row
+    const int* textIds(int col, int row = 0) const;
+
+    // Builds the auxiliary index of a column (no-op if it already has one)
+    void buildIndex(int col);
+
+    // Returns the auxiliary index of a column, nullptr if it has none
+    const ColumnIndex* index(int col) const;
+
+    // Drops the auxiliary indexes of every column
+    void clearIndexes();
+
+private:
+    // Writes an entry and keeps the index of its column up to date
+    void write(int row, int col, double value, bool isNumber, utils::ErrorCode error);
+
+    vector<vector<double>> numbers;       // numbers[col][row]
+    vector<vector<unsigned char>> valid;  // valid[col][row]
+    vector<vector<utils::ErrorCode>> errors; // errors[col][row]
+    vector<vector<int>> texts;            // texts[col][row], interned text id or 0
+    vector<int> errorCounts;              // Number of error values in each column
+    vector<unique_ptr<ColumnIndex>> indexes; // Optional index of each column
+};
+
+}
+
+#endif
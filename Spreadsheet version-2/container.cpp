@@ -76,7 +76,7 @@ namespace utils {
 
     // Overloading the [] operator to access an element at the given index (const version)
     template<class T>
-    T Container<T>::operator[](int index) const {
+    const T& Container<T>::operator[](int index) const {
         if (index < 0 || index >= sizee) {  // Validate the index
             throw out_of_range("");  // Throw an exception if the index is out of range
         }
@@ -122,6 +122,18 @@ namespace utils {
         return data.get() + sizee;  // Return the raw pointer to the end of the data
     }
 
+    // Function to return a const iterator to the beginning of the container
+    template<class T>
+    const T* Container<T>::begin() const {
+        return data.get();
+    }
+
+    // Function to return a const iterator to the end of the container
+    template<class T>
+    const T* Container<T>::end() const {
+        return data.get() + sizee;
+    }
+
     // Function to return the number of elements in the container
     template<class T>
     int Container<T>::size() const {
@@ -37,7 +37,7 @@ class Container{
     T& operator[](int index);
     
     // Index operator to access an element by index (const version)
-    T operator[](int index) const ;
+    const T& operator[](int index) const ;
 
     // Erase an element at the specified position
     auto erase(T* pos);
@@ -50,6 +50,10 @@ class Container{
 
     // Return an iterator to the end of the container
     auto end();
+
+    // Const versions of the iterators
+    const T* begin() const;
+    const T* end() const;
         
     // Return the number of elements in the container
     int size() const;
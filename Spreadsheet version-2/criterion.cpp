@@ -0,0 +1,88 @@
+#include "criterion.h"
+#include "cell.h"
+#include "stringPool.h"
+#include <cstdlib>
+
+using namespace spreadsheet;
+
+namespace utils {
+
+// Criterion matching the numbers equal to the value
+Criterion Criteria::fromNumber(double value) {
+    Criterion criterion;
+    criterion.number = value;
+    return criterion;
+}
+
+// Parses the operator, then reads the operand as a number if all of it is one, as a text otherwise
+Criterion Criteria::parse(const string& text) {
+    Criterion criterion;
+    size_t pos = 0;
+    if (text.compare(0, 2, "<=") == 0) { criterion.op = CompareOp::lessEqual; pos = 2; }
+    else if (text.compare(0, 2, ">=") == 0) { criterion.op = CompareOp::greaterEqual; pos = 2; }
+    else if (text.compare(0, 2, "<>") == 0) { criterion.op = CompareOp::notEqual; pos = 2; }
+    else if (text.compare(0, 1, "<") == 0) { criterion.op = CompareOp::less; pos = 1; }
+    else if (text.compare(0, 1, ">") == 0) { criterion.op = CompareOp::greater; pos = 1; }
+    else if (text.compare(0, 1, "=") == 0) { criterion.op = CompareOp::equal; pos = 1; }
+
+    string operand = text.substr(pos);
+    char* end = nullptr;
+    double value = strtod(operand.c_str(), &end);
+    if (!operand.empty() && *end == '\0') {
+        criterion.number = value;
+        return criterion;
+    }
+    criterion.text = true;
+    criterion.textId = StringPool::intern(StringPool::fold(operand));
+    return criterion;
+}
+
+// Reads the criterion held by a cell
+Criterion Criteria::fromCell(const Cell* cell) {
+    if (cell->getType() == Type::string)
+        return parse(cell->getValue());
+    return fromNumber(cell->getNumber());
+}
+
+// Applies the criterion to a column span. Numbers and text equality run on the vectorized kernels;
+// text ordering (like ">m") compares the interned texts one by one.
+void Criteria::select(const ColumnStore& store, int col, int row, int n, const Criterion& criterion,
+                      unsigned char* selected) {
+    const double* values = store.values(col, row);
+    const unsigned char* mask = store.mask(col, row);
+    const int* ids = store.textIds(col, row);
+
+    if (!criterion.text) {
+        RangeKernels::compare(values, mask, n, criterion.op, criterion.number, selected);
+        return;
+    }
+
+    // Empty operand: blank cells hold neither a number nor a text
+    if (criterion.textId == 0 && (criterion.op == CompareOp::equal || criterion.op == CompareOp::notEqual)) {
+        bool blank = criterion.op == CompareOp::equal;
+        for (int i = 0; i < n; i++)
+            selected[i] &= ((ids[i] == 0 && !mask[i]) == blank);
+        return;
+    }
+
+    if (criterion.op == CompareOp::equal || criterion.op == CompareOp::notEqual) {
+        RangeKernels::matchIds(ids, n, criterion.textId, criterion.op == CompareOp::equal, selected);
+        return;
+    }
+
+    const string& operand = StringPool::get(criterion.textId);
+    for (int i = 0; i < n; i++) {
+        if (!selected[i])
+            continue;
+        if (ids[i] == 0) {
+            selected[i] = 0;
+            continue;
+        }
+        int order = StringPool::get(ids[i]).compare(operand);
+        bool hit = (criterion.op == CompareOp::less && order < 0) || (criterion.op == CompareOp::lessEqual && order <= 0) ||
+                   (criterion.op == CompareOp::greater && order > 0) || (criterion.op == CompareOp::greaterEqual && order >= 0);
+        selected[i] = hit;
+    }
+}
+
+}
@@ -0,0 +1,45 @@
+#ifndef CRITERION_H
+#define CRITERION_H
+
+#include <string>
+#include "rangeKernels.h"
+#include "columnStore.h"
+
+using namespace std;
+
+namespace spreadsheet {
+    class Cell;
+}
+
+namespace utils {
+
+// A condition of the conditional functions (SUMIF, COUNTIF, ...), like 5, ">10" or "<>apple"
+struct Criterion {
+    CompareOp op = CompareOp::equal;
+    bool text = false;  // Compares texts rather than numbers
+    double number = 0;  // Operand of a numeric criterion
+    int textId = 0;     // Interned lower case operand of a text criterion (see StringPool)
+};
+
+// Reading and applying criteria. Criteria are applied to whole column spans of the ColumnStore with the
+// vectorized predicate kernels: numbers are compared as doubles, texts as interned ids, without case.
+class Criteria {
+public:
+    // Criterion matching the numbers equal to the value
+    static Criterion fromNumber(double value);
+
+    // Parses a criterion written as text: an optional operator (=, <>, <, <=, >, >=) followed by a number or a text.
+    // "=" alone matches empty cells and "<>" alone matches cells that are not empty.
+    static Criterion parse(const string& text);
+
+    // Reads the criterion held by a cell: a text is parsed, anything else matches numbers equal to its value
+    static Criterion fromCell(const spreadsheet::Cell* cell);
+
+    // Clears the entries of 'selected' (rows row..row+n-1 of the column) whose cell does not meet the criterion
+    static void select(const spreadsheet::ColumnStore& store, int col, int row, int n, const Criterion& criterion,
+                       unsigned char* selected);
+};
+
+}
+
+#endif
@@ -0,0 +1,29 @@
+#include "errorValue.h"
+
+namespace utils {
+
+// Returns the text shown for the error
+string ErrorValue::toString(ErrorCode code) {
+    switch (code) {
+        case ErrorCode::divZero:
+            return "#DIV/0!";
+        case ErrorCode::ref:
+            return "#REF!";
+        case ErrorCode::cycle:
+            return "#CYCLE!";
+        case ErrorCode::notAvailable:
+            return "#N/A";
+        case ErrorCode::value:
+            return "#VALUE!";
+        case ErrorCode::spill:
+            return "#SPILL!";
+        case ErrorCode::num:
+            return "#NUM!";
+        case ErrorCode::name:
+            return "#NAME?";
+        default:
+            return "";
+    }
+}
+
+}
@@ -0,0 +1,33 @@
+#ifndef ERROR_VALUE_H
+#define ERROR_VALUE_H
+
+#include <string>
+
+using namespace std;
+
+namespace utils {
+
+// Typed error values of a formula. They are stored in the formula cell instead of throwing, and any
+// formula that reads an erroring cell or a range containing one evaluates to the same error.
+enum class ErrorCode : unsigned char {
+    none,         // The formula has a value
+    divZero,      // #DIV/0!  division by zero
+    ref,          // #REF!    reference outside the sheet
+    cycle,        // #CYCLE!  the formula depends on itself
+    notAvailable, // #N/A     a lookup found no matching key
+    value,        // #VALUE!  arguments of the wrong shape (like ranges of different sizes)
+    spill,        // #SPILL!  the cells an array formula spills into are not empty
+    num,          // #NUM!    no numeric result (like the inverse of a singular matrix)
+    name          // #NAME?   a name that is not defined
+};
+
+// Conversions of error values for display and export
+class ErrorValue {
+public:
+    // Returns the text shown for the error ("#DIV/0!", "#REF!", "#CYCLE!", "#N/A", "#VALUE!", "#SPILL!", "#NUM!", "#NAME?"), empty for ErrorCode::none
+    static string toString(ErrorCode code);
+};
+
+}
+
+#endif
@@ -1,10 +1,13 @@
 #include "fileManager.h"
+#include "functionRegistry.h"
 #include <fstream>
 #include <vector>
 #include <string>
 #include <iostream>
 #include <sstream>
 #include <stdexcept>
+#include <filesystem>
+#include <algorithm>
 using namespace spreadsheet;
 using namespace utils;
 using namespace spreadsheet;
@@ -25,12 +28,12 @@ void FileManager::saveAsCSV(SpreadSheet& table, const string& filename) {
 
             string cellContent = table.getCell(row, col)->getContent();
 
-            // Check if the cell content is a formula (starts with '@').
-            if (!cellContent.empty() && cellContent[0] == '@') {
+            // Check if the cell content is a formula (starts with '@' or '=', which may call functions too).
+            if (!cellContent.empty() && (cellContent[0] == '@' || cellContent[0] == '=')) {
                 cellContent = convertToExcelFormula(cellContent);
             }
 
-            file << cellContent;
+            file << quote(cellContent);
         }
         file << "\n"; // Add a newline at the end of the row.
     }
@@ -40,41 +43,94 @@ void FileManager::saveAsCSV(SpreadSheet& table, const string& filename) {
 
 // Loads spreadsheet content from a CSV file.
 void FileManager::loadFromCSV(SpreadSheet& table, const string& filename) {
+    vector<vector<string>> contents = readCSV(filename);
+
+    for (int row = 0; row < (int)contents.size(); ++row) {
+        int col = 0;
+        for (const string& cellContent : contents[row]) {
+            table.setContent(row , col ,cellContent);
+            ++col;
+        }
+
+        // Set remaining cells in the row to empty if there are fewer columns.
+        while (col < table.getNumCols()) {
+            table.setContent(row , col ,"");
+            ++col;
+        }
+    }
+}
+
+// Reads the cells of a CSV file row by row.
+vector<vector<string>> FileManager::readCSV(const string& filename) {
     ifstream file(filename);
     if (!file.is_open()) {
         throw runtime_error("Failed to open file.");
     }
 
+    vector<vector<string>> contents;
     string line;
-    int row = 0;
 
     // Read the file line by line.
     while (getline(file, line)) {
-        istringstream ss(line);
-        string cellContent;
-        int col = 0;
-
         // Split the line by commas to get cell contents.
-        while (getline(ss, cellContent, ',')) {
+        contents.push_back(splitLine(line));
+        for (string& cellContent : contents.back()) {
             // Convert Excel formula to internal representation if necessary.
             if (!cellContent.empty() && cellContent[0] == '=') {
                 cellContent = convertToInternalFormula(cellContent);
             }
-            table.setContent(row , col ,cellContent);
-            
-            ++col;
         }
+    }
 
-        // Set remaining cells in the row to empty if there are fewer columns.
-        while (col < table.getNumCols()) {
-            table.setContent(row , col ,"");
-            ++col;
-        }
+    file.close(); // Close the file after reading.
+    return contents;
+}
+
+// Saves every sheet as a CSV file of the directory.
+void FileManager::saveDirectory(Workbook& book, const string& directory) {
+    filesystem::create_directories(directory);
+    for (int i = 0; i < book.size(); i++)
+        saveAsCSV(book.getSheet(i), directory + "/" + book.getSheetName(i) + ".csv");
+}
+
+// Loads the CSV files of the directory, in the order of their names. The sheets are placed one after the
+// other without evaluating anything; then the groups of sheets that read each other recalculate concurrently.
+void FileManager::loadDirectory(Workbook& book, const string& directory) {
+    vector<pair<string, string>> files; // Sheet name and path of every file
+    error_code failure;
+    for (const filesystem::directory_entry& entry : filesystem::directory_iterator(directory, failure)) {
+        string name = entry.path().stem().string();
+        if (entry.path().extension() == ".csv" && Workbook::isSheetName(name))
+            files.push_back({name, entry.path().string()});
+    }
+    if (failure || files.empty()) {
+        throw runtime_error("Failed to open file.");
+    }
+    std::sort(files.begin(), files.end());
 
-        ++row;
+    // Every sheet exists before any formula is compiled, so a formula may read a sheet that comes after it
+    vector<int> sheets;
+    for (const pair<string, string>& file : files) {
+        int index = book.find(file.first);
+        sheets.push_back(index >= 0 ? index : book.addSheet(file.first));
     }
+    for (size_t i = 0; i < files.size(); i++)
+        book.getSheet(sheets[i]).load(readCSV(files[i].second));
+    book.recalculate();
+}
 
-    file.close(); // Close the file after reading.
+// Shows the sheet with the name.
+void FileManager::selectSheet(Workbook& book, const string& name) {
+    int index = book.find(name);
+    book.setActive(index >= 0 ? index : book.addSheet(name));
+}
+
+// Returns the workbook of the table.
+Workbook& FileManager::workbookOf(SpreadSheet& table) {
+    if (table.getWorkbook() == nullptr) {
+        throw invalid_argument("Invalid Sheet.");
+    }
+    return *table.getWorkbook();
 }
 
  void FileManager::createNewFile(SpreadSheet& table, const std::string& filename) {
@@ -96,7 +152,7 @@ void FileManager::loadFromCSV(SpreadSheet& table, const string& filename) {
     file.close(); // Close the file after writing.
 }
 
-// Handles file operations based on the command (&SAVE or &LOAD).
+// Handles file operations based on the command (&SAVE, &LOAD, &NEW, &SAVEDIR, &LOADDIR or &SHEET).
 void FileManager::fileHandle(SpreadSheet& table, const string& filename) {
     string str = "", name;
     int i = 0;
@@ -122,6 +178,17 @@ void FileManager::fileHandle(SpreadSheet& table, const string& filename) {
             name = filename.substr(i);
             createNewFile(table, name);
         }
+        // &SAVEDIR and &LOADDIR take a directory with one CSV file per sheet of the workbook.
+        else if (str == "&SAVEDIR") {
+            saveDirectory(workbookOf(table), filename.substr(i));
+        }
+        else if (str == "&LOADDIR") {
+            loadDirectory(workbookOf(table), filename.substr(i));
+        }
+        // If the command is &SHEET, show the sheet with the given name.
+        else if (str == "&SHEET") {
+            selectSheet(workbookOf(table), filename.substr(i));
+        }
     }
     catch(exception& e){
         throw;
@@ -130,50 +197,129 @@ void FileManager::fileHandle(SpreadSheet& table, const string& filename) {
 }
 
 string FileManager::convertToExcelFormula(const string& formula) {
-    vector<string> originalFunctions = {"@SUM", "@MAX", "@MIN", "@AVER", "@STDDEV"};
-    vector<string> excelFunctions = {"=SUM", "=MAX", "=MIN", "=AVERAGE", "=STDEV"};
+    string result = "";
 
-    string result = formula;
-
-    // Replace the function name.
-    for (int i = 0; i < originalFunctions.size(); ++i) {
-        int pos = result.find(originalFunctions[i]);
-        if (pos != string::npos) {
-            result.replace(pos, originalFunctions[i].length(), excelFunctions[i]);
-            break;
+    for (size_t i = 0; i < formula.size(); ) {
+        char ch = formula[i];
+        if (ch == '"') {
+            // Quoted criterion, copied as it is (a doubled quote inside reopens it right away)
+            size_t close = formula.find('"', i + 1);
+            close = (close == string::npos) ? formula.size() : close + 1;
+            result += formula.substr(i, close - i);
+            i = close;
         }
-    }
-
-    // Replace ".." with ":" for range compatibility in Excel.
-    int rangePos = result.find("..");
-    if (rangePos != string::npos) {
-        result.replace(rangePos, 2, ":");
+        else if (ch == '@') {
+            // Replace every function name, the leading one and the nested ones, with its Excel name from the
+            // function registry. A leading '@' becomes the '=' of Excel formulas.
+            string name = functionName(formula.substr(i));
+            const FunctionInfo* info = FunctionRegistry::find(name);
+            result += (i == 0) ? "=" : (info != nullptr) ? "" : "@";
+            if (info != nullptr) {
+                result += info->excelName;
+                i += name.length();
+            }
+            i++;
+        }
+        else if (formula.compare(i, 2, "..") == 0) {
+            // Replace ".." with ":" for range compatibility in Excel (lookups take more than one range).
+            result += ':';
+            i += 2;
+        }
+        else
+            result += formula[i++];
     }
 
     return result;
 }
 
 string FileManager::convertToInternalFormula(const string& formula) {
-    
-    vector<string> excelFunctions = {"=SUM", "=MAX", "=MIN", "=AVERAGE", "=STDEV"};
-    vector<string> internalFunctions = {"@SUM", "@MAX", "@MIN", "@AVER", "@STDDEV"};
-
-    string result = formula;
+    string result = "";
 
-    // Replace Excel function names with internal function names.
-    for (int i = 0; i < excelFunctions.size(); ++i) {
-        int pos = result.find(excelFunctions[i]);
-        if (pos != string::npos) {
-            result.replace(pos, excelFunctions[i].length(), internalFunctions[i]);
-            break;
+    for (size_t i = 0; i < formula.size(); ) {
+        char ch = formula[i];
+        bool startsWord = (i == 0 || (!isalnum(formula[i - 1]) && formula[i - 1] != '_' && formula[i - 1] != '@'));
+        if (ch == '"') {
+            size_t close = formula.find('"', i + 1);
+            close = (close == string::npos) ? formula.size() : close + 1;
+            result += formula.substr(i, close - i);
+            i = close;
+        }
+        else if (i > 0 && startsWord && isupper(ch)) {
+            // Replace every Excel function name with the internal one from the function registry. Calls get
+            // their '@'; a leading call makes an '@' formula.
+            string name = functionName(formula.substr(i - 1));
+            const FunctionInfo* info = FunctionRegistry::findExcel(name);
+            if (info != nullptr) {
+                if (i == 1)
+                    result.clear();
+                result += '@';
+                result += info->name;
+                i += name.length();
+            }
+            else
+                result += formula[i++];
         }
+        else if (ch == ':') {
+            // Replace ":" with ".." for range compatibility in the internal format.
+            result += "..";
+            i++;
+        }
+        else
+            result += formula[i++];
     }
 
-    // Replace ":" with ".." for range compatibility in the internal format.
-    int rangePos = result.find(":");
-    if (rangePos != string::npos) {
-        result.replace(rangePos, 1, "..");
+    return result;
+}
+
+// Returns the function name that follows the leading '@' or '=' of a formula (empty if there is none).
+string FileManager::functionName(const string& formula) {
+    string name = "";
+    for (size_t i = 1; i < formula.size() && isalpha(formula[i]); i++)
+        name += formula[i];
+    if (name.length() + 1 >= formula.size() || formula[name.length() + 1] != '(')
+        return "";
+    return name;
+}
+
+// Quotes a field that contains commas (like the arguments of a lookup) or quotes, doubling inner quotes.
+string FileManager::quote(const string& field) {
+    if (field.find_first_of(",\"") == string::npos)
+        return field;
+    string result = "\"";
+    for (char ch : field) {
+        if (ch == '"')
+            result += '"';
+        result += ch;
     }
+    return result + "\"";
+}
 
-    return result;
+// Splits a CSV line at the commas that are not inside a quoted field.
+vector<string> FileManager::splitLine(const string& line) {
+    vector<string> fields;
+    string field = "";
+    bool quoted = false;
+    for (size_t i = 0; i < line.size(); i++) {
+        char ch = line[i];
+        if (quoted) {
+            if (ch == '"' && i + 1 < line.size() && line[i + 1] == '"')
+                field += line[++i]; // Doubled quote inside a quoted field
+            else if (ch == '"')
+                quoted = false;
+            else
+                field += ch;
+        }
+        else if (ch == '"')
+            quoted = true;
+        else if (ch == ',') {
+            fields.push_back(field);
+            field = "";
+        }
+        else
+            field += ch;
+    }
+    // Like getline, a trailing comma does not start another field
+    if (!field.empty() || (!line.empty() && line.back() != ','))
+        fields.push_back(field);
+    return fields;
 }
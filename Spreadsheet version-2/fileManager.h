@@ -2,7 +2,9 @@
 #define FILEMANAGER_H
 
 #include "spreadSheet.h"
+#include "workbook.h"
 #include <string>
+#include <vector>
 
 using namespace std;
 using namespace spreadsheet;
@@ -11,6 +13,8 @@ class FileManager{
  public:
    // Public method to handle file operations for the spreadsheet.
    // Depending on the use case, it may load from or save to a file.
+   // &SAVEDIR and &LOADDIR save and load every sheet of the workbook of the table as a directory of CSV files,
+   // and &SHEET shows another sheet of the workbook, adding it if needed.
    static void fileHandle(SpreadSheet& table,const string & filename);
   
   private:
@@ -20,6 +24,22 @@ class FileManager{
    // Saves the spreadsheet data to a CSV file.
    static void saveAsCSV(SpreadSheet& table, const string & filename);
 
+   // Saves every sheet of the workbook into the directory, as <sheet name>.csv
+   static void saveDirectory(Workbook& book, const string& directory);
+
+   // Loads every <sheet name>.csv file of the directory into the sheet of that name, adding the missing sheets.
+   // All the sheets are placed first, so formulas may read any of them; then the workbook recalculates once.
+   static void loadDirectory(Workbook& book, const string& directory);
+
+   // Shows the sheet with the name, adding it if the workbook has none
+   static void selectSheet(Workbook& book, const string& name);
+
+   // Returns the workbook of the table; throws invalid_argument for a table on its own
+   static Workbook& workbookOf(SpreadSheet& table);
+
+   // Reads the contents of a CSV file, with formulas in the internal format.
+   static vector<vector<string>> readCSV(const string& filename);
+
    // Create new file
    static void createNewFile(SpreadSheet& table, const string & filename);
 
@@ -29,6 +49,15 @@ class FileManager{
    // Converts an Excel-compatible formula to an internal formula format.
    static string convertToInternalFormula(const string& formula);
 
+   // Returns the function name that follows the leading '@' or '=' of a formula.
+   static string functionName(const string& formula);
+
+   // Quotes a CSV field that contains commas or quotes.
+   static string quote(const string& field);
+
+   // Splits a CSV line into its fields, keeping commas inside quoted fields.
+   static vector<string> splitLine(const string& line);
+
 
 };
 
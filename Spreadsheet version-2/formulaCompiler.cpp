@@ -0,0 +1,1750 @@
+#include "formulaCompiler.h"
+#include "spreadSheet.h"
+#include "workbook.h"
+#include "functionRegistry.h"
+#include "rangeKernels.h"
+#include "matrixKernels.h"
+#include "cellAddress.h"
+#include <algorithm>
+#include <map>
+#include <tuple>
+#include <cmath>
+#include <cstdlib>
+#include <cctype>
+#include <stdexcept>
+
+using namespace spreadsheet;
+using namespace std;
+
+namespace utils {
+
+// Shape of a single value
+static const pair<int, int> SINGLE = {0, 0};
+
+// Moves the relative parts of the single reference of an instruction by (rows, cols)
+static void shift(Instruction& in, int rows, int cols) {
+    bool single = in.op == OpCode::pushCell || ((in.op == OpCode::criterion || in.op == OpCode::lookup) && in.row >= 0);
+    if (!single)
+        return;
+    if (!(in.absolute & absoluteRow)) in.row += rows;
+    if (!(in.absolute & absoluteCol)) in.col += cols;
+    in.lastRow = in.row;
+    in.lastCol = in.col;
+}
+
+// Returns true if nothing has been compiled yet
+bool CompiledFormula::empty() const {
+    return code.empty();
+}
+
+// Returns the instructions of the program
+const vector<Instruction>& CompiledFormula::getCode() const {
+    return code;
+}
+
+// Visits the instructions of the program, then those of its argument programs
+void CompiledFormula::forEach(const function<void(const Instruction&)>& visit, int rows, int cols) const {
+    for (const Instruction& in : code) {
+        if (rows == 0 && cols == 0) {
+            visit(in);
+            continue;
+        }
+        Instruction moved = in;
+        shift(moved, rows, cols);
+        visit(moved);
+    }
+    for (const CompiledFormula& operand : operands)
+        operand.forEach(visit, rows, cols);
+}
+
+// Returns true if the program only reads single cells of its sheet, with no branches or sheet names
+bool CompiledFormula::isShareable() const {
+    if (code.empty() || array || !operands.empty() || !branches.empty() || !names.empty())
+        return false;
+    for (const Instruction& in : code) {
+        switch (in.op) {
+            case OpCode::pushConst:
+            case OpCode::pushCell:
+            case OpCode::negate:
+            case OpCode::add:
+            case OpCode::subtract:
+            case OpCode::multiply:
+            case OpCode::divide:
+            case OpCode::equal:
+            case OpCode::notEqual:
+            case OpCode::less:
+            case OpCode::lessEqual:
+            case OpCode::greater:
+            case OpCode::greaterEqual:
+            case OpCode::store:
+            case OpCode::load:
+                break;
+            default:
+                return false;
+        }
+    }
+    return true;
+}
+
+// Returns true if the moved single references are all on the sheet
+bool CompiledFormula::fits(int rows, int cols, const SpreadSheet& table) const {
+    for (Instruction in : code) {
+        if (in.op != OpCode::pushCell)
+            continue;
+        shift(in, rows, cols);
+        if (in.row < 0 || in.col < 0 || in.row >= table.getNumRows() || in.col >= table.getNumCols())
+            return false;
+    }
+    return true;
+}
+
+// Returns true if the program computes an array
+bool CompiledFormula::isArray() const {
+    return array;
+}
+
+// Returns the number of rows of the result
+int CompiledFormula::getRows() const {
+    return rows;
+}
+
+// Returns the number of columns of the result
+int CompiledFormula::getCols() const {
+    return cols;
+}
+
+// Runs the postfix program. The stack was sized at compile time, so no allocation happens here.
+// Errors never throw: the first error met (in left to right order) is kept and the value computed
+// alongside it is discarded by the caller.
+double CompiledFormula::evaluate(SpreadSheet& table, ErrorCode& error, int rows, int cols) const {
+    fill(taken.begin(), taken.end(), 0);
+    return run(table, 0, code.size(), error, rows, cols);
+}
+
+// Returns the ids of the sheet names compiled into the program
+const vector<int>& CompiledFormula::getNames() const {
+    return names;
+}
+
+// Returns true if the last evaluation ran an instruction that reads the cell. An instruction ran if every
+// branch around it was taken; branches nest, so they are simply all checked.
+bool CompiledFormula::reads(int row, int col) const {
+    if (branches.empty() || !operands.empty())
+        return true;
+    for (size_t i = 0; i < code.size(); i++) {
+        const Instruction& in = code[i];
+        // References on other sheets match by position too, which only ever evaluates the formula once more
+        bool single = in.op == OpCode::pushCell || in.op == OpCode::pushSheetCell || (in.op == OpCode::criterion && in.row >= 0);
+        bool block = in.op == OpCode::aggregate || in.op == OpCode::pushRange || in.op == OpCode::pushArray ||
+                     in.op == OpCode::sheetAggregate;
+        if (!(single && in.row == row && in.col == col) &&
+            !(block && row >= in.row && row <= in.lastRow && col >= in.col && col <= in.lastCol))
+            continue;
+        bool ran = true;
+        for (size_t b = 0; b < branches.size() && ran; b++)
+            if ((int)i >= branches[b].first && (int)i < branches[b].second && !taken[b])
+                ran = false;
+        if (ran)
+            return true;
+    }
+    return false;
+}
+
+// Runs a part of a single valued program
+double CompiledFormula::run(SpreadSheet& table, size_t begin, size_t end, ErrorCode& error, int rows, int cols) const {
+    double* top = stack.data(); // Points one past the top of the stack
+    error = ErrorCode::none;
+
+    for (size_t i = begin; i < end; i++) {
+        const Instruction& in = code[i];
+        switch (in.op) {
+            case OpCode::pushConst:
+                *top++ = in.value;
+                break;
+            case OpCode::pushCell: {
+                const Cell* cell = table.getCell((in.absolute & absoluteRow) ? in.row : in.row + rows,
+                                                 (in.absolute & absoluteCol) ? in.col : in.col + cols);
+                if (error == ErrorCode::none)
+                    error = cell->getError();
+                *top++ = cell->getNumber();
+            } break;
+            case OpCode::pushError:
+                if (error == ErrorCode::none)
+                    error = (ErrorCode)(int)in.value;
+                *top++ = 0.0;
+                break;
+            case OpCode::aggregate:
+                if (error == ErrorCode::none)
+                    error = table.getRangeError(in.range);
+                *top++ = aggregate(table, in);
+                break;
+            case OpCode::pushRange:
+                *top++ = in.range;
+                break;
+            case OpCode::pushSheetCell: {
+                const Cell* cell = table.getWorkbook()->getSheet((int)in.value).getCell(in.row, in.col);
+                if (error == ErrorCode::none)
+                    error = cell->getError();
+                *top++ = cell->getNumber();
+            } break;
+            case OpCode::sheetAggregate: {
+                SpreadSheet& sheet = table.getWorkbook()->getSheet((int)in.value);
+                if (error == ErrorCode::none)
+                    error = sheet.getRangeError(in.range);
+                *top++ = aggregate(sheet, in);
+            } break;
+            case OpCode::lookup: {
+                int count = (int)in.value;
+                top -= count;
+                // Range arguments hold node ids only while no argument has failed
+                ErrorCode found = ErrorCode::none;
+                double result = 0.0;
+                if (error == ErrorCode::none)
+                    result = FunctionRegistry::get(in.func).evaluate(table, in, top, count, criteria.data(), found);
+                if (error == ErrorCode::none)
+                    error = found;
+                *top++ = result;
+            } break;
+            case OpCode::criterion: {
+                // Quoted criteria were parsed at compile time and stay in their slot
+                Criterion& criterion = criteria[in.range];
+                if (in.row >= 0) {
+                    const Cell* cell = table.getCell(in.row, in.col);
+                    if (error == ErrorCode::none)
+                        error = cell->getError();
+                    criterion = Criteria::fromCell(cell);
+                }
+                else if (in.value != 0)
+                    criterion = Criteria::fromNumber(*--top);
+                *top++ = in.range;
+            } break;
+            case OpCode::negate:
+                top[-1] = 0.0 - top[-1];  // As for arrays, so that the negation of 0 is 0 rather than -0
+                break;
+            case OpCode::add:
+                --top;
+                top[-1] += *top;
+                break;
+            case OpCode::subtract:
+                --top;
+                top[-1] -= *top;
+                break;
+            case OpCode::multiply:
+                --top;
+                top[-1] *= *top;
+                break;
+            case OpCode::divide:
+                --top;
+                if (*top == 0) {
+                    if (error == ErrorCode::none)
+                        error = ErrorCode::divZero;
+                    top[-1] = 0.0;
+                    break;
+                }
+                top[-1] /= *top;
+                break;
+            case OpCode::equal:
+                --top;
+                top[-1] = top[-1] == *top;
+                break;
+            case OpCode::notEqual:
+                --top;
+                top[-1] = top[-1] != *top;
+                break;
+            case OpCode::less:
+                --top;
+                top[-1] = top[-1] < *top;
+                break;
+            case OpCode::lessEqual:
+                --top;
+                top[-1] = top[-1] <= *top;
+                break;
+            case OpCode::greater:
+                --top;
+                top[-1] = top[-1] > *top;
+                break;
+            case OpCode::greaterEqual:
+                --top;
+                top[-1] = top[-1] >= *top;
+                break;
+            // The loop steps past the instruction, so a jump lands one before its target
+            case OpCode::jumpIfFalse:
+                if (*--top == 0)
+                    i = in.range - 1;
+                break;
+            case OpCode::jump:
+                i = in.range - 1;
+                break;
+            case OpCode::choose: {
+                // The index is truncated; out of range it lands on the #VALUE! result after the jumps
+                double k = trunc(*--top);
+                i += (k >= 1 && k <= in.value) ? (size_t)k - 1 : (size_t)in.value;
+            } break;
+            case OpCode::enter:
+                taken[in.range] = 1;
+                break;
+            case OpCode::store:
+                locals[in.range] = top[-1];
+                break;
+            case OpCode::load:
+                *top++ = locals[in.range];
+                break;
+            case OpCode::pushArray:
+            case OpCode::broadcast:
+            case OpCode::matrix:
+                break;  // Only in array programs, run by evaluateArray
+        }
+    }
+    return stack[0];
+}
+
+// Runs the array program one column and one chunk of rows at a time, so the operands of a chunk stay in
+// the L1 cache. Block operands point straight into the column store; every operator writes into the buffer
+// of its left operand's slot. Error values are tracked per element only for operands that have some.
+void CompiledFormula::evaluateArray(SpreadSheet& table, double* values, ErrorCode* errors) const {
+    const ColumnStore& store = table.getStore();
+    fill(taken.begin(), taken.end(), 0);
+
+    // Matrix functions need whole arguments, so their results are computed first
+    for (const Instruction& in : code)
+        if (in.op == OpCode::matrix)
+            computeMatrix(table, in);
+
+    // Single valued operands do not depend on the element, they are computed first
+    size_t spread = 0;
+    for (size_t i = 0; i < code.size(); i++) {
+        if (code[i].op != OpCode::broadcast)
+            continue;
+        size_t length = (size_t)code[i].value;
+        spreadValues[spread] = run(table, i + 1, i + 1 + length, spreadErrors[spread]);
+        if (spreadErrors[spread] != ErrorCode::none)
+            spreadValues[spread] = 0.0;
+        spread++;
+        i += length;
+    }
+
+    for (int j = 0; j < cols; j++) {
+        for (int first = 0; first < rows; first += ARRAY_CHUNK) {
+            int n = min(ARRAY_CHUNK, rows - first);
+            Lane* top = lanes.data(); // Points one past the top of the operand stack
+            spread = 0;
+
+            for (size_t i = 0; i < code.size(); i++) {
+                const Instruction& in = code[i];
+                switch (in.op) {
+                    case OpCode::broadcast:
+                        *top++ = {&spreadValues[spread],
+                                  spreadErrors[spread] != ErrorCode::none ? &spreadErrors[spread] : nullptr, true};
+                        spread++;
+                        i += (size_t)in.value;
+                        break;
+                    case OpCode::pushArray: {
+                        int row = in.row + first, col = in.col + j;
+                        bool failed = store.firstError(row, col, row + n - 1, col) != ErrorCode::none;
+                        *top++ = {store.values(col, row), failed ? store.errorCodes(col, row) : nullptr, false};
+                    } break;
+                    case OpCode::matrix: {
+                        size_t offset = (size_t)j * rows + first;
+                        *top++ = {matrixValues[in.range].data() + offset,
+                                  matrixFailed[in.range] ? matrixErrors[in.range].data() + offset : nullptr, false};
+                    } break;
+                    case OpCode::negate:
+                    case OpCode::add:
+                    case OpCode::subtract:
+                    case OpCode::multiply:
+                    case OpCode::divide: {
+                        // Negation is 0 - x, so that -0 does not appear
+                        static const double zero = 0.0;
+                        Lane right = (in.op == OpCode::negate) ? top[-1] : *--top;
+                        Lane left = (in.op == OpCode::negate) ? Lane{&zero, nullptr, true} : top[-1];
+                        size_t slot = top - 1 - lanes.data();
+                        OpCode op = (in.op == OpCode::negate) ? OpCode::subtract : in.op;
+                        top[-1] = combine(op, left, right, laneValues.data() + slot * ARRAY_CHUNK,
+                                          laneErrors.data() + slot * ARRAY_CHUNK, n);
+                    } break;
+                    default:
+                        break;  // Single valued instructions only appear behind a broadcast
+                }
+            }
+
+            const Lane& result = lanes[0];
+            double* target = values + (size_t)j * rows + first;
+            ErrorCode* targetErrors = errors + (size_t)j * rows + first;
+            for (int e = 0; e < n; e++) {
+                target[e] = result.values[result.spread ? 0 : e];
+                targetErrors[e] = result.errors ? result.errors[result.spread ? 0 : e] : ErrorCode::none;
+            }
+        }
+    }
+}
+
+// Runs the shared program over the family a chunk of rows at a time. Every slot of the stack and every local
+// has a chunk buffer; the buffers of array programs are used, as a shared program has none of its own.
+void CompiledFormula::evaluateFamily(SpreadSheet& table, int rows, int cols, int count,
+                                     double* values, ErrorCode* errors) const {
+    const ColumnStore& store = table.getStore();
+    size_t slots = stack.size() + locals.size();
+    lanes.resize(slots);
+    laneValues.resize(slots * ARRAY_CHUNK);
+    laneErrors.resize(slots * ARRAY_CHUNK);
+    Lane* saved = lanes.data() + stack.size(); // Values of the locals
+
+    for (int first = 0; first < count; first += ARRAY_CHUNK) {
+        int n = min(ARRAY_CHUNK, count - first);
+        Lane* top = lanes.data(); // Points one past the top of the operand stack
+
+        for (const Instruction& in : code) {
+            size_t slot = top - lanes.data();
+            switch (in.op) {
+                case OpCode::pushConst:
+                    *top++ = {&in.value, nullptr, true};
+                    break;
+                case OpCode::pushCell: {
+                    bool fixed = in.absolute & absoluteRow;
+                    int row = fixed ? in.row : in.row + rows + first;
+                    int col = (in.absolute & absoluteCol) ? in.col : in.col + cols;
+                    bool failed = store.firstError(row, col, fixed ? row : row + n - 1, col) != ErrorCode::none;
+                    *top++ = {store.values(col, row), failed ? store.errorCodes(col, row) : nullptr, fixed};
+                } break;
+                case OpCode::negate: {
+                    // Subtracted from 0 as for a single cell, so that the negation of 0 is 0 rather than -0
+                    double* out = laneValues.data() + (slot - 1) * ARRAY_CHUNK;
+                    int size = top[-1].spread ? 1 : n;
+                    for (int e = 0; e < size; e++)
+                        out[e] = 0.0 - top[-1].values[e];
+                    top[-1].values = out;
+                } break;
+                case OpCode::add:
+                case OpCode::subtract:
+                case OpCode::multiply:
+                case OpCode::divide:
+                case OpCode::equal:
+                case OpCode::notEqual:
+                case OpCode::less:
+                case OpCode::lessEqual:
+                case OpCode::greater:
+                case OpCode::greaterEqual: {
+                    Lane right = *--top;
+                    top[-1] = combine(in.op, top[-1], right, laneValues.data() + (slot - 2) * ARRAY_CHUNK,
+                                      laneErrors.data() + (slot - 2) * ARRAY_CHUNK, n);
+                } break;
+                case OpCode::store: {
+                    // The local keeps a copy, as the buffer of the slot is reused by what follows
+                    const Lane& value = top[-1];
+                    int size = value.spread ? 1 : n;
+                    double* copy = laneValues.data() + (stack.size() + in.range) * ARRAY_CHUNK;
+                    ErrorCode* copyErrors = laneErrors.data() + (stack.size() + in.range) * ARRAY_CHUNK;
+                    copy_n(value.values, size, copy);
+                    if (value.errors != nullptr)
+                        copy_n(value.errors, size, copyErrors);
+                    saved[in.range] = {copy, value.errors != nullptr ? copyErrors : nullptr, value.spread};
+                } break;
+                case OpCode::load:
+                    *top++ = saved[in.range];
+                    break;
+                default:
+                    break;  // Not in a shared program
+            }
+        }
+
+        const Lane& result = lanes[0];
+        for (int e = 0; e < n; e++) {
+            ErrorCode code = result.errors ? result.errors[result.spread ? 0 : e] : ErrorCode::none;
+            errors[first + e] = code;
+            values[first + e] = code != ErrorCode::none ? 0.0 : result.values[result.spread ? 0 : e];
+        }
+    }
+}
+
+// Combines two operands of a chunk: arithmetic through the element-wise kernels, comparisons in plain loops
+CompiledFormula::Lane CompiledFormula::combine(OpCode op, const Lane& left, const Lane& right, double* out,
+                                               ErrorCode* outErrors, int n) const {
+    const double* a = left.values;
+    const double* b = right.values;
+    size_t stepA = left.spread ? 0 : 1, stepB = right.spread ? 0 : 1;
+    int zeros = 0;
+    switch (op) {
+        case OpCode::add:
+            zeros = RangeKernels::elementwise(ElementOp::add, a, left.spread, b, right.spread, out, n);
+            break;
+        case OpCode::subtract:
+            zeros = RangeKernels::elementwise(ElementOp::subtract, a, left.spread, b, right.spread, out, n);
+            break;
+        case OpCode::multiply:
+            zeros = RangeKernels::elementwise(ElementOp::multiply, a, left.spread, b, right.spread, out, n);
+            break;
+        case OpCode::divide:
+            zeros = RangeKernels::elementwise(ElementOp::divide, a, left.spread, b, right.spread, out, n);
+            break;
+        case OpCode::equal:
+            for (int e = 0; e < n; e++) out[e] = a[e * stepA] == b[e * stepB];
+            break;
+        case OpCode::notEqual:
+            for (int e = 0; e < n; e++) out[e] = a[e * stepA] != b[e * stepB];
+            break;
+        case OpCode::less:
+            for (int e = 0; e < n; e++) out[e] = a[e * stepA] < b[e * stepB];
+            break;
+        case OpCode::lessEqual:
+            for (int e = 0; e < n; e++) out[e] = a[e * stepA] <= b[e * stepB];
+            break;
+        case OpCode::greater:
+            for (int e = 0; e < n; e++) out[e] = a[e * stepA] > b[e * stepB];
+            break;
+        case OpCode::greaterEqual:
+            for (int e = 0; e < n; e++) out[e] = a[e * stepA] >= b[e * stepB];
+            break;
+        default:
+            break;
+    }
+
+    if (left.errors == nullptr && right.errors == nullptr && zeros == 0)
+        return {out, nullptr, false};
+    for (int e = 0; e < n; e++) {
+        ErrorCode code = left.errors ? left.errors[left.spread ? 0 : e] : ErrorCode::none;
+        if (code == ErrorCode::none && right.errors)
+            code = right.errors[right.spread ? 0 : e];
+        if (code == ErrorCode::none && zeros > 0 && b[e * stepB] == 0)
+            code = ErrorCode::divZero;
+        outErrors[e] = code;
+        if (code != ErrorCode::none)
+            out[e] = 0.0;
+    }
+    return {out, outErrors, false};
+}
+
+// Computes a matrix function. Its arguments are array programs: each one is evaluated once into a contiguous
+// column-major matrix (a block is copied out of the column store column by column), then the kernel runs on
+// those tiles. An error value in an argument of MMULT or MINVERSE makes every element that error;
+// TRANSPOSE moves error values with their elements. A singular matrix has no inverse (#NUM!).
+void CompiledFormula::computeMatrix(SpreadSheet& table, const Instruction& in) const {
+    int first = (int)in.value;
+    int count = (in.func == Function::mmult) ? 2 : 1;
+    ErrorCode failed = ErrorCode::none;
+    for (int a = first; a < first + count; a++) {
+        const CompiledFormula& operand = operands[a];
+        size_t size = (size_t)operand.rows * operand.cols;
+        operandValues[a].resize(size);
+        operandErrors[a].resize(size);
+        operand.evaluateArray(table, operandValues[a].data(), operandErrors[a].data());
+        for (size_t e = 0; e < size && failed == ErrorCode::none; e++)
+            failed = operandErrors[a][e];
+    }
+
+    vector<double>& values = matrixValues[in.range];
+    vector<ErrorCode>& errors = matrixErrors[in.range];
+    size_t size = (size_t)rows * cols;
+    values.resize(size);
+    errors.assign(size, ErrorCode::none);
+    const CompiledFormula& left = operands[first];
+
+    if (in.func == Function::transpose) {
+        MatrixKernels::transpose(operandValues[first].data(), values.data(), left.rows, left.cols);
+        if (failed != ErrorCode::none) {
+            for (int i = 0; i < left.rows; i++)
+                for (int j = 0; j < left.cols; j++)
+                    errors[j + (size_t)i * left.cols] = operandErrors[first][i + (size_t)j * left.rows];
+        }
+    }
+    else if (failed == ErrorCode::none && in.func == Function::mmult) {
+        MatrixKernels::multiply(operandValues[first].data(), operandValues[first + 1].data(), values.data(),
+                                left.rows, left.cols, operands[first + 1].cols);
+    }
+    else if (failed == ErrorCode::none && !MatrixKernels::invert(operandValues[first].data(), values.data(), left.rows)) {
+        failed = ErrorCode::num;
+    }
+    if (failed != ErrorCode::none && in.func != Function::transpose)
+        errors.assign(size, failed);
+    for (size_t e = 0; e < size; e++)
+        if (errors[e] != ErrorCode::none)
+            values[e] = 0.0;
+    matrixFailed[in.range] = failed != ErrorCode::none;
+}
+
+// Computes a range function. The statistics of the range are shared by every formula over the same block:
+// the sheet scans the block once with the range kernels and keeps the result up to date as cells change.
+// Only numeric cells (values and formulas) take part in the result.
+double CompiledFormula::aggregate(SpreadSheet& table, const Instruction& in) {
+    const FunctionInfo& info = FunctionRegistry::get(in.func);
+    return info.apply(table.getRangeState(in.range, !info.invertible));
+}
+
+// Compiles the formula text into a postfix program
+CompiledFormula FormulaCompiler::compile(const string& formula, SpreadSheet& table) {
+    Source src{formula, 0, table};
+
+    // '=' formulas start with an expression, '@' formulas start directly with the function call
+    if (!formula.empty() && formula[0] == '=')
+        src.pos = 1;
+
+    int root = parseComparison(src);
+    skipSpaces(src);
+    if (src.pos != formula.size()) {
+        throw invalid_argument("Invalid input.");
+    }
+
+    CompiledFormula program;
+    program.criteria = src.criteria;
+    program.names = src.bound;
+    int depth = 0, maxDepth = 0;
+    bool array = false;
+    for (const Node& node : src.tree)
+        array = array || node.op == OpCode::pushArray || node.op == OpCode::matrix;
+    if (!array) {
+        share(src, root);
+        emit(src, root, program, depth, maxDepth);
+        program.stack.resize(maxDepth);
+        program.taken.resize(program.branches.size(), 1);
+        return program;
+    }
+
+    // Array formula: its blocks must have the same size
+    vector<pair<int, int>> shapes(src.tree.size(), SINGLE);
+    if (!shapeOf(src, root, shapes)) {
+        CompiledFormula mismatch = failed(ErrorCode::value);
+        mismatch.names = src.bound;
+        return mismatch;
+    }
+    CompiledFormula arrayProgram = buildArray(src, root, shapes);
+    arrayProgram.names = src.bound;
+    return arrayProgram;
+}
+
+// Builds the array program of a subtree
+CompiledFormula FormulaCompiler::buildArray(Source& src, int node, const vector<pair<int, int>>& shapes) {
+    CompiledFormula program;
+    program.criteria = src.criteria;
+    int maxDepth = 0, lanes = 0, maxLanes = 0, spreads = 0;
+    emitArray(src, node, shapes, program, maxDepth, lanes, maxLanes, spreads);
+    program.array = true;
+    program.rows = shapes[node].first;
+    program.cols = shapes[node].second;
+    program.stack.resize(max(maxDepth, 1));
+    program.lanes.resize(maxLanes);
+    program.laneValues.resize((size_t)maxLanes * CompiledFormula::ARRAY_CHUNK);
+    program.laneErrors.resize((size_t)maxLanes * CompiledFormula::ARRAY_CHUNK);
+    program.spreadValues.resize(spreads);
+    program.spreadErrors.resize(spreads);
+    program.operandValues.resize(program.operands.size());
+    program.operandErrors.resize(program.operands.size());
+    program.matrixFailed.resize(program.matrixValues.size());
+    program.matrixErrors.resize(program.matrixValues.size());
+    program.taken.resize(program.branches.size(), 1);
+    return program;
+}
+
+// let := '@LET(' (name ',' comparison ',')+ comparison ')'
+// A name followed by a comma starts a binding; anything else is the result. The names go out of scope after it.
+int FormulaCompiler::parseLet(Source& src) {
+    size_t outer = src.names.size();
+    while (true) {
+        skipSpaces(src);
+        size_t start = src.pos;
+        if (src.pos < src.text.size() && islower(src.text[src.pos])) {
+            string name = parseName(src);
+            skipSpaces(src);
+            if (src.pos < src.text.size() && src.text[src.pos] == ',') {
+                src.pos++;
+                int value = parseComparison(src);
+                src.names.push_back({name, value});
+                skipSpaces(src);
+                if (src.pos >= src.text.size() || src.text[src.pos] != ',')
+                    throw invalid_argument("Invalid Formula.");  // A binding without a result
+                src.pos++;
+                continue;
+            }
+            src.pos = start;
+        }
+        break;
+    }
+    if (src.names.size() == outer)
+        throw invalid_argument("Invalid Formula.");
+
+    int result = parseComparison(src);
+    skipSpaces(src);
+    if (src.pos >= src.text.size() || src.text[src.pos] != ')')
+        throw invalid_argument("Invalid Formula.");
+    src.pos++;
+    src.names.resize(outer);
+    return result;
+}
+
+// name := [a-z] [a-z0-9]*. Lowercase names never read as cell references, which are uppercase.
+string FormulaCompiler::parseName(Source& src) {
+    string name = "";
+    while (src.pos < src.text.size() && (islower(src.text[src.pos]) || isdigit(src.text[src.pos])))
+        name += src.text[src.pos++];
+    return name;
+}
+
+// Resolves a sheet name to its definition and records the name, so the formula is recompiled when it changes.
+// Blocks are absolute: a filled or relocated formula keeps reading the named block.
+int FormulaCompiler::nameNode(Source& src, const string& name, bool range) {
+    int id = src.table.addName(name);
+    if (find(src.bound.begin(), src.bound.end(), id) == src.bound.end())
+        src.bound.push_back(id);
+
+    const NameDefinition& definition = src.table.getName(id);
+    if (!definition.defined)
+        return addNode(src, {OpCode::pushError, Function::sum, 0, 0, 0, 0, (double)ErrorCode::name, -1, -1});
+    if (!definition.range && range)
+        return addNode(src, {OpCode::pushError, Function::sum, 0, 0, 0, 0, (double)ErrorCode::value, -1, -1});
+    if (!definition.range)
+        return addNode(src, {OpCode::pushConst, Function::sum, 0, 0, 0, 0, definition.value, -1, -1});
+
+    const int row = definition.row, col = definition.col, lastRow = definition.lastRow, lastCol = definition.lastCol;
+    if (!range && row == lastRow && col == lastCol)
+        return addNode(src, {OpCode::pushCell, Function::sum, row, col, row, col, 0.0, -1, -1,
+                             (unsigned char)(absoluteRow | absoluteCol)});
+    unsigned char fixed = absoluteRow | absoluteCol | absoluteLastRow | absoluteLastCol;
+    return addNode(src, {range ? OpCode::pushRange : OpCode::pushArray, Function::sum, row, col, lastRow, lastCol,
+                         0.0, -1, -1, fixed});
+}
+
+// comparison := expression (('=' | '<>' | '<' | '<=' | '>' | '>=') expression)*
+int FormulaCompiler::parseComparison(Source& src) {
+    int left = parseExpression(src);
+    skipSpaces(src);
+    while (src.pos < src.text.size()) {
+        char ch = src.text[src.pos];
+        char next = src.pos + 1 < src.text.size() ? src.text[src.pos + 1] : '\0';
+        OpCode op;
+        if (ch == '=')
+            op = OpCode::equal;
+        else if (ch == '<')
+            op = (next == '>') ? OpCode::notEqual : (next == '=') ? OpCode::lessEqual : OpCode::less;
+        else if (ch == '>')
+            op = (next == '=') ? OpCode::greaterEqual : OpCode::greater;
+        else
+            break;
+        src.pos += (op == OpCode::notEqual || op == OpCode::lessEqual || op == OpCode::greaterEqual) ? 2 : 1;
+        int right = parseExpression(src);
+        left = addNode(src, {op, Function::sum, 0, 0, 0, 0, 0.0, left, right});
+        skipSpaces(src);
+    }
+    return left;
+}
+
+// expression := term (('+' | '-') term)*
+int FormulaCompiler::parseExpression(Source& src) {
+    int left = parseTerm(src);
+    skipSpaces(src);
+    while (src.pos < src.text.size() && (src.text[src.pos] == '+' || src.text[src.pos] == '-')) {
+        OpCode op = (src.text[src.pos] == '+') ? OpCode::add : OpCode::subtract;
+        src.pos++;
+        int right = parseTerm(src);
+        left = addNode(src, {op, Function::sum, 0, 0, 0, 0, 0.0, left, right});
+        skipSpaces(src);
+    }
+    return left;
+}
+
+// term := unary (('*' | '/') unary)*
+int FormulaCompiler::parseTerm(Source& src) {
+    int left = parsePrimaryOrUnary(src);
+    skipSpaces(src);
+    while (src.pos < src.text.size() && (src.text[src.pos] == '*' || src.text[src.pos] == '/')) {
+        OpCode op = (src.text[src.pos] == '*') ? OpCode::multiply : OpCode::divide;
+        src.pos++;
+        int right = parsePrimaryOrUnary(src);
+        left = addNode(src, {op, Function::sum, 0, 0, 0, 0, 0.0, left, right});
+        skipSpaces(src);
+    }
+    return left;
+}
+
+// unary := ('-' | '+') unary | primary
+int FormulaCompiler::parsePrimaryOrUnary(Source& src) {
+    skipSpaces(src);
+    if (src.pos >= src.text.size()) {
+        throw invalid_argument("Invalid input.");
+    }
+
+    char ch = src.text[src.pos];
+
+    if (ch == '-' || ch == '+') {
+        src.pos++;
+        int operand = parsePrimaryOrUnary(src);
+        if (ch == '+')
+            return operand;
+        // Fold negative constants directly (subtracted from 0 like every negation, so -0 is 0)
+        if (src.tree[operand].op == OpCode::pushConst) {
+            src.tree[operand].value = 0.0 - src.tree[operand].value;
+            return operand;
+        }
+        return addNode(src, {OpCode::negate, Function::sum, 0, 0, 0, 0, 0.0, operand, -1});
+    }
+
+    if (ch == '(') {
+        src.pos++;
+        int inner = parseComparison(src);
+        skipSpaces(src);
+        if (src.pos >= src.text.size() || src.text[src.pos] != ')') {
+            throw invalid_argument("Invalid input.");
+        }
+        src.pos++;
+        return inner;
+    }
+
+    if (ch == '@') {
+        return parseFunction(src);
+    }
+
+    // A reference on another sheet of the workbook, like Sheet2!A1
+    int sheet;
+    if (isalpha(ch) && parseSheet(src, sheet))
+        return sheetNode(src, sheet, false);
+
+    // A name of an enclosing LET stands for its value. A leaf is copied, since the parser may still turn
+    // it into something else (like a negative constant or a criterion); other nodes are used as they are.
+    if (islower(ch)) {
+        string name = parseName(src);
+        for (size_t i = src.names.size(); i-- > 0; ) {
+            if (src.names[i].first != name)
+                continue;
+            int value = src.names[i].second;
+            const Node& n = src.tree[value];
+            if (n.left == -1 && n.right == -1 && n.arguments.empty())
+                return addNode(src, Node(n));
+            return value;
+        }
+        return nameNode(src, name, false);
+    }
+
+    if (isdigit(ch) || ch == '.') {
+        const char* start = src.text.c_str() + src.pos;
+        char* end;
+        double value = strtod(start, &end);
+        if (end == start) {
+            throw invalid_argument("Invalid Formula.");
+        }
+        src.pos += end - start;
+        // A number too large for a double (like 1e400) has no value; smaller than the least one it reads as 0
+        if (isinf(value))
+            return addNode(src, {OpCode::pushError, Function::sum, 0, 0, 0, 0, (double)ErrorCode::num, -1, -1});
+        return addNode(src, {OpCode::pushConst, Function::sum, 0, 0, 0, 0, value, -1, -1});
+    }
+
+    if (isalpha(ch) || ch == '$') {
+        int row, col;
+        unsigned char absolute;
+        size_t start = src.pos;
+        bool inside = parseReference(src, row, col, absolute);
+        if (src.text.compare(src.pos, 2, "..") == 0) {
+            // A block of cells as an operand makes an array formula
+            src.pos = start;
+            int node = parseRange(src);
+            if (src.tree[node].op == OpCode::pushRange)
+                src.tree[node].op = OpCode::pushArray;
+            return node;
+        }
+        if (!inside)
+            return addNode(src, {OpCode::pushError, Function::sum, 0, 0, 0, 0, (double)ErrorCode::ref, -1, -1});
+        return addNode(src, {OpCode::pushCell, Function::sum, row, col, row, col, 0.0, -1, -1, absolute});
+    }
+
+    // A reference that was moved off the sheet by a fill
+    if (src.text.compare(src.pos, 5, "#REF!") == 0) {
+        src.pos += 5;
+        return addNode(src, {OpCode::pushError, Function::sum, 0, 0, 0, 0, (double)ErrorCode::ref, -1, -1});
+    }
+
+    throw invalid_argument("Invalid input.");
+}
+
+// function := '@' NAME '(' range ')' | '@' NAME '(' argument (',' argument)* ')'
+int FormulaCompiler::parseFunction(Source& src) {
+    src.pos++; // Skip '@'
+
+    string name = "";
+    while (src.pos < src.text.size() && isalpha(src.text[src.pos])) {
+        name += src.text[src.pos++];
+    }
+
+    // The name is resolved to an id here, evaluation never looks at it again
+    const FunctionInfo* info = FunctionRegistry::find(name);
+    if (info == nullptr) {
+        throw invalid_argument("Invalid Formula.");
+    }
+
+    if (src.pos >= src.text.size() || src.text[src.pos] != '(') {
+        throw invalid_argument("Invalid Formula.");
+    }
+    src.pos++;
+    if (info->kind == FunctionKind::binding)
+        return parseLet(src);
+
+    // Each argument is a range, a criterion or an expression, as the function declares
+    vector<int> arguments;
+    while (true) {
+        skipSpaces(src);
+        if ((info->rangeArguments >> arguments.size()) & 1)
+            arguments.push_back(parseRange(src));
+        else if ((info->criterionArguments >> arguments.size()) & 1)
+            arguments.push_back(parseCriterion(src));
+        else
+            arguments.push_back(parseComparison(src));
+        skipSpaces(src);
+        if (src.pos >= src.text.size() || src.text[src.pos] != ',')
+            break;
+        src.pos++;
+    }
+
+    if (src.pos >= src.text.size() || src.text[src.pos] != ')') {
+        throw invalid_argument("Invalid Formula.");
+    }
+    src.pos++;
+    if ((int)arguments.size() < info->minArgs || (int)arguments.size() > info->maxArgs) {
+        throw invalid_argument("Invalid Formula.");
+    }
+
+    // A range function reads the cached statistics of its range; a range that left the sheet stays #REF!.
+    // Moving functions compile the same way: the sheet batches their copies down a column (see evaluateWindows).
+    if (info->kind == FunctionKind::aggregate || info->kind == FunctionKind::window) {
+        Node& node = src.tree[arguments[0]];
+        if (node.op == OpCode::pushRange || node.op == OpCode::sheetAggregate) {
+            if (node.op == OpCode::pushRange)
+                node.op = OpCode::aggregate;
+            node.func = info->id;
+        }
+        return arguments[0];
+    }
+
+    // The blocks of other sheets are read through their cached statistics only, by the range functions above
+    for (int argument : arguments)
+        if (src.tree[argument].op == OpCode::sheetAggregate)
+            throw invalid_argument("Invalid Formula.");
+
+    // A branching function becomes jumps around its arguments, see emitBranches
+    if (info->kind == FunctionKind::branch) {
+        if (info->id == Function::ifs && arguments.size() % 2 != 0)
+            throw invalid_argument("Invalid Formula.");  // A condition without its value
+        return addNode(src, {OpCode::jump, info->id, 0, 0, 0, 0, 0.0, -1, -1, 0, arguments});
+    }
+
+    // A matrix function computes its arguments as arrays, see shapeOf and buildArray
+    if (info->kind == FunctionKind::matrix)
+        return addNode(src, {OpCode::matrix, info->id, 0, 0, 0, 0, 0.0, -1, -1, 0, arguments});
+
+    // A key written as a single reference is remembered, so a key cell holding text can be matched as text
+    Node node = {OpCode::lookup, info->id, -1, -1, -1, -1, (double)arguments.size(), -1, -1, 0, arguments};
+    const Node& key = src.tree[arguments[0]];
+    if (info->kind == FunctionKind::lookup && key.op == OpCode::pushCell) {
+        node.row = node.lastRow = key.row;
+        node.col = node.lastCol = key.col;
+        node.absolute = key.absolute;
+    }
+    return addNode(src, node);
+}
+
+// criterion := '"' text '"' | expression
+int FormulaCompiler::parseCriterion(Source& src) {
+    int slot = src.criteria.size();
+    src.criteria.push_back(Criterion());
+
+    if (src.pos < src.text.size() && src.text[src.pos] == '"') {
+        // Quoted text, a doubled quote stands for one quote
+        string text = "";
+        src.pos++;
+        while (true) {
+            if (src.pos >= src.text.size())
+                throw invalid_argument("Invalid Formula.");
+            if (src.text[src.pos] == '"') {
+                if (src.pos + 1 >= src.text.size() || src.text[src.pos + 1] != '"')
+                    break;
+                src.pos++;
+            }
+            text += src.text[src.pos++];
+        }
+        src.pos++;
+        src.criteria[slot] = Criteria::parse(text);
+        return addNode(src, {OpCode::criterion, Function::sum, -1, -1, -1, -1, 0.0, -1, -1, 0, {}, slot});
+    }
+
+    int operand = parseComparison(src);
+    if (src.tree[operand].op == OpCode::pushCell) {
+        // The cell is read as a criterion instead of being pushed
+        src.tree[operand].op = OpCode::criterion;
+        src.tree[operand].slot = slot;
+        return operand;
+    }
+    return addNode(src, {OpCode::criterion, Function::sum, -1, -1, -1, -1, 1.0, operand, -1, 0, {}, slot});
+}
+
+// range := [sheet] reference '..' reference | name | '#REF!'
+int FormulaCompiler::parseRange(Source& src) {
+    int sheet;
+    if (parseSheet(src, sheet))
+        return sheetNode(src, sheet, true);
+    if (src.pos < src.text.size() && islower(src.text[src.pos]))
+        return nameNode(src, parseName(src), true);
+
+    // A range whose references were moved off the sheet by a fill is written as #REF!
+    if (src.text.compare(src.pos, 5, "#REF!") == 0) {
+        src.pos += 5;
+        return addNode(src, {OpCode::pushError, Function::sum, 0, 0, 0, 0, (double)ErrorCode::ref, -1, -1});
+    }
+
+    int fr, fc, lr, lc;
+    unsigned char first, last;
+    bool inside = parseReference(src, fr, fc, first);
+    if (src.text.compare(src.pos, 2, "..") != 0) {
+        throw invalid_argument("Invalid Formula.");
+    }
+    src.pos += 2;
+    inside = parseReference(src, lr, lc, last) && inside;
+
+    // A range that leaves the sheet evaluates to #REF!
+    if (!inside)
+        return addNode(src, {OpCode::pushError, Function::sum, 0, 0, 0, 0, (double)ErrorCode::ref, -1, -1});
+
+    Node node = {OpCode::pushRange, Function::sum, fr, fc, lr, lc, 0.0, -1, -1, (unsigned char)(first | last << 2)};
+    normalizeRange(node.row, node.col, node.lastRow, node.lastCol, node.absolute);
+    return addNode(src, node);
+}
+
+// sheet := NAME '!'. Sheet names start with a letter, so a '$' reference or "#REF!" is never taken for one.
+bool FormulaCompiler::parseSheet(Source& src, int& sheet) {
+    size_t end = src.pos;
+    while (end < src.text.size() && (isalnum(src.text[end]) || src.text[end] == '_'))
+        end++;
+    if (end == src.pos || !isalpha(src.text[src.pos]) || end >= src.text.size() || src.text[end] != '!')
+        return false;
+
+    Workbook* book = src.table.getWorkbook();
+    sheet = (book == nullptr) ? -1 : book->find(src.text.substr(src.pos, end - src.pos));
+    src.pos = end + 1;
+    return true;
+}
+
+// Node of a reference on another sheet. All the sheets of a workbook have the same size, so the reference
+// is checked against the formula's own sheet. A fill moves it off the sheet as "Sheet2!#REF!".
+int FormulaCompiler::sheetNode(Source& src, int sheet, bool range) {
+    if (src.text.compare(src.pos, 5, "#REF!") == 0) {
+        src.pos += 5;
+        return addNode(src, {OpCode::pushError, Function::sum, 0, 0, 0, 0, (double)ErrorCode::ref, -1, -1});
+    }
+    if (sheet >= 0 && sheet == src.table.getIndex())
+        return range ? parseRange(src) : parsePrimaryOrUnary(src);
+
+    int row, col, lastRow = 0, lastCol = 0;
+    unsigned char first, last = 0;
+    bool inside = parseReference(src, row, col, first);
+    bool block = src.text.compare(src.pos, 2, "..") == 0;
+    if (block) {
+        src.pos += 2;
+        inside = parseReference(src, lastRow, lastCol, last) && inside;
+    }
+    // A range argument takes a block, and blocks of other sheets are not operands of array formulas
+    if (block != range)
+        throw invalid_argument("Invalid Formula.");
+
+    if (sheet < 0 || !inside)
+        return addNode(src, {OpCode::pushError, Function::sum, 0, 0, 0, 0, (double)ErrorCode::ref, -1, -1});
+
+    if (!block)
+        return addNode(src, {OpCode::pushSheetCell, Function::sum, row, col, row, col, (double)sheet, -1, -1, first});
+    Node node = {OpCode::sheetAggregate, Function::sum, row, col, lastRow, lastCol, (double)sheet, -1, -1,
+                 (unsigned char)(first | last << 2)};
+    normalizeRange(node.row, node.col, node.lastRow, node.lastCol, node.absolute);
+    return addNode(src, node);
+}
+
+// Reads a cell reference (up to three capital letters followed by the row number)
+bool FormulaCompiler::parseReference(Source& src, int& row, int& col, unsigned char& absolute) {
+    const string& text = src.text;
+    absolute = 0;
+
+    // A '$' before the letters or the digits keeps that part fixed when the formula is filled
+    if (src.pos < text.size() && text[src.pos] == '$') {
+        absolute |= absoluteCol;
+        src.pos++;
+    }
+    col = CellAddress::readColumn(text, src.pos);
+
+    if (src.pos < text.size() && text[src.pos] == '$') {
+        absolute |= absoluteRow;
+        src.pos++;
+    }
+    row = CellAddress::readRow(text, src.pos);
+
+    if (col < 0 || row < 0 || (src.pos < text.size() && isalpha(text[src.pos]))) {
+        throw invalid_argument("Invalid input.");
+    }
+    if (row > src.table.getNumRows() || row < 1 || col > src.table.getNumCols() || col < 1) {
+        return false;
+    }
+
+    row--;
+    col--;
+    return true;
+}
+
+// Adds a node to the tree and returns its index
+int FormulaCompiler::addNode(Source& src, const Node& node) {
+    src.tree.push_back(node);
+    return src.tree.size() - 1;
+}
+
+// Skips blanks in the formula text
+void FormulaCompiler::skipSpaces(Source& src) {
+    while (src.pos < src.text.size() && src.text[src.pos] == ' ')
+        src.pos++;
+}
+
+// Emits the subtree in postfix order
+void FormulaCompiler::emit(Source& src, int node, CompiledFormula& program, int& depth, int& maxDepth) {
+    const Node n = src.tree[node];
+
+    // A shared subexpression is computed where it is first needed and loaded from its local afterwards,
+    // as long as its store is sure to have run: every scope (branch) around the store is still open
+    bool shared = node < (int)src.uses.size() && src.uses[node] > 1 &&
+                  n.op != OpCode::pushConst && n.op != OpCode::pushCell && n.op != OpCode::pushError &&
+                  n.op != OpCode::pushRange && n.op != OpCode::criterion && n.op != OpCode::pushSheetCell;
+    if (shared && src.locals[node] >= 0) {
+        const vector<int>& stored = src.storedIn[node];
+        if (stored.size() <= src.scopes.size() && equal(stored.begin(), stored.end(), src.scopes.begin())) {
+            program.code.push_back({OpCode::load, Function::sum, 0, 0, 0, 0, 0.0, src.locals[node], 0});
+            maxDepth = max(maxDepth, ++depth);
+            return;
+        }
+    }
+    auto keep = [&]() {
+        if (!shared)
+            return;
+        if (src.locals[node] < 0) {
+            src.locals[node] = program.locals.size();
+            program.locals.push_back(0.0);
+        }
+        program.code.push_back({OpCode::store, Function::sum, 0, 0, 0, 0, 0.0, src.locals[node], 0});
+        src.storedIn[node] = src.scopes;
+    };
+
+    if (n.op == OpCode::jump) {
+        emitBranches(src, n, program, depth, maxDepth);
+        keep();
+        return;
+    }
+
+    if (n.left != -1)
+        emit(src, n.left, program, depth, maxDepth);
+    if (n.right != -1)
+        emit(src, n.right, program, depth, maxDepth);
+    for (int argument : n.arguments)
+        emit(src, argument, program, depth, maxDepth);
+
+    int range = -1;
+    if (n.op == OpCode::aggregate || n.op == OpCode::pushRange)
+        range = src.table.addRange(n.row, n.col, n.lastRow, n.lastCol);
+    else if (n.op == OpCode::sheetAggregate)
+        range = src.table.getWorkbook()->getSheet((int)n.value).addRange(n.row, n.col, n.lastRow, n.lastCol);
+    else if (n.op == OpCode::criterion)
+        range = n.slot;
+    program.code.push_back({n.op, n.func, n.row, n.col, n.lastRow, n.lastCol, n.value, range, n.absolute});
+
+    switch (n.op) {
+        case OpCode::pushConst:
+        case OpCode::pushCell:
+        case OpCode::pushError:
+        case OpCode::aggregate:
+        case OpCode::pushRange:
+        case OpCode::pushSheetCell:
+        case OpCode::sheetAggregate:
+            depth++;
+            break;
+        case OpCode::negate:
+            break;
+        case OpCode::lookup:
+            depth -= (int)n.arguments.size() - 1; // Pops the arguments and pushes the result
+            break;
+        case OpCode::criterion:
+            if (n.value == 0)
+                depth++; // A quoted or cell criterion pushes its slot; a computed one replaces its value
+            break;
+        default:
+            depth--; // Binary operators pop two values and push one
+            break;
+    }
+    if (depth > maxDepth)
+        maxDepth = depth;
+    keep();
+}
+
+// Merges identical subtrees, bottom up: the children of a node come before it in the tree, so they are
+// already merged when the node is looked up. Criteria are never merged, each has a slot of its own.
+// Then counts the parents of every node reached from the root.
+void FormulaCompiler::share(Source& src, int& root) {
+    vector<Node>& tree = src.tree;
+    vector<int> same(tree.size());
+    map<tuple<OpCode, Function, int, int, int, int, double, int, int, unsigned char, vector<int>>, int> seen;
+    for (size_t i = 0; i < tree.size(); i++) {
+        Node& n = tree[i];
+        if (n.left != -1)
+            n.left = same[n.left];
+        if (n.right != -1)
+            n.right = same[n.right];
+        for (int& argument : n.arguments)
+            argument = same[argument];
+        same[i] = i;
+        if (n.op != OpCode::criterion)
+            same[i] = seen.emplace(make_tuple(n.op, n.func, n.row, n.col, n.lastRow, n.lastCol, n.value,
+                                              n.left, n.right, n.absolute, n.arguments), i).first->second;
+    }
+    root = same[root];
+
+    src.uses.assign(tree.size(), 0);
+    src.locals.assign(tree.size(), -1);
+    src.storedIn.assign(tree.size(), {});
+    vector<bool> visited(tree.size(), false);
+    vector<int> pending = {root};
+    visited[root] = true;
+    while (!pending.empty()) {
+        const Node& n = tree[pending.back()];
+        pending.pop_back();
+        vector<int> children = n.arguments;
+        if (n.left != -1)
+            children.push_back(n.left);
+        if (n.right != -1)
+            children.push_back(n.right);
+        for (int child : children) {
+            src.uses[child]++;
+            if (!visited[child]) {
+                visited[child] = true;
+                pending.push_back(child);
+            }
+        }
+    }
+}
+
+// Emits IF, IFS or CHOOSE. Each branch starts with an enter instruction and is listed in 'branches';
+// every branch leaves one value on the stack and jumps to the end, past the other branches:
+//   IF:     condition, jumpIfFalse -> else, [then], jump -> end, [else]
+//   IFS:    (condition, jumpIfFalse -> next, [value], jump -> end)..., #N/A when no condition holds
+//   CHOOSE: index, choose, jump -> [value1] ... jump -> [valueN], #VALUE!, jump -> end, [value1] ... [valueN]
+// Jump targets are indexes into the program, patched once the branches they skip are emitted.
+void FormulaCompiler::emitBranches(Source& src, const Node& n, CompiledFormula& program, int& depth, int& maxDepth) {
+    vector<Instruction>& code = program.code;
+    vector<size_t> exits; // Jumps to the end
+    int base = depth;
+
+    auto push = [&](const Instruction& in) {
+        code.push_back(in);
+        return code.size() - 1;
+    };
+    auto jump = [&](OpCode op) {
+        return push({op, Function::sum, 0, 0, 0, 0, 0.0, -1, 0});
+    };
+    // Result of the construct when it has no branch to take
+    auto fail = [&](ErrorCode error) {
+        push({OpCode::pushError, Function::sum, 0, 0, 0, 0, (double)error, -1, 0});
+        depth = base + 1;
+        maxDepth = max(maxDepth, depth);
+    };
+    // One branch: its subtree, or 0 for the missing else of IF (FALSE in Excel)
+    auto branch = [&](int node) {
+        int id = program.branches.size();
+        program.branches.push_back({(int)code.size(), 0});
+        push({OpCode::enter, Function::sum, 0, 0, 0, 0, 0.0, id, 0});
+        depth = base;
+        src.scopes.push_back(src.nextScope++);
+        if (node >= 0)
+            emit(src, node, program, depth, maxDepth);
+        else {
+            push({OpCode::pushConst, Function::sum, 0, 0, 0, 0, 0.0, -1, 0});
+            depth = base + 1;
+            maxDepth = max(maxDepth, depth);
+        }
+        src.scopes.pop_back();
+        program.branches[id].second = code.size();
+    };
+
+    const vector<int>& arguments = n.arguments;
+    if (n.func == Function::ifThen) {
+        emit(src, arguments[0], program, depth, maxDepth);
+        size_t skip = jump(OpCode::jumpIfFalse);
+        branch(arguments[1]);
+        exits.push_back(jump(OpCode::jump));
+        code[skip].range = code.size();
+        branch(arguments.size() > 2 ? arguments[2] : -1);
+    }
+    else if (n.func == Function::ifs) {
+        // A condition runs only when the ones before it are false, so each opens a scope for the next ones
+        size_t outer = src.scopes.size();
+        for (size_t k = 0; k < arguments.size(); k += 2) {
+            if (k > 0)
+                src.scopes.push_back(src.nextScope++);
+            depth = base;
+            emit(src, arguments[k], program, depth, maxDepth);
+            size_t skip = jump(OpCode::jumpIfFalse);
+            branch(arguments[k + 1]);
+            exits.push_back(jump(OpCode::jump));
+            code[skip].range = code.size();
+        }
+        src.scopes.resize(outer);
+        fail(ErrorCode::notAvailable);
+    }
+    else {
+        emit(src, arguments[0], program, depth, maxDepth);
+        int choices = arguments.size() - 1;
+        push({OpCode::choose, Function::sum, 0, 0, 0, 0, (double)choices, -1, 0});
+        size_t table = code.size();
+        for (int k = 0; k < choices; k++)
+            jump(OpCode::jump);
+        fail(ErrorCode::value);
+        exits.push_back(jump(OpCode::jump));
+        for (int k = 1; k <= choices; k++) {
+            code[table + k - 1].range = code.size();
+            branch(arguments[k]);
+            if (k < choices)
+                exits.push_back(jump(OpCode::jump));
+        }
+    }
+    for (size_t exit : exits)
+        code[exit].range = code.size();
+    depth = base + 1;
+}
+
+// Computes the shapes of the nodes. Every node is visited, so a misplaced block is reported even when
+// the sizes of other blocks do not match.
+bool FormulaCompiler::shapeOf(Source& src, int node, vector<pair<int, int>>& shapes) {
+    const Node& n = src.tree[node];
+    if (n.op == OpCode::pushArray) {
+        shapes[node] = {n.lastRow - n.row + 1, n.lastCol - n.col + 1};
+        return true;
+    }
+
+    bool matching = true;
+    vector<int> children = n.arguments;
+    if (n.left != -1)
+        children.push_back(n.left);
+    if (n.right != -1)
+        children.push_back(n.right);
+    for (int child : children)
+        matching = shapeOf(src, child, shapes) && matching;
+
+    if (n.op == OpCode::matrix) {
+        vector<pair<int, int>> arguments;
+        for (int argument : n.arguments) {
+            if (shapes[argument] == SINGLE)
+                throw invalid_argument("Invalid Formula.");  // Matrix functions take blocks
+            arguments.push_back(shapes[argument]);
+        }
+        pair<int, int> shape;
+        if (!matrixShape(n.func, arguments, shape))
+            return false;
+        shapes[node] = shape;
+        return matching;
+    }
+
+    bool operation = n.op == OpCode::negate || n.op == OpCode::add || n.op == OpCode::subtract ||
+                     n.op == OpCode::multiply || n.op == OpCode::divide;
+    for (int child : children) {
+        if (shapes[child] == SINGLE)
+            continue;
+        if (!operation)
+            throw invalid_argument("Invalid Formula.");  // Functions take single values besides their ranges
+        if (shapes[node] == SINGLE)
+            shapes[node] = shapes[child];
+        else if (shapes[node] != shapes[child])
+            matching = false;
+    }
+    return matching;
+}
+
+// Emits the array program of the subtree
+void FormulaCompiler::emitArray(Source& src, int node, const vector<pair<int, int>>& shapes, CompiledFormula& program,
+                                int& maxDepth, int& lanes, int& maxLanes, int& spreads) {
+    const Node n = src.tree[node];
+    if (shapes[node] == SINGLE) {
+        // Single valued subtree: a broadcast instruction followed by its ordinary program
+        size_t marker = program.code.size();
+        program.code.push_back({OpCode::broadcast, Function::sum, 0, 0, 0, 0, 0.0, -1, 0});
+        int depth = 0;
+        emit(src, node, program, depth, maxDepth);
+        program.code[marker].value = program.code.size() - marker - 1;
+        spreads++;
+        lanes++;
+    }
+    else if (n.op == OpCode::pushArray) {
+        int range = src.table.addRange(n.row, n.col, n.lastRow, n.lastCol);
+        program.code.push_back({OpCode::pushArray, Function::sum, n.row, n.col, n.lastRow, n.lastCol, 0.0, range, n.absolute});
+        lanes++;
+    }
+    else if (n.op == OpCode::matrix) {
+        // The arguments become programs of their own; the result is a slot read like a block
+        int first = program.operands.size();
+        for (int argument : n.arguments)
+            program.operands.push_back(buildArray(src, argument, shapes));
+        program.code.push_back({OpCode::matrix, n.func, 0, 0, 0, 0, (double)first, (int)program.matrixValues.size(), 0});
+        program.matrixValues.push_back({});
+        lanes++;
+    }
+    else {
+        emitArray(src, n.left, shapes, program, maxDepth, lanes, maxLanes, spreads);
+        if (n.right != -1) {
+            emitArray(src, n.right, shapes, program, maxDepth, lanes, maxLanes, spreads);
+            lanes--;
+        }
+        program.code.push_back({n.op, n.func, 0, 0, 0, 0, 0.0, -1, 0});
+    }
+    if (lanes > maxLanes)
+        maxLanes = lanes;
+}
+
+// Shapes of the matrix functions
+bool FormulaCompiler::matrixShape(Function func, const vector<pair<int, int>>& arguments, pair<int, int>& shape) {
+    const pair<int, int>& a = arguments[0];
+    switch (func) {
+        case Function::mmult:
+            shape = {a.first, arguments[1].second};
+            return a.second == arguments[1].first;  // Columns of the first match rows of the second
+        case Function::transpose:
+            shape = {a.second, a.first};
+            return true;
+        default:
+            shape = a;
+            return a.first == a.second;  // Only square matrices have an inverse
+    }
+}
+
+// Orders the corners of a range, swapping their absolute flags along with them
+void FormulaCompiler::normalizeRange(int& row, int& col, int& lastRow, int& lastCol, unsigned char& absolute) {
+    unsigned char first = absolute & 3, last = absolute >> 2 & 3;
+    if (row > lastRow) {
+        int temp = row; row = lastRow; lastRow = temp;
+        first = (first & ~absoluteRow) | (last & absoluteRow);
+        last = (last & ~absoluteRow) | (absolute & absoluteRow);
+    }
+    if (col > lastCol) {
+        int temp = col; col = lastCol; lastCol = temp;
+        unsigned char firstCol = first & absoluteCol;
+        first = (first & ~absoluteCol) | (last & absoluteCol);
+        last = (last & ~absoluteCol) | firstCol;
+    }
+    absolute = first | last << 2;
+}
+
+// Moves the program by (rows, cols). Every moved instruction still pushes one value, so the stack size is kept.
+CompiledFormula FormulaCompiler::relocate(const CompiledFormula& program, int rows, int cols, SpreadSheet& table) {
+    CompiledFormula moved = program;
+
+    // An array that has lost one of its blocks is #REF! as a whole
+    CompiledFormula lost = failed(ErrorCode::ref);
+    lost.names = program.names;
+    for (CompiledFormula& operand : moved.operands) {
+        operand = relocate(operand, rows, cols, table);
+        if (!operand.isArray())
+            return lost;
+    }
+
+    for (Instruction& in : moved.code) {
+        if (in.op == OpCode::lookup && in.row >= 0) {
+            // The key cell moves like the reference that pushes it; once off the sheet, that reference is #REF!
+            if (!(in.absolute & absoluteRow)) in.row += rows;
+            if (!(in.absolute & absoluteCol)) in.col += cols;
+            if (in.row < 0 || in.col < 0 || in.row >= table.getNumRows() || in.col >= table.getNumCols())
+                in.row = in.col = -1;
+            in.lastRow = in.row;
+            in.lastCol = in.col;
+            continue;
+        }
+        bool cellCriterion = in.op == OpCode::criterion && in.row >= 0;
+        if (in.op != OpCode::pushCell && in.op != OpCode::aggregate && in.op != OpCode::pushRange &&
+            in.op != OpCode::pushArray && in.op != OpCode::pushSheetCell && in.op != OpCode::sheetAggregate &&
+            !cellCriterion)
+            continue;
+
+        if (!(in.absolute & absoluteRow)) in.row += rows;
+        if (!(in.absolute & absoluteCol)) in.col += cols;
+        if (in.op == OpCode::pushCell || in.op == OpCode::pushSheetCell || cellCriterion) {
+            in.lastRow = in.row;
+            in.lastCol = in.col;
+        }
+        else {
+            if (!(in.absolute & absoluteLastRow)) in.lastRow += rows;
+            if (!(in.absolute & absoluteLastCol)) in.lastCol += cols;
+            normalizeRange(in.row, in.col, in.lastRow, in.lastCol, in.absolute);
+        }
+
+        if (in.row < 0 || in.col < 0 || in.lastRow >= table.getNumRows() || in.lastCol >= table.getNumCols()) {
+            if (in.op == OpCode::pushArray)
+                return lost;
+            in = {OpCode::pushError, Function::sum, 0, 0, 0, 0, (double)ErrorCode::ref, -1, 0};
+            continue;
+        }
+        if (in.op == OpCode::aggregate || in.op == OpCode::pushRange || in.op == OpCode::pushArray)
+            in.range = table.addRange(in.row, in.col, in.lastRow, in.lastCol);
+        else if (in.op == OpCode::sheetAggregate)
+            in.range = table.getWorkbook()->getSheet((int)in.value).addRange(in.row, in.col, in.lastRow, in.lastCol);
+    }
+    return moved;
+}
+
+// Moves the references of the formula text by (rows, cols). Absolute parts stay.
+string FormulaCompiler::relocate(const string& formula, int rows, int cols, const SpreadSheet& table) {
+    return rewrite(formula, true, true, [&](int& row, int& col, unsigned char absolute) {
+        if (!(absolute & absoluteRow)) row += rows;
+        if (!(absolute & absoluteCol)) col += cols;
+        return row >= 0 && col >= 0 && row < table.getNumRows() && col < table.getNumCols();
+    });
+}
+
+// Points the single references into the block at the new rows of their cells
+CompiledFormula FormulaCompiler::follow(const CompiledFormula& program, const RowMove& move, int sheet) {
+    CompiledFormula moved = program;
+    for (CompiledFormula& operand : moved.operands)
+        operand = follow(operand, move, sheet);
+    for (Instruction& in : moved.code) {
+        // The key cell of a lookup is read by the pushCell before it and follows it. The references of
+        // a formula of another sheet are on its own sheet, apart from those to the sheet of the block.
+        bool single = in.op == OpCode::pushCell || ((in.op == OpCode::lookup || in.op == OpCode::criterion) && in.row >= 0);
+        if (sheet >= 0)
+            single = in.op == OpCode::pushSheetCell && (int)in.value == sheet;
+        if (single && in.row >= move.row && in.row <= move.lastRow && in.col >= move.col && in.col <= move.lastCol)
+            in.row = in.lastRow = move.target[in.row - move.row];
+    }
+    return moved;
+}
+
+// Points the single references of the text into the block at the new rows of their cells
+string FormulaCompiler::follow(const string& formula, const RowMove& move, const string& sheet) {
+    // Rows move whether or not the reference is absolute, so the flags are not read
+    return rewrite(formula, false, !sheet.empty(), [&](int& row, int& col, unsigned char) {
+        if (row >= move.row && row <= move.lastRow && col >= move.col && col <= move.lastCol)
+            row = move.target[row - move.row];
+        return true;
+    }, writeReference, sheet);
+}
+
+// Writes the references of the text as offsets from the cell, or as numbers where they are absolute
+string FormulaCompiler::toTemplate(const string& formula, int row, int col) {
+    return rewrite(formula, true, true, [&](int& r, int& c, unsigned char absolute) {
+        if (!(absolute & absoluteRow)) r -= row;
+        if (!(absolute & absoluteCol)) c -= col;
+        return true;
+    }, writeRelative);
+}
+
+// Writes the R1C1 references of the text as references from the cell. The text was written by toTemplate,
+// so any word before a '!' is a sheet name and the references are the R1C1 words after it or elsewhere.
+string FormulaCompiler::fromTemplate(const string& text, int row, int col) {
+    string result = "";
+    size_t pos = 0;
+
+    while (pos < text.size()) {
+        char ch = text[pos];
+        if (ch == '@') {
+            result += text[pos++];
+            while (pos < text.size() && isalpha(text[pos]))
+                result += text[pos++];
+            continue;
+        }
+        if (ch == '"') {
+            size_t close = text.find('"', pos + 1);
+            close = (close == string::npos) ? text.size() : close + 1;
+            result += text.substr(pos, close - pos);
+            pos = close;
+            continue;
+        }
+
+        bool startsWord = (pos == 0 || !isalnum(text[pos - 1]));
+        size_t end = pos;
+        while (startsWord && isalpha(ch) && end < text.size() && (isalnum(text[end]) || text[end] == '_'))
+            end++;
+        if (end > pos && end < text.size() && text[end] == '!') {
+            result += text.substr(pos, end + 1 - pos);
+            pos = end + 1;
+            continue;
+        }
+
+        int r, c;
+        unsigned char absolute;
+        end = pos;
+        if (startsWord && readRelative(text, end, r, c, absolute)) {
+            if (!(absolute & absoluteRow)) r += row;
+            if (!(absolute & absoluteCol)) c += col;
+            result += writeReference(r, c, absolute);
+            pos = end;
+            continue;
+        }
+        result += text[pos++];
+    }
+    return result;
+}
+
+// Rewrites every reference of the formula text
+string FormulaCompiler::rewrite(const string& formula, bool ranges, bool sheets,
+                                const function<bool(int&, int&, unsigned char)>& move,
+                                const function<string(int, int, unsigned char)>& write, const string& only) {
+    string result = "";
+    size_t pos = 0;
+    bool named = false;  // The reference at 'pos' follows the prefix of the sheet 'only'
+
+    while (pos < formula.size()) {
+        char ch = formula[pos];
+        if (ch == '@') {
+            // Function name
+            result += formula[pos++];
+            while (pos < formula.size() && isalpha(formula[pos]))
+                result += formula[pos++];
+            continue;
+        }
+        if (ch == '"') {
+            // Quoted criterion, copied as it is (a doubled quote inside reopens it right away)
+            size_t close = formula.find('"', pos + 1);
+            close = (close == string::npos) ? formula.size() : close + 1;
+            result += formula.substr(pos, close - pos);
+            pos = close;
+            continue;
+        }
+
+        bool startsWord = (pos == 0 || !isalnum(formula[pos - 1]));
+        int row, col, lastRow, lastCol;
+        unsigned char first, last;
+        size_t end = pos;
+
+        // A sheet prefix is copied; unless 'sheets', so is the reference after it
+        while (startsWord && isalpha(ch) && end < formula.size() && (isalnum(formula[end]) || formula[end] == '_'))
+            end++;
+        if (end > pos && end < formula.size() && formula[end] == '!') {
+            named = !only.empty() && formula.compare(pos, end - pos, only) == 0;
+            result += formula.substr(pos, end + 1 - pos);
+            pos = end + 1;
+            size_t next = pos;
+            if (!sheets && readReference(formula, next, row, col, first)) {
+                size_t after = next + 2;
+                if (formula.compare(next, 2, "..") == 0 && readReference(formula, after, lastRow, lastCol, last))
+                    next = after;
+                result += formula.substr(pos, next - pos);
+                pos = next;
+            }
+            continue;
+        }
+        bool moving = only.empty() || named;
+        named = false;
+        end = pos;
+        if (startsWord && (ch == '$' || isupper(ch)) && readReference(formula, end, row, col, first)) {
+            size_t next = end + 2;
+            if (!moving) {
+                // A reference that 'only' leaves alone, with the rest of its range
+                if (formula.compare(end, 2, "..") == 0 && readReference(formula, next, lastRow, lastCol, last))
+                    end = next;
+                result += formula.substr(pos, end - pos);
+                pos = end;
+                continue;
+            }
+            if (formula.compare(end, 2, "..") == 0 && readReference(formula, next, lastRow, lastCol, last)) {
+                // A range is moved as a whole, it becomes #REF! if either corner leaves the sheet
+                if (ranges) {
+                    bool inside = move(row, col, first);
+                    inside = move(lastRow, lastCol, last) && inside;
+                    result += inside ? write(row, col, first) + ".." + write(lastRow, lastCol, last) : "#REF!";
+                }
+                else
+                    result += formula.substr(pos, next - pos);
+                pos = next;
+                continue;
+            }
+            result += move(row, col, first) ? write(row, col, first) : "#REF!";
+            pos = end;
+            continue;
+        }
+        result += formula[pos++];
+    }
+    return result;
+}
+
+// Reads a reference from the text (up to three capital letters followed by the row number)
+bool FormulaCompiler::readReference(const string& text, size_t& pos, int& row, int& col, unsigned char& absolute) {
+    size_t i = pos;
+    absolute = 0;
+
+    if (i < text.size() && text[i] == '$') {
+        absolute |= absoluteCol;
+        i++;
+    }
+    col = CellAddress::readColumn(text, i);
+
+    if (i < text.size() && text[i] == '$') {
+        absolute |= absoluteRow;
+        i++;
+    }
+    row = CellAddress::readRow(text, i);
+
+    if (col < 0 || row < 0 || (i < text.size() && isalpha(text[i])))
+        return false;
+    pos = i;
+    row--;
+    col--;
+    return true;
+}
+
+// Returns a program whose value is the error
+CompiledFormula FormulaCompiler::failed(ErrorCode error) {
+    CompiledFormula program;
+    program.code.push_back({OpCode::pushError, Function::sum, 0, 0, 0, 0, (double)error, -1, 0});
+    program.stack.resize(1);
+    return program;
+}
+
+// Writes a zero based reference with its '$' signs
+string FormulaCompiler::writeReference(int row, int col, unsigned char absolute) {
+    return ((absolute & absoluteCol) ? "$" : "") + CellAddress::columnLabel(col) + ((absolute & absoluteRow) ? "$" : "") +
+           to_string(row + 1);
+}
+
+// Reads an R1C1 reference: 'R', then an offset in brackets or a row number, then the same for 'C'
+bool FormulaCompiler::readRelative(const string& text, size_t& pos, int& row, int& col, unsigned char& absolute) {
+    size_t i = pos;
+    absolute = 0;
+    int parts[2] = {0, 0};
+    const char letters[2] = {'R', 'C'};
+
+    for (int part = 0; part < 2; part++) {
+        if (i >= text.size() || text[i] != letters[part])
+            return false;
+        i++;
+        if (i < text.size() && text[i] == '[') {
+            size_t close = text.find(']', i);
+            if (close == string::npos)
+                return false;
+            try {
+                parts[part] = stoi(text.substr(i + 1, close - i - 1));
+            }
+            catch (exception&) {
+                return false;
+            }
+            i = close + 1;
+        }
+        else if (i < text.size() && isdigit(text[i])) {
+            int number = 0;
+            while (i < text.size() && isdigit(text[i]))
+                number = number * 10 + (text[i++] - '0');
+            parts[part] = number - 1;
+            absolute |= part == 0 ? absoluteRow : absoluteCol;
+        }
+    }
+    if (i < text.size() && (isalnum(text[i]) || text[i] == '_'))
+        return false;
+    pos = i;
+    row = parts[0];
+    col = parts[1];
+    return true;
+}
+
+// Writes an R1C1 reference
+string FormulaCompiler::writeRelative(int row, int col, unsigned char absolute) {
+    string text = "R";
+    if (absolute & absoluteRow)
+        text += to_string(row + 1);
+    else if (row != 0)
+        text += "[" + to_string(row) + "]";
+    text += "C";
+    if (absolute & absoluteCol)
+        text += to_string(col + 1);
+    else if (col != 0)
+        text += "[" + to_string(col) + "]";
+    return text;
+}
+
+}
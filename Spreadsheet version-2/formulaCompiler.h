@@ -0,0 +1,438 @@
+#ifndef FORMULA_COMPILER_H
+#define FORMULA_COMPILER_H
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <utility>
+#include "errorValue.h"
+#include "criterion.h"
+
+using namespace std;
+
+namespace spreadsheet {
+    class SpreadSheet;
+}
+
+namespace utils {
+
+// Operation codes of a compiled formula program (postfix order)
+enum class OpCode : unsigned char {
+    pushConst,  // Push a numeric constant
+    pushCell,   // Push the numeric value of a single cell
+    pushError,  // Push an error value found at compile time (like #REF!)
+    aggregate,  // Push the result of a range function over a block of cells
+    pushRange,  // Push the id of a range node, as an argument of a lookup function
+    lookup,     // Pop the arguments of a lookup or conditional function, push its result
+    criterion,  // Resolve a criterion of a conditional function into its slot and push the slot number
+    pushArray,  // Push a block of cells as an operand of an array formula (see CompiledFormula::evaluateArray)
+    broadcast,  // Single valued operand of an array formula: the next 'value' instructions compute it once
+    matrix,     // Result of a matrix function, computed whole before the elements of the array formula
+    negate,     // Unary minus on the top of the stack
+    add,        // Pop two values, push their sum
+    subtract,   // Pop two values, push their difference
+    multiply,   // Pop two values, push their product
+    divide,     // Pop two values, push their quotient
+    equal,      // Pop two values, push 1 if they are equal, 0 otherwise
+    notEqual,   // Pop two values, push 1 if they differ
+    less,       // Pop two values, push 1 if the first is smaller
+    lessEqual,  // Pop two values, push 1 if the first is smaller or equal
+    greater,    // Pop two values, push 1 if the first is larger
+    greaterEqual, // Pop two values, push 1 if the first is larger or equal
+    jumpIfFalse, // Pop a condition, continue at instruction 'range' if it is 0
+    jump,       // Continue at instruction 'range'. In the expression tree, a whole IF, IFS or CHOOSE
+    choose,     // Pop an index k, continue at the k-th of the 'value' jumps that follow (after them if out of range)
+    enter,      // First instruction of a branch of IF, IFS or CHOOSE: records branch 'range' as taken
+    store,      // Copy the value on top of the stack into local 'range' (a subexpression used again later)
+    load,       // Push local 'range', computed earlier in the same evaluation
+    pushSheetCell, // Push the numeric value of a single cell of sheet 'value' of the workbook
+    sheetAggregate // Push the result of a range function over a block of cells of sheet 'value' of the workbook
+};
+
+// Built-in functions, used by the aggregate and lookup instructions.
+// Names, arguments and evaluation of each function are declared in FunctionRegistry.
+enum class Function : unsigned char {
+    sum,
+    aver,
+    max,
+    min,
+    stddev,
+    count,
+    match,
+    vlookup,
+    xlookup,
+    sumif,
+    countif,
+    averif,
+    sumifs,
+    countifs,
+    averifs,
+    mmult,
+    transpose,
+    minverse,
+    median,
+    percentile,
+    quartile,
+    rank,
+    large,
+    small,
+    msum,
+    mavg,
+    mmin,
+    mmax,
+    mstddev,
+    ifThen,
+    ifs,
+    choose,
+    let
+};
+
+// Flags of Instruction::absolute, set for the parts of a reference written with '$' (like $A1 or A$1).
+// Those parts stay fixed when a formula is filled into other cells.
+enum Absolute : unsigned char {
+    absoluteRow = 1,     // Row of the cell, or of the first corner of the range
+    absoluteCol = 2,     // Column of the cell, or of the first corner of the range
+    absoluteLastRow = 4, // Row of the last corner of the range
+    absoluteLastCol = 8  // Column of the last corner of the range
+};
+
+// A single instruction of a compiled formula.
+// Cell references are resolved to zero based grid coordinates at compile time.
+struct Instruction {
+    OpCode op;
+    Function func;
+    int row, col;         // Referenced cell, first cell of the range, or key cell of a lookup / criterion (-1 if computed)
+    int lastRow, lastCol; // Last cell of the range (aggregate and pushRange)
+    double value;         // Constant value (pushConst), the ErrorCode (pushError), the argument count (lookup),
+                          // 1 if the criterion is the number on top of the stack (criterion),
+                          // the number of instructions of the operand (broadcast),
+                          // the index of the first argument program (matrix), the number of choices (choose),
+                          // or the index of the sheet in the workbook (pushSheetCell, sheetAggregate)
+    int range;            // Id of the sheet's range node (aggregate, pushRange, pushArray and, on the other sheet,
+                          // sheetAggregate), the criterion slot (criterion),
+                          // the slot of the result (matrix), the target of a jump (jumpIfFalse, jump),
+                          // the branch (enter) or the local (store, load)
+    unsigned char absolute; // Absolute flags of the reference (pushCell, aggregate, pushRange, pushArray, pushSheetCell,
+                            // sheetAggregate and the key of lookup)
+};
+
+// A reordering of the rows of a block, as done by the sort command:
+// the cell at (r, c) of the block moves to (target[r - row], c).
+struct RowMove {
+    int row, col, lastRow, lastCol; // Zero based corners of the block
+    vector<int> target;             // New row of every row of the block
+};
+
+// A formula compiled once into a postfix program.
+// Evaluation runs over a stack that is allocated at compile time, so re-evaluating allocates nothing.
+class CompiledFormula {
+public:
+    // Returns true if nothing has been compiled yet
+    bool empty() const;
+
+    // Runs the program against the table and returns the numeric result.
+    // 'error' receives the error value of the formula, ErrorCode::none if it has a value.
+    // A program shared by a family of cells (see FormulaTemplate) runs moved by (rows, cols) for each of them.
+    double evaluate(spreadsheet::SpreadSheet& table, ErrorCode& error, int rows = 0, int cols = 0) const;
+
+    // Returns the instructions of the program (used to register dependencies)
+    const vector<Instruction>& getCode() const;
+
+    // Calls 'visit' for every instruction of the program and of the argument programs of its matrix functions.
+    // With (rows, cols), the single references are visited moved like the program of a cell of a family.
+    void forEach(const function<void(const Instruction&)>& visit, int rows = 0, int cols = 0) const;
+
+    // Returns the ids of the sheet names the formula was compiled against
+    const vector<int>& getNames() const;
+
+    // Returns true if the last evaluation ran an instruction that reads the cell at (row, col): a reference to it
+    // or a range over it outside of the branches of IF / IFS / CHOOSE, or inside a branch that was taken.
+    // A formula that only reads the cell in branches it did not take keeps its value when the cell changes.
+    bool reads(int row, int col) const;
+
+    // Returns true if the program can be shared by a family of cells: it only reads single cells of its own sheet
+    // and combines them with operators. Ranges are nodes of one block, and the branches taken by the last
+    // evaluation belong to one cell, so programs with them are not shared.
+    bool isShareable() const;
+
+    // Returns true if every single reference of the program moved by (rows, cols) stays on the sheet
+    bool fits(int rows, int cols, const spreadsheet::SpreadSheet& table) const;
+
+    // Returns true if the formula computes an array: it reads a block of cells outside of any function,
+    // like =A1..A1000*B1..B1000, and spills its elements into the cells below and right of it
+    bool isArray() const;
+
+    // Returns the number of rows / columns of the result of an array formula (1 for other formulas)
+    int getRows() const;
+    int getCols() const;
+
+    // Runs an array program and writes its getRows() x getCols() elements, column by column, into 'values' and
+    // 'errors'. Blocks are read from the column store a chunk at a time and combined with the element-wise kernels;
+    // single valued operands are computed once. An element is an error value if one of its operands is.
+    void evaluateArray(spreadsheet::SpreadSheet& table, double* values, ErrorCode* errors) const;
+
+    // Runs a shared program (see isShareable) for 'count' cells of its family on consecutive rows of one column,
+    // the first one (rows, cols) from the cell it was compiled for, and writes their results into 'values' and
+    // 'errors'. Like an array program, it works a chunk of cells at a time: a reference that moves with the row
+    // reads the chunk's span of a column of the store, one with an absolute row a single value, and + - * / run
+    // through the element-wise kernels. The results equal those of evaluating the cells one by one.
+    void evaluateFamily(spreadsheet::SpreadSheet& table, int rows, int cols, int count,
+                        double* values, ErrorCode* errors) const;
+
+private:
+    friend class FormulaCompiler;
+
+    // Operand of an array program for the current chunk
+    struct Lane {
+        const double* values;    // Values of the chunk, or the single value of a spread operand
+        const ErrorCode* errors; // Error values, like 'values', or nullptr if the operand has none
+        bool spread;             // The operand is one value used for every element
+    };
+
+    // Runs the instructions begin..end-1 of a single valued program and returns the value left on the stack.
+    // Single references are moved by (rows, cols).
+    double run(spreadsheet::SpreadSheet& table, size_t begin, size_t end, ErrorCode& error,
+               int rows = 0, int cols = 0) const;
+
+    // Evaluates the arguments of a matrix instruction into contiguous matrices and computes its result slot
+    void computeMatrix(spreadsheet::SpreadSheet& table, const Instruction& in) const;
+
+    // Computes a range function from the statistics the sheet caches for the range
+    static double aggregate(spreadsheet::SpreadSheet& table, const Instruction& in);
+
+    // Computes a binary operator over the chunk of two operands into the buffer 'out' (which may be an operand's)
+    // and returns the result operand. Error values of the operands are carried in order, and a zero divisor
+    // gives #DIV/0!; the elements with an error value are 0.
+    Lane combine(OpCode op, const Lane& left, const Lane& right, double* out, ErrorCode* outErrors, int n) const;
+
+    vector<Instruction> code;     // Postfix program
+    vector<pair<int, int>> branches;        // Instructions first..second-1 of every branch of IF / IFS / CHOOSE
+    mutable vector<unsigned char> taken;    // Branches run by the last evaluation (all of them before the first)
+    mutable vector<double> stack; // Evaluation stack, sized to the maximum depth of the program
+    mutable vector<double> locals; // Values of the subexpressions used more than once
+    mutable vector<Criterion> criteria; // Criterion slots; quoted criteria are parsed once at compile time
+    vector<int> names;            // Sheet names compiled into the program
+
+    bool array = false;                  // The program is an array program
+    int rows = 1, cols = 1;              // Shape of the result
+    mutable vector<Lane> lanes;          // Operand stack of an array program (then the locals, for a family)
+    mutable vector<double> laneValues;   // Chunk buffer of every operand slot
+    mutable vector<ErrorCode> laneErrors; // Error buffer of every operand slot
+    mutable vector<double> spreadValues; // Single valued operands, computed once per evaluation
+    mutable vector<ErrorCode> spreadErrors;
+
+    vector<CompiledFormula> operands;    // Array programs of the arguments of the matrix functions
+    mutable vector<vector<double>> operandValues;    // Last result of every argument program
+    mutable vector<vector<ErrorCode>> operandErrors;
+    mutable vector<vector<double>> matrixValues;     // Result of every matrix function, in the shape of the program
+    mutable vector<vector<ErrorCode>> matrixErrors;
+    mutable vector<unsigned char> matrixFailed;      // The result of a matrix function has error values
+
+    // Elements of an array operand processed at a time (4 KB of doubles per operand slot)
+    static constexpr int ARRAY_CHUNK = 512;
+};
+
+// Formula shared by the cells of a family, the same formula filled into other cells (like =A1*B1, =A2*B2, ...).
+// The text is kept once in relative (R1C1) form, like =RC[-2]*RC[-1], and the program is compiled once for the
+// cell at (row, col); every cell of the family runs it moved by its own offset from that cell.
+struct FormulaTemplate {
+    string text;             // The formula in R1C1 form (see FormulaCompiler::toTemplate)
+    CompiledFormula program; // The program, compiled for the cell at (row, col)
+    int row, col;            // Zero based position the program was compiled for
+};
+
+// Compiles formula text ('=' expressions and '@' range functions) into a CompiledFormula.
+// Supports + - * /, comparisons (= <> < <= > >=, giving 1 or 0), unary minus, parentheses, numbers, cell references,
+// @FUNC(X..Y) range functions and @FUNC(key, X..Y, ...) lookup and conditional functions.
+// @IF(condition, a[, b]), @IFS(condition1, a1, ...) and @CHOOSE(k, a1, ...) compile to jumps: only the branch
+// they select is evaluated, so an expensive argument that is not selected costs nothing.
+// @LET(name, value, ..., result) names values for the result; names are lowercase letters and digits.
+// Any other name is a sheet name (see NameTable), compiled as its block or constant; #NAME? if it is not defined.
+// In a workbook, Sheet2!A1 reads a cell of another sheet and @SUM(Sheet2!A1..A9) (or another range function)
+// a block of it; blocks of other sheets are not taken by lookups or array formulas. Unknown sheets are #REF!.
+// A subexpression written more than once, or a name used more than once, is computed once per evaluation.
+// A block X..Y used as an operand makes an array formula,
+// and so do the matrix functions @MMULT(A, B), @TRANSPOSE(A) and @MINVERSE(A) over blocks or array expressions.
+class FormulaCompiler {
+public:
+    // Compiles the formula, throws invalid_argument on malformed input.
+    // References outside the sheet do not throw, they compile to a #REF! error value.
+    // Ranges are registered with the sheet's range index, which caches their statistics.
+    static CompiledFormula compile(const string& formula, spreadsheet::SpreadSheet& table);
+
+    // Returns the program of the formula moved by (rows, cols), as when it is filled into another cell.
+    // Relative references move, absolute ones stay; references that leave the sheet become #REF!.
+    // The source program is reused instead of compiling the moved formula text again.
+    static CompiledFormula relocate(const CompiledFormula& program, int rows, int cols, spreadsheet::SpreadSheet& table);
+
+    // Returns the formula text moved by (rows, cols), with the same rules as the program
+    static string relocate(const string& formula, int rows, int cols, const spreadsheet::SpreadSheet& table);
+
+    // Returns the program with its single references into the block following the cells the move takes
+    // elsewhere, so the formula keeps reading the same cells. Ranges are kept: they still cover the block.
+    // For a formula of another sheet, 'sheet' is the index of the sheet of the block: only the references
+    // to that sheet (Sheet2!A1) follow.
+    static CompiledFormula follow(const CompiledFormula& program, const RowMove& move, int sheet = -1);
+
+    // Returns the formula text with the same rules as the program; 'sheet' is then the name of the sheet
+    static string follow(const string& formula, const RowMove& move, const string& sheet = "");
+
+    // Returns the formula text written at (row, col) in relative (R1C1) form: the relative parts of references are
+    // offsets from the cell in brackets, left out when 0 (=RC[-2]*R[1]C for =A5*C6 at C5), and the absolute parts
+    // are numbers (R5C1 for $A$5). A formula and the formulas filled from it have the same R1C1 text.
+    static string toTemplate(const string& formula, int row, int col);
+
+    // Returns the formula text of an R1C1 formula placed at (row, col)
+    static string fromTemplate(const string& text, int row, int col);
+
+    // Returns a program whose value is the error, for a formula that no longer compiles
+    static CompiledFormula failed(ErrorCode error);
+
+private:
+    // Node of the expression tree built while parsing
+    struct Node {
+        OpCode op = OpCode::pushConst;
+        Function func = Function::sum;
+        int row = 0, col = 0, lastRow = 0, lastCol = 0;
+        double value = 0.0;
+        int left = -1, right = -1;  // Child node indexes, -1 if unused
+        unsigned char absolute = 0; // Absolute flags of the reference
+        vector<int> arguments = {}; // Argument nodes of a lookup, in order
+        int slot = -1;              // Criterion slot (criterion only)
+    };
+
+    // Parsing state shared by the recursive descent functions
+    struct Source {
+        const string& text;
+        size_t pos;
+        spreadsheet::SpreadSheet& table;
+        vector<Node> tree = {};
+        vector<Criterion> criteria = {}; // Criterion slots of the program
+        vector<pair<string, int>> names = {}; // Names of the enclosing LET functions and their value nodes, innermost last
+        vector<int> bound = {};              // Ids of the sheet names used by the formula
+
+        // Common subexpressions, see share
+        vector<int> uses = {};               // Number of parents of every node, 0 if it is not shared
+        vector<int> locals = {};             // Local of every shared node, -1 until it is first emitted
+        vector<vector<int>> storedIn = {};   // Scopes around the store of every shared node
+        vector<int> scopes = {};             // Scopes around the instruction being emitted
+        int nextScope = 0;
+    };
+
+    // let := '@LET(' (name ',' comparison ',')+ comparison ')'
+    static int parseLet(Source& src);
+
+    // name := [a-z] [a-z0-9]*, a value named by an enclosing LET
+    static string parseName(Source& src);
+
+    // Node of a sheet name: its block (a range argument when 'range', otherwise a block operand or a single
+    // cell) or its constant. Undefined names are #NAME?, and a constant given for a range is #VALUE!.
+    static int nameNode(Source& src, const string& name, bool range);
+
+    // sheet := NAME '!', the sheet of a reference on another sheet. Reads nothing and returns false if the text
+    // at 'pos' is not a sheet prefix; otherwise 'sheet' receives the index of the sheet, -1 if there is no such sheet.
+    static bool parseSheet(Source& src, int& sheet);
+
+    // Node of the reference that follows a sheet prefix: a single cell, or a block for a range argument
+    // ('range'). A reference to the formula's own sheet compiles like one without prefix.
+    static int sheetNode(Source& src, int sheet, bool range);
+
+    // comparison := expression (('=' | '<>' | '<' | '<=' | '>' | '>=') expression)*
+    static int parseComparison(Source& src);
+
+    // expression := term (('+' | '-') term)*
+    static int parseExpression(Source& src);
+
+    // term := unary (('*' | '/') unary)*
+    static int parseTerm(Source& src);
+
+    // unary := ('-' | '+') unary | primary
+    static int parsePrimaryOrUnary(Source& src);
+
+    // function := '@' NAME '(' range ')' | '@' NAME '(' argument (',' argument)* ')'
+    // where each argument is a range or an expression, as the function declares
+    static int parseFunction(Source& src);
+
+    // criterion := '"' text '"' | expression
+    // A quoted criterion is parsed here; a single reference is read at evaluation, so the cell may hold a number
+    // or a criterion text like ">10"; any other expression matches the numbers equal to its value.
+    static int parseCriterion(Source& src);
+
+    // range := [sheet] reference '..' reference | name | '#REF!'
+    // Returns a pushRange node (sheetAggregate for a block of another sheet), or a #REF! node if the range
+    // leaves the sheet.
+    static int parseRange(Source& src);
+
+    // Reads a cell reference like "B12" or "$B$12" and resolves it to zero based coordinates.
+    // 'absolute' receives absoluteRow / absoluteCol for the parts written with '$'.
+    // Returns false if the reference is outside the sheet.
+    static bool parseReference(Source& src, int& row, int& col, unsigned char& absolute);
+
+    // Orders the corners of a range so the first one is the top left, swapping their absolute flags along
+    static void normalizeRange(int& row, int& col, int& lastRow, int& lastCol, unsigned char& absolute);
+
+    // Rewrites every reference of the formula text through 'move', which receives the zero based row and column
+    // of a reference with its absolute flags (absoluteRow / absoluteCol) and returns false if the moved reference
+    // is off the sheet, which is written #REF!. Ranges are moved corner by corner when 'ranges' is true and
+    // copied unchanged otherwise; references on other sheets (after a "Sheet2!" prefix) are moved along with
+    // the others when 'sheets' is true. Moved references are written by 'write'. When 'only' names a sheet,
+    // just the references after its prefix are moved and all others are copied.
+    // Function names and numbers are copied as they are.
+    static string rewrite(const string& formula, bool ranges, bool sheets,
+                          const function<bool(int&, int&, unsigned char)>& move,
+                          const function<string(int, int, unsigned char)>& write = writeReference,
+                          const string& only = "");
+
+    // Reads a reference like "B12" or "$B$12" from the text at 'pos' without checking it against the sheet.
+    // Leaves 'pos' unchanged and returns false if there is no reference there.
+    static bool readReference(const string& text, size_t& pos, int& row, int& col, unsigned char& absolute);
+
+    // Writes a zero based reference with its '$' signs
+    static string writeReference(int row, int col, unsigned char absolute);
+
+    // Reads an R1C1 reference like "RC[-1]" or "R5C[2]" from the text at 'pos'. The relative parts are offsets,
+    // the absolute ones zero based positions. Leaves 'pos' unchanged and returns false if there is none there.
+    static bool readRelative(const string& text, size_t& pos, int& row, int& col, unsigned char& absolute);
+
+    // Writes an R1C1 reference, the relative parts given as offsets and the absolute ones as zero based positions
+    static string writeRelative(int row, int col, unsigned char absolute);
+
+    // Adds a node to the tree and returns its index
+    static int addNode(Source& src, const Node& node);
+
+    // Skips blanks in the formula text
+    static void skipSpaces(Source& src);
+
+    // Emits the subtree rooted at 'node' in postfix order and tracks the stack depth
+    static void emit(Source& src, int node, CompiledFormula& program, int& depth, int& maxDepth);
+
+    // Merges the identical subtrees of the tree under 'root' and counts the parents of every node.
+    // A shared node is computed by its first emission, which stores it in a local, and loaded by the others.
+    static void share(Source& src, int& root);
+
+    // Emits an IF, IFS or CHOOSE node as a condition (or index) followed by jumps around its branches
+    static void emitBranches(Source& src, const Node& n, CompiledFormula& program, int& depth, int& maxDepth);
+
+    // Computes the shape (rows, cols) of the value of every node under 'node' into 'shapes', (0, 0) for single values.
+    // Blocks keep their size; operators take the size of their block operands, which must all match, and spread
+    // single values over them. Returns false if blocks of different sizes meet.
+    // Throws invalid_argument if a block is passed where a function expects a single value.
+    static bool shapeOf(Source& src, int node, vector<pair<int, int>>& shapes);
+
+    // Emits an array program: blocks and operators work on whole arrays, and every single valued subtree
+    // is emitted after a broadcast instruction, to be computed once per evaluation
+    static void emitArray(Source& src, int node, const vector<pair<int, int>>& shapes, CompiledFormula& program,
+                          int& maxDepth, int& lanes, int& maxLanes, int& spreads);
+
+    // Builds the array program of the subtree and sizes its buffers. The arguments of matrix functions become
+    // array programs of their own, evaluated whole before the program streams its elements.
+    static CompiledFormula buildArray(Source& src, int node, const vector<pair<int, int>>& shapes);
+
+    // Computes the shape of the result of a matrix function from the shapes of its arguments.
+    // Returns false if the shapes do not fit the function (like MMULT of 2x3 and 2x3).
+    static bool matrixShape(Function func, const vector<pair<int, int>>& arguments, pair<int, int>& shape);
+};
+
+}
+
+#endif
@@ -1,5 +1,8 @@
 
 #include "formulaParser.h"
+#include "functionRegistry.h"
+#include "workbook.h"
+#include "cellAddress.h"
 #include <vector>
 #include <string>
 #include <iostream>
@@ -12,137 +15,48 @@ using namespace std;
 namespace utils{
 
 void FormulaParser::parserFormula(Cell* cell, SpreadSheet& table) {
-    // Static vectors to store parsed formula elements:
-    // 'op' stores operators (+, -, *, /), 'element' stores individual formula components (e.g., cell references), and 
-    // 'numbers' stores numeric values derived from the formula elements.
-    vector<char> op;  
-    vector<string> element;
-    vector<double> numbers;
-    string token = "";
+    // A cell of the result of an array formula copies its element from the formula
+    if (cell->getType() == Type::spill) {
+        SpillCell* spill = static_cast<SpillCell*>(cell);
+        spill->pull(dynamic_cast<const FormulaCell*>(table.getCell(spill->getAnchorRow(), spill->getAnchorCol())));
+        return;
+    }
+
     char c = cell->getContent()[0];  // Get the first character of the cell content
 
     switch (c) {
-        case '=': {  // Case where the formula starts with '='
-            // Parse the formula by separating operators and numbers/cell references
-            int checkmin=1;
-            for (char ch : cell->getContent()) {
-                if (checkmin==0 && (ch == '+' || ch == '-' || ch == '*' || ch == '/')) {
-                    if (!token.empty()) {
-                        element.push_back(token);  // Add the current token (number or cell reference) to element
-                        op.push_back(ch);  // Add the operator to op
-                        token.clear();  // Reset the token for the next number or reference
-                        checkmin=1;
-                    }
-                } else if (ch != '=') {
-                    token += ch;  // Accumulate the current character into the token
-                    checkmin=0;
-                }
-            }
-
-            // Add the final token (after the last operator)
-            if (!token.empty()) {
-                element.push_back(token);
-            }
-
-            vector<int> index;
-            for (int i = 0; i < element.size(); i++) {
-                // Check if the first character of the element is a minus sign ('-').
-                if (element[i][0] == '-') {
-                    index.push_back(i);  // Add the index of the element to the 'index' vector.
-                    element[i].erase(0, 1);  // Remove the minus sign ('-') from the beginning of the element.
-                }
-            }
-
-
-            // Validate if the formula is valid with respect to the table
-            try{
-                isValid(table,element);
-
-            }
-            catch(exception& e){
-                table.setContent(cell->getRow()-4, (cell->getCol()-4)/CELL_SIZE,"");
-                cout << "\033[" << cell->getRow() << ";" << cell->getCol() << "H" << "       " << std::flush;
-                throw;
-            }
-
-            // Convert all the element strings to numeric values (either from cells or direct numbers)
-            convertToDouble(table,element,numbers);
-
-            //Multiply previously saved values ​​by minus.
-             for(int i=0;i<index.size();i++){
-                numbers[index[i]]=-numbers[index[i]];
-            }
-
-            // Process multiplication and division first
-            for (int i = 0; i < op.size(); i++) {
-                if (op[i] == '*' || op[i] == '/') {
-                    try{
-                        numbers[i] = applyOp(numbers[i], numbers[i + 1], op[i]);  // Apply operation
-                    }
-                    catch(exception& e){
-                        table.setContent(cell->getRow()-4, (cell->getCol()-4)/CELL_SIZE,"");
-                        cout << "\033[" << cell->getRow() << ";" << cell->getCol() << "H" << "       " << std::flush;
-                        throw;
-                    }
-                    numbers.erase(numbers.begin() + i + 1);  // Remove the processed number
-                    op.erase(op.begin() + i);  // Remove the operator
-                    i--;  // Adjust the index after removal
-                }
-            }
-
-            // Process remaining addition and subtraction operations
-            while (!op.empty()) {
-                try{
-                    double result = applyOp(numbers[0], numbers[1], op[0]);  // Apply the operation
-                    numbers[0] = result;  // Store the result back
-                    numbers.erase(numbers.begin() + 1);  // Remove the second operand
-                    op.erase(op.begin());  // Remove the operator
-                }
-                catch(exception& e){
-                        table.setContent(cell->getRow()-4, (cell->getCol()-4)/CELL_SIZE,"");
-                        cout << "\033[" << cell->getRow() << ";" << cell->getCol() << "H" << "       " << std::flush;
-                        throw;
+        case '=':    // Arithmetic formula
+        case '@': {  // Range-based functions like SUM, AVER, etc.
+            FormulaCell* formulaCell = dynamic_cast<FormulaCell*>(cell);
+            if (formulaCell == nullptr)
+                break;
+
+            // The formula is compiled only once, later evaluations just run the program
+            if (formulaCell->getProgram().empty()) {
+                try {
+                    if (c == '@')
+                        isValid(table, cell->getContent());  // Check that the function is supported
+                    formulaCell->compile(table);
                 }
-            }
-
-            double result = numbers[0];  // Final result of the formula
-
-            // Set the result value to the cell
-            cell->setValue(to_string(result));
-
-            // Update dependent cells
-            for (const string& ref : element) {
-                if (isCell(ref)) {
-                    int r = getRows(ref);
-                    int c = getCols(ref);
-                    table.getCell(r - 1, c - 1)->addDependents(cell);  // Add this cell as a dependent to others
+                catch (exception& e) {
+                    clearCell(cell, table);  // Invalid formula, clear the cell content
+                    throw;
                 }
+                formulaCell->setCyclic(addDependencies(formulaCell, table));
+                if (formulaCell->getProgram().isArray())
+                    table.placeSpill(formulaCell);  // The cells of the result, or #SPILL! if they are taken
             }
-
+            evaluate(formulaCell, table);
         } break;
 
-        case '<':// for copy;
-        case '@': {  // Case where the formula starts with '@' (range-based functions like SUM, AVER, etc.)
+        case '<': {  // Copy command: <X-CPY(A..B) copies cell X into the range A..B
             string str = "";
             int k,l, flag = 0;
             string firstCell = "", lastCell = "",position="";
             int fr, fc, lr, lc, pr, pc;
-            double result = 0.0;
             char ch;
             k=1;
 
-            // Validate the range of cells
-            if (c == '@') {
-                try {
-                    // Check if the cell's content is valid
-                    isValid(table, cell->getContent());
-                }
-                catch (exception& e) {
-                    // Clear the content of the invalid cell and rethrow the exception
-                    table.setContent(cell->getRow() - 4, (cell->getCol() - 4) / CELL_SIZE, "");
-                    throw;
-                }
-            }
             if (c == '<') {
                 try {
                     // Validate the entire cell
@@ -183,188 +97,37 @@ void FormulaParser::parserFormula(Cell* cell, SpreadSheet& table) {
                 k++;
             }
 
-            // Convert first and last cell references to row and column numbers
-            fr = getRows(firstCell);
-            fc = getCols(firstCell);
-            lr = getRows(lastCell);
-            lc = getCols(lastCell);
+            // Convert first and last cell references to zero based rows and columns (-1 if malformed)
+            if (!CellAddress::parse(firstCell, fr, fc))
+                fr = fc = -1;
+            if (!CellAddress::parse(lastCell, lr, lc))
+                lr = lc = -1;
 
-            if(c=='<'){ 
-                pr = getRows(position); //row of the cell to be copied
-                pc = getCols(position); //col of the cell to be copied
+            if(c=='<' && !CellAddress::parse(position, pr, pc)){ //row and col of the cell to be copied
+                pr = pc = -1;
             }
 
             // Check if the row and column numbers are within valid bounds of the spreadsheet
-            if(fr > table.getNumRows() || fr < 1 || fc > table.getNumCols() || fc < 1){
+            if(fr >= table.getNumRows() || fr < 0 || fc >= table.getNumCols() || fc < 0){
                 table.setContent(cell->getRow()-4, (cell->getCol()-4)/CELL_SIZE,"");  // Invalid range, clear the cell content
                 throw out_of_range("Invalid Range.");
     
             }
-            if(lr > table.getNumRows() || lr < 1 || lc > table.getNumCols() || lc < 1){
+            if(lr >= table.getNumRows() || lr < 0 || lc >= table.getNumCols() || lc < 0){
                table.setContent(cell->getRow()-4, (cell->getCol()-4)/CELL_SIZE,"");  // Invalid range, clear the cell content
                  throw out_of_range("Invalid Range.");
             }
            
-            if(c=='<' && (pr > table.getNumRows() || pr < 1 || pc > table.getNumCols() || pc < 1)){
+            if(c=='<' && (pr >= table.getNumRows() || pr < 0 || pc >= table.getNumCols() || pc < 0)){
                 throw out_of_range("Invalid Range.");
             }
 
-            int findex=(fc==lc) ? fr : fc;
-            int lindex=(fc==lc) ? lr : lc;
-
-    
-            // Mark dependent cells in the specified range
-             if(c=='@'){
-                
-                for (int i = findex; i <= lindex; i++) {
-                    int r=i-1;
-                    int c=(fc==lc) ? fc-1 : fr-1;
-                    if(fc!=lc){ int temp= r; r=c;c=temp;}
-                    // Add current cell as a dependent for the range
-                    table.getCell(r, c)->addDependents(cell);  
-                }
-                
-            }
-
-            // Calculate the result based on the specified function
-            if (str == "SUM") {
-                // Calculates the sum of the values in the specified range of cells for the "SUM" function.
-                for (int i = findex; i <= lindex; i++) {
-                    int r=i-1;
-                    int c=(fc==lc) ? fc-1 : fr-1;
-                    if(fc!=lc){ int temp= r; r=c;c=temp;}
-                    // If the cell contains a formula or a value, add its value to the result.
-                    if(table.getCell(r, c)->getType() == Type::formula || table.getCell(r ,c)->getType() == Type::value)
-                        result += stod(table.getCell(r, c)->getValue());  // Convert the cell's value to double and add it.
-                }
-            } 
-            else if (str == "AVER") {
-                // Calculates the average of the values in the specified range of cells for the "AVER" function.
-                int count = 0;  // Counter for invalid cells (not formula or value).
-                for (int i = findex; i <= lindex; i++) {
-                    int r=i-1;
-                    int c=(fc==lc) ? fc-1 : fr-1;
-                    if(fc!=lc){ int temp= r; r=c;c=temp;}
-
-                    // If the cell contains a formula or a value, add its value to the result.
-                    if(table.getCell(r, c)->getType() == Type::formula || table.getCell(r ,c)->getType() == Type::value)
-                        result += stod(table.getCell(r, c)->getValue());
-                    else
-                        count++;  // Increment the counter for invalid cells.
-                }
-                result /= (lindex - findex + 1 - count);  // Divide the sum by the number of valid cells to calculate the average.
-            } 
-            
-            else if (str == "MAX") {
-                // Finds the maximum value in the specified range of cells for the "MAX" function.
-                double max;
-                // Initialize 'max' with the first valid cell value in the range.
-                for (int i = findex; i <= lindex; i++) {
-                    int r=i-1;
-                    int c=(fc==lc) ? fc-1 : fr-1;
-                    if(fc!=lc){ int temp= r; r=c;c=temp;}
-
-                    if(table.getCell(r, c)->getType() == Type::formula || table.getCell(r,c)->getType() == Type::value){
-                        max = stod(table.getCell(r, c)->getValue());
-                        break;
-                    }
-                }
-                // Iterate through the rest of the range to find the maximum value.
-                for (int i = findex + 1; i <= lindex; i++) {
-                    int r=i-1;
-                    int c=(fc==lc) ? fc-1 : fr-1;
-                    if(fc!=lc){ int temp= r; r=c;c=temp;}
-
-                    if(table.getCell(r, c)->getType() == Type::formula || table.getCell(r, c)->getType() == Type::value){
-                        if (stod(table.getCell(r, c)->getValue()) > max) {
-                            max = stod(table.getCell(r, c)->getValue());  // Update 'max' if a larger value is found.
-                        }
-                    }
-                }
-                result = max;  // Store the maximum value in 'result'.
-            }
-
-            else if (str == "MIN") {
-                // Finds the minimum value in the specified range of cells for the "MIN" function.
-                double min;
-                // Initialize 'min' with the first valid cell value in the range.
-                for (int i = findex; i <= lindex; i++) {
-                    int r=i-1;
-                    int c=(fc==lc) ? fc-1 : fr-1;
-                    if(fc!=lc){ int temp= r; r=c;c=temp;}
-
-                    if(table.getCell(r, c)->getType() == Type::formula || table.getCell(r,c)->getType() == Type::value){
-                        min = stod(table.getCell(r, c)->getValue());
-                        break;
-                    }
-                }
-                // Iterate through the rest of the range to find the minimum value.
-                for (int i = findex + 1; i <= lindex; i++) {
-                    int r=i-1;
-                    int c=(fc==lc) ? fc-1 : fr-1;
-                    if(fc!=lc){ int temp= r; r=c;c=temp;}
-
-                    if(table.getCell(r, c)->getType() == Type::formula || table.getCell(r, c)->getType() == Type::value){
-                        if (stod(table.getCell(r, c)->getValue()) < min) {
-                            min = stod(table.getCell(r, c)->getValue());  // Update 'min' if a smaller value is found.
-                        }
-                    }
-                }
-                result = min;  // Store the minimum value in 'result'.
-            } 
-
-            else if (str == "STDDEV") {
-                // Calculates the standard deviation of the values in the specified range of cells for the "STDDEV" function.
-                double sum = 0.0;  // To store the sum of all valid cell values.
-                int count = 0;  // Counter for invalid cells (not formula or value).
-                for (int i = findex; i <= lindex; i++) {
-                    int r=i-1;
-                    int c=(fc==lc) ? fc-1 : fr-1;
-                    if(fc!=lc){ int temp= r; r=c;c=temp;}
-
-                    // If the cell contains a formula or a value, add its value to the sum.
-                    if(table.getCell(r, c)->getType() == Type::formula || table.getCell(r, c)->getType() == Type::value)
-                        sum += stod(table.getCell(r, c)->getValue());
-                    else
-                        count++;  // Increment the counter for invalid cells.
-                }
-
-                sum /= (lindex - findex + 1-count);  // Calculate mean
-                for (int i = findex; i <= lindex; i++) {
-                    int r=i-1;
-                    int c=(fc==lc) ? fc-1 : fr-1;
-                    if(fc!=lc){ int temp= r; r=c;c=temp;}
-                    if(table.getCell(r, c)->getType()==Type::formula || table.getCell(r, c)->getType()==Type::value)
-                        result += pow(stod(table.getCell(r, c)->getValue()) - sum, 2);  // Sum squared differences
-                }
-                result = sqrt(result / (lindex - findex + 1-count));  // Standard deviation calculation
-               
+            if(str=="CPY"){
+                // Fill the block spanned by the two corners with the source cell. Relative references of a
+                // formula source are moved to each target, and the block is recalculated once.
+                table.fill(pr, pc, min(fr,lr), min(fc,lc), max(fr,lr), max(fc,lc));
             }
 
-            else if(str=="CPY"){
-                string str= table.getCell(pr-1,pc-1)->getContent();
-                for (int i = findex; i <= lindex; i++) {
-                    int r=i-1;
-                    int c=(fc==lc) ? fc-1 : fr-1;
-                    if(fc!=lc){ int temp= r; r=c;c=temp;}
-
-                    // Set the content of the target cell (i-1, fc-1) to the source cell's content
-                     table.setContent(r,c,str);
-
-                    // If the source cell contains a string or is empty
-                    if(!(table.getCell(pr-1,pc-1)->getType()==Type::string ||table.getCell(pr-1,pc-1)->getType()==Type::empty)){
-                        string str;
-                        // Set the value of the target cell to the source cell's value
-                        table.getCell(r, c)->setValue(table.getCell(pr-1,pc-1)->getValue());
-                        str=table.getCell(r, c)->getValue().substr(0,CELL_SIZE-1);
-                    }
-                }
-            }
-
-            // Set the calculated result to the cell
-            if(c=='@')
-            cell->setValue(to_string(result));
-           
         } break;
 
        
@@ -374,90 +137,262 @@ void FormulaParser::parserFormula(Cell* cell, SpreadSheet& table) {
 }
 
 
-// Function to apply arithmetic operation on two numbers (a and b) based on the operator 'op'
-double FormulaParser::applyOp(double a, double b, char op) {
-    if(op=='/' && b==0){
-        throw out_of_range("Division by zero error.");
+// Runs the program of the formula. Evaluation never throws: errors like #DIV/0! are stored in the cell
+// and the formula is kept.
+void FormulaParser::evaluate(FormulaCell* cell, SpreadSheet& table) {
+    if (cell->isCyclic()) {
+        cell->setResult(0.0, ErrorCode::cycle);
+        return;
     }
-    switch (op) {
-        case '+': return a + b;   // Add a and b
-        case '-': return a - b;   // Subtract b from a
-        case '*': return a * b;   // Multiply a and b
-        case '/': return a / b;   // Divide a by b
-        default: return 0;        // If an unknown operator, return 0
+    if (cell->getProgram().isArray()) {
+        if (cell->isSpilled())
+            cell->evaluateArray(table);
+        else
+            cell->setResult(0.0, ErrorCode::spill);
+        return;
     }
+    ErrorCode error;
+    int rows, cols;
+    cell->getOffset(rows, cols);
+    double value = cell->getProgram().evaluate(table, error, rows, cols);
+    cell->setResult(error == ErrorCode::none ? value : 0.0, error);
 }
 
-// Function to convert the elements (cell references or numbers) to double values
-void FormulaParser::convertToDouble(SpreadSheet& table, const vector<string> &element, vector<double> &numbers) {
-    for(int i = 0; i < element.size(); i++) {
-        if(isalpha(element[i][0])) { // If it's a cell reference (e.g., A1)
-            int c = getCols(element[i]);  // Get column index
-            int r = getRows(element[i]);  // Get row index
-            if(table.getCell(r - 1, c - 1)->getType()==Type::string || table.getCell(r - 1, c - 1)->getType()==Type::empty){
-                numbers.push_back(0);
-            }
-            else 
-            numbers.push_back(stod(table.getCell(r - 1, c - 1)->getValue())); // Convert cell value to double
-        } else {
-            double num = stod(element[i]);  // Convert the string number to double
-            numbers.push_back(num);
-        }
+// Parses and runs the sort command
+void FormulaParser::sortCommand(const string& command, SpreadSheet& table) {
+    if (command.compare(0, 6, "^SORT(") != 0 || command.back() != ')')
+        throw invalid_argument("Invalid Formula.");
+    vector<string> args = commandArguments(command, 6);
+
+    int row, col, lastRow, lastCol;
+    readBlock(table, args[0], row, col, lastRow, lastCol);
+
+    // The key columns, by letter
+    vector<SortKey> keys;
+    for (size_t i = 1; i < args.size(); i++) {
+        string key = args[i];
+        bool descending = !key.empty() && key[0] == '-';
+        if (!key.empty() && (key[0] == '-' || key[0] == '+'))
+            key = key.substr(1);
+        keys.push_back({readColumn(key, col, lastCol), descending});
     }
+    if (keys.empty())
+        keys.push_back({col, false});
+
+    table.sort(row, col, lastRow, lastCol, keys);
 }
 
-// Check if a given string represents a cell reference
-bool FormulaParser::isCell(const string& str) {
-    return isalpha(str[0]);  // Return true if the string starts with a letter (i.e., it's a cell reference)
+// Parses and runs the pivot command
+void FormulaParser::pivotCommand(const string& command, SpreadSheet& table) {
+    if (command.compare(0, 7, "^PIVOT(") != 0 || command.back() != ')')
+        throw invalid_argument("Invalid Formula.");
+    vector<string> args = commandArguments(command, 7);
+    if (args.size() != 5 && args.size() != 6)
+        throw invalid_argument("Invalid Formula.");
+    bool crossTable = args.size() == 6;
+
+    int row, col, lastRow, lastCol;
+    readBlock(table, args[0], row, col, lastRow, lastCol);
+
+    PivotSpec spec;
+    spec.row = row;
+    spec.lastRow = lastRow;
+    spec.rowKey = readColumn(args[1], col, lastCol);
+    spec.colKey = crossTable ? readColumn(args[2], col, lastCol) : -1;
+    spec.valueCol = readColumn(args[crossTable ? 3 : 2], col, lastCol);
+
+    // The function, by its formula or Excel name
+    const string& name = args[crossTable ? 4 : 3];
+    const FunctionInfo* info = FunctionRegistry::find(name);
+    if (info == nullptr)
+        info = FunctionRegistry::findExcel(name);
+    if (info == nullptr || (info->id != Function::sum && info->id != Function::count && info->id != Function::aver))
+        throw invalid_argument("Invalid Formula.");
+    spec.function = info->id;
+
+    // The result grows down and to the right, so it must start below or right of the block
+    const string& target = args[crossTable ? 5 : 4];
+    checkReference(table, target);
+    CellAddress::parse(target, spec.targetRow, spec.targetCol);
+    if (spec.targetRow <= lastRow && spec.targetCol <= lastCol)
+        throw out_of_range("Invalid Range.");
+
+    table.pivot(spec);
 }
 
-// Function to extract the row number from a cell reference
-int FormulaParser::getRows(const string& str) {
-    int r = 0;
-    for(char c : str) {  // Loop through each character in the string
-        if(isdigit(c)) {  // If the character is a digit
-            r += c - '0';  // Convert the character to its numeric value
-            r *= 10;  // Shift the number
+// Parses and runs the name command
+void FormulaParser::nameCommand(const string& command, SpreadSheet& table) {
+    if (command.compare(0, 6, "^NAME(") != 0 || command.back() != ')')
+        throw invalid_argument("Invalid Formula.");
+    vector<string> args = commandArguments(command, 6);
+    if (args.size() > 2)
+        throw invalid_argument("Invalid Formula.");
+
+    // Formulas read a lowercase word as a name, uppercase ones are references
+    const string& name = args[0];
+    if (name.empty() || !islower(name[0]))
+        throw invalid_argument("Invalid Formula.");
+    for (char c : name)
+        if (!islower(c) && !isdigit(c))
+            throw invalid_argument("Invalid Formula.");
+
+    // Without a definition the name is removed
+    NameDefinition definition;
+    if (args.size() == 2) {
+        const string& value = args[1];
+        definition.defined = true;
+        if (value.find("..") != string::npos) {
+            definition.range = true;
+            readBlock(table, value, definition.row, definition.col, definition.lastRow, definition.lastCol);
+        }
+        else if (!value.empty() && isupper(value[0])) {
+            definition.range = true;
+            checkReference(table, value);
+            CellAddress::parse(value, definition.row, definition.col);
+            definition.lastRow = definition.row;
+            definition.lastCol = definition.col;
+        }
+        else {
+            size_t used = 0;
+            try {
+                definition.value = stod(value, &used);
+            }
+            catch (exception& e) {
+                throw invalid_argument("Invalid Formula.");
+            }
+            if (used != value.size())
+                throw invalid_argument("Invalid Formula.");
         }
     }
-    r = r / 10;  // Correct the row number by dividing by 10 (as it was multiplied in the loop)
-    return r;
+    table.defineName(name, definition);
+}
+
+// Runs a '^' command by its name
+void FormulaParser::runCommand(const string& command, SpreadSheet& table) {
+    if (command.compare(0, 6, "^SORT(") == 0)
+        sortCommand(command, table);
+    else if (command.compare(0, 7, "^PIVOT(") == 0)
+        pivotCommand(command, table);
+    else if (command.compare(0, 6, "^NAME(") == 0)
+        nameCommand(command, table);
+    else
+        throw invalid_argument("Invalid Formula.");
 }
 
-// Function to extract the column number from a cell reference
-int FormulaParser::getCols(const string& str) {
-    if(!isalpha(str[1])) {
-        return str[0] - 'A' + 1;  // If it's a single letter (A, B, C, etc.), return its position (1, 2, 3, ...)
-    } else {
-        int sum = 0;
-        sum += (str[0] - 'A' + 1) * 26;  // Account for two-letter columns like AA, AB, etc.
-        sum += str[1] - 'A' + 1;  // Add the second letter's value
-        return sum;
+// Splits the arguments of a command at the commas, dropping blanks
+vector<string> FormulaParser::commandArguments(const string& command, size_t open) {
+    vector<string> args(1, "");
+    for (size_t i = open; i + 1 < command.size(); i++) {
+        if (command[i] == ',')
+            args.push_back("");
+        else if (command[i] != ' ')
+            args.back() += command[i];
     }
+    return args;
 }
 
-// This function validates the formula string to ensure it uses a valid function and proper syntax.
+// Reads a block given by two opposite corners
+void FormulaParser::readBlock(const SpreadSheet& table, const string& str, int& row, int& col, int& lastRow, int& lastCol) {
+    size_t dots = str.find("..");
+    if (dots == string::npos)
+        throw invalid_argument("Invalid Formula.");
+    string firstCell = str.substr(0, dots), lastCell = str.substr(dots + 2);
+    checkReference(table, firstCell);
+    checkReference(table, lastCell);
+    int firstRow, firstCol;
+    CellAddress::parse(firstCell, firstRow, firstCol);
+    CellAddress::parse(lastCell, lastRow, lastCol);
+    row = min(firstRow, lastRow);
+    lastRow = max(firstRow, lastRow);
+    col = min(firstCol, lastCol);
+    lastCol = max(firstCol, lastCol);
+}
 
-void FormulaParser::isValid(const SpreadSheet& table, const string& str) {
-    int c = 0; // Counter for special characters: '(', ')', and '.'
+// Reads a column letter inside the block
+int FormulaParser::readColumn(const string& str, int col, int lastCol) {
+    size_t pos = 0;
+    int result = CellAddress::readColumn(str, pos) - 1;
+    if (result < 0 || pos != str.size())
+        throw invalid_argument("Invalid Formula.");
+    if (result < col || result > lastCol)
+        throw out_of_range("Invalid Range.");
+    return result;
+}
 
-    // Check if the function name is one of the supported ones: @SUM, @MIN, @MAX, @AVER, or @STDDEV
-    if(str.substr(0, 4) != "@SUM" && str.substr(0, 4) != "@MIN" && str.substr(0, 4) != "@MAX"
-       && str.substr(0, 5) != "@AVER" && str.substr(0, 7) != "@STDDEV") {
+// Checks that the text is a cell reference inside the sheet
+void FormulaParser::checkReference(const SpreadSheet& table, const string& str) {
+    int row, col;
+    if (!CellAddress::parse(str, row, col))
         throw invalid_argument("Invalid Formula.");
-    }
+    if (row >= table.getNumRows() || col >= table.getNumCols())
+        throw out_of_range("Invalid Range.");
+}
 
-    // Iterate through each character in the formula string
-    for(char ch : str) {
-        // Count the occurrences of special characters: '(', ')', and '.'
-        if(ch == '(' || ch == ')' || ch == '.')
-            c++;
-    }
+// Clears a cell whose formula could not be evaluated
+void FormulaParser::clearCell(Cell* cell, SpreadSheet& table) {
+    table.setContent(cell->getRow()-4, (cell->getCol()-4)/CELL_SIZE,"");
+    if (table.isShown())
+        cout << "\033[" << cell->getRow() << ";" << cell->getCol() << "H" << "       " << std::flush;
+}
 
-    // Check if there are exactly 4 occurrences of the special characters
-    if(c != 4)
-        throw invalid_argument("Invalid Formula.");
+// Registers the formula cell as a dependent of every cell its program reads.
+// Single references get an edge on the cell, ranges (and the blocks of array formulas) get one node for the
+// whole block, and the formula is bound to the sheet names it uses. Returns true if the formula reads itself,
+// directly, through the cells that depend on it or, for an array formula, through the cells of its result.
+bool FormulaParser::addDependencies(FormulaCell* cell, SpreadSheet& table) {
+    int row = cell->getRow() - 4;
+    int col = (cell->getCol() - 4) / CELL_SIZE;
+    int lastRow = row + cell->getProgram().getRows() - 1;
+    int lastCol = col + cell->getProgram().getCols() - 1;
+    bool cyclic = false;
+    int offsetRows, offsetCols;  // A formula of a family reads the cells of the template moved this far
+    cell->getOffset(offsetRows, offsetCols);
+
+    cell->getProgram().forEach([&](const Instruction& in) {
+        if (in.op == OpCode::pushCell || (in.op == OpCode::criterion && in.row >= 0)) {
+            Cell* source = table.getCell(in.row, in.col);
+            if (source == cell || cell->checkCyclicDependency(source))
+                cyclic = true;  // The edge would close a cycle, it is not added
+            else
+                source->addDependents(cell, true);  // Add this cell as a dependent to others (already walked)
+            if (in.row >= row && in.row <= lastRow && in.col >= col && in.col <= lastCol)
+                cyclic = true;  // The cell is part of the result of the formula
+        }
+        else if (in.op == OpCode::aggregate || in.op == OpCode::pushRange || in.op == OpCode::pushArray) {
+            if (in.row <= lastRow && in.lastRow >= row && in.col <= lastCol && in.lastCol >= col)
+                cyclic = true;  // The range contains the formula itself or a cell of its result
+            table.addRangeDependent(cell, in.range);
+        }
+        else if (in.op == OpCode::pushSheetCell) {
+            // The edge is on the cell of the other sheet, which links the two sheets
+            Cell* source = table.getWorkbook()->getSheet((int)in.value).getCell(in.row, in.col);
+            if (cell->checkCyclicDependency(source))
+                cyclic = true;
+            else
+                source->addDependents(cell, true);
+            table.getWorkbook()->link(table.getIndex(), (int)in.value);
+        }
+        else if (in.op == OpCode::sheetAggregate) {
+            table.getWorkbook()->getSheet((int)in.value).addRangeDependent(cell, in.range);
+            table.getWorkbook()->link(table.getIndex(), (int)in.value);
+        }
+    }, offsetRows, offsetCols);
+    for (int name : cell->getProgram().getNames())
+        table.addNameDependent(cell, name);
+    return cyclic;
+}
+
+// This function validates the formula string to ensure it uses a valid function and proper syntax.
 
+void FormulaParser::isValid(const SpreadSheet& table, const string& str) {
+    // Check if the function name is one of the registered functions.
+    // The structure of the call is checked by the formula compiler.
+    string name = "";
+    for (size_t i = 1; i < str.size() && isalpha(str[i]); i++)
+        name += str[i];
+    if (FunctionRegistry::find(name) == nullptr) {
+        throw invalid_argument("Invalid Formula.");
+    }
 }
 
 
@@ -480,59 +415,11 @@ void FormulaParser::isValid(const SpreadSheet& table, const Cell& cell) {
     // Validate the formula:
     // - There must be exactly 4 special characters ('(', ')', '.')
     // - A '-' character must be present
-    // - The total number of alphabetic characters should be 6 or 9
-    if(c != 4 || flag == 0 || c2 < 6 || c2 > 9)
+    // - The total number of alphabetic characters should be 6 to 12 (three references of up to three letters)
+    if(c != 4 || flag == 0 || c2 < 6 || c2 > 12)
     throw invalid_argument("Invalid Formula.");
         
 
 }
 
-
-
-
-// Validate if the formula elements (cell references or numbers) are valid
-void FormulaParser::isValid( SpreadSheet table,const vector<string> &element) {
-    if(element.size() == 0) {
-       throw invalid_argument("Invalid input.");
-    }
-    
-    for(int i = 0; i < element.size(); i++) {
-        int ct = 0;
-        int count = 0;
-        for(char c : element[i]) {  // Count the number of digits in the element
-            if(isdigit(c)|| c=='-') {
-                count++;
-            }
-        }
-        if(count == element[i].size()){}
-        else{
-        
-            if(element[i].size() > 4) 
-               throw invalid_argument("Invalid input.");
-
-            for(char c : element[i]) {  // Check if the element has valid cell reference format
-                if(isalpha(c) && islower(c)) {
-                    throw invalid_argument("Invalid input.");
-                }
-                if(isalpha(c)) {
-                    ct++;
-                }
-            }
-
-            if(ct > 2)  // Cell references can only be 1 or 2 characters long
-                throw invalid_argument("Invalid input.");
-
-            int c = getCols(element[i]);  // Get the column of the cell reference
-            int r = getRows(element[i]);  // Get the row of the cell reference
-
-            if(r > table.getNumRows() || r < 1 || c > table.getNumCols() || c < 1)
-                throw invalid_argument("Invalid input.");
-            
-        }
-    }
-}
-
 }
-
-
-
@@ -17,32 +17,54 @@ class FormulaParser {
    // Takes a reference to a Cell and a SpreadSheet to resolve the formula.
    static void parserFormula(Cell* cell, SpreadSheet& table);
    
-   // Helper function to extract the column number from a string representation of a cell (e.g., "A1" -> 1).
-   static int getCols(const string& str);
-   
-   // Helper function to extract the row number from a string representation of a cell (e.g., "A1" -> 1).
-   static int getRows(const string& str);
+   // Registers a formula cell as a dependent of every cell its compiled program reads.
+   // Returns true if the formula depends on itself.
+   static bool addDependencies(FormulaCell* cell, SpreadSheet& table);
+
+   // Runs the compiled program of a formula cell and stores its value or error value (never throws).
+   static void evaluate(FormulaCell* cell, SpreadSheet& table);
+
+   // Sort command: ^SORT(A..B, K1, -K2, ...) sorts the rows of the block spanned by A and B by the key
+   // columns K1, K2, ... (column letters inside the block, '-' for descending order).
+   // Without keys the block is sorted by its first column. Throws on malformed commands.
+   static void sortCommand(const string& command, SpreadSheet& table);
+
+   // Pivot command: ^PIVOT(A..B, K, V, F, T) groups the rows of the block spanned by A and B by key column K
+   // and writes, from target cell T on, every key with the function F (SUM, COUNT or AVER) of its numbers in
+   // column V. ^PIVOT(A..B, K1, K2, V, F, T) writes a cross table with the keys of K2 across.
+   // The result follows later edits of the block. Throws on malformed commands.
+   static void pivotCommand(const string& command, SpreadSheet& table);
+
+   // Name command: ^NAME(N, A..B) names the block spanned by A and B (or a single cell A), ^NAME(N, X) names
+   // the number X, and ^NAME(N) removes the name. N is a lowercase word; formulas use it in place of the block
+   // or number, and the formulas using it are recompiled when it changes. Throws on malformed commands.
+   static void nameCommand(const string& command, SpreadSheet& table);
+
+   // Runs a '^' command (^SORT, ^PIVOT or ^NAME). Throws on malformed or unknown commands.
+   static void runCommand(const string& command, SpreadSheet& table);
 
  private:
  
-    // Helper function to check if a string represents a valid cell reference.
-    static bool isCell(const string& str);
-    
-    
     // Validates individual elements of a formula, ensuring correct formatting.
     static void isValid(const SpreadSheet& table, const string& str); 
     
     static void isValid(const SpreadSheet& table ,const Cell& cell);  
 
-    static void isValid(SpreadSheet table,const vector<string> &element);
+    // Checks that the text is a cell reference (letters followed by digits) inside the sheet.
+    static void checkReference(const SpreadSheet& table, const string& str);
 
-    // Helper function to apply mathematical operations like +, -, *, / to two operands.
-    static double applyOp(double a, double b, char op);
-    
-    // Converts all formula elements (cell references and constants) to double values.
-    static void convertToDouble(SpreadSheet& table, const vector<string> &element, vector<double> &numbers);
+    // Splits the arguments of a command at the commas, dropping blanks. 'open' is the length of "^NAME(".
+    static vector<string> commandArguments(const string& command, size_t open);
+
+    // Reads a block given by two opposite corners (A..B) into zero based corners.
+    static void readBlock(const SpreadSheet& table, const string& str, int& row, int& col, int& lastRow, int& lastCol);
+
+    // Reads a column letter of a command and checks that it lies in col..lastCol; returns it zero based.
+    static int readColumn(const string& str, int col, int lastCol);
+
+    // Clears a cell whose formula could not be compiled or evaluated.
+    static void clearCell(Cell* cell, SpreadSheet& table);
 
-  
 };
 
 }
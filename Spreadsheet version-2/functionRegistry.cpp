@@ -0,0 +1,408 @@
+#include "functionRegistry.h"
+#include "spreadSheet.h"
+#include <cmath>
+#include <algorithm>
+
+using namespace spreadsheet;
+
+namespace utils {
+
+// Result readers of the range functions
+static double sumOf(const AggregateState& state) { return state.getSum(); }
+static double meanOf(const AggregateState& state) { return state.getMean(); }
+static double maxOf(const AggregateState& state) { return state.getMax(); }
+static double minOf(const AggregateState& state) { return state.getMin(); }
+static double deviationOf(const AggregateState& state) { return sqrt(state.getVariance()); }
+static double countOf(const AggregateState& state) { return state.getCount(); }
+
+// Cell written as the key of a lookup, so a text key can be matched; nullptr if the key is computed
+static const Cell* keyCell(SpreadSheet& table, const Instruction& in) {
+    return in.row >= 0 ? table.getCell(in.row, in.col) : nullptr;
+}
+
+// Reads the cell found by a lookup, passing its error value on
+static double resultOf(SpreadSheet& table, int row, int col, ErrorCode& error) {
+    const Cell* cell = table.getCell(row, col);
+    error = cell->getError();
+    return cell->getNumber();
+}
+
+// Match type argument of MATCH / VLOOKUP: 1 largest not above the key, 0 exact, -1 smallest not below
+static MatchMode modeOf(double type) {
+    return type > 0 ? MatchMode::atMost : (type < 0 ? MatchMode::atLeast : MatchMode::exact);
+}
+
+// MATCH(key, X..Y[, type]): position of the key in the first column of the range.
+// The type defaults to 1 (approximate) as in Excel.
+static double matchOf(SpreadSheet& table, const Instruction& in, const double* args, int count, const Criterion* criteria, ErrorCode& error) {
+    const RangeNode& range = table.getRange((int)args[1]);
+    MatchMode mode = count > 2 ? modeOf(args[2]) : MatchMode::atMost;
+    int row = table.findRow(range.col, range.row, range.lastRow, keyCell(table, in), args[0], mode);
+    if (row < 0) {
+        error = ErrorCode::notAvailable;
+        return 0;
+    }
+    return row - range.row + 1;
+}
+
+// VLOOKUP(key, X..Y, column[, approximate]): value in the given column of the row whose first cell holds the key.
+// The match is approximate unless the last argument is 0, as in Excel.
+static double vlookupOf(SpreadSheet& table, const Instruction& in, const double* args, int count, const Criterion* criteria, ErrorCode& error) {
+    const RangeNode& range = table.getRange((int)args[1]);
+    int column = (int)args[2];
+    if (column < 1 || column > range.lastCol - range.col + 1) {
+        error = ErrorCode::ref;
+        return 0;
+    }
+    MatchMode mode = (count > 3 && args[3] == 0) ? MatchMode::exact : MatchMode::atMost;
+    int row = table.findRow(range.col, range.row, range.lastRow, keyCell(table, in), args[0], mode);
+    if (row < 0) {
+        error = ErrorCode::notAvailable;
+        return 0;
+    }
+    return resultOf(table, row, range.col + column - 1, error);
+}
+
+// XLOOKUP(key, X..Y, Z..W): value of the return range at the position of the key in the lookup range (exact match)
+static double xlookupOf(SpreadSheet& table, const Instruction& in, const double* args, int count, const Criterion* criteria, ErrorCode& error) {
+    const RangeNode& keys = table.getRange((int)args[1]);
+    const RangeNode& values = table.getRange((int)args[2]);
+    int row = table.findRow(keys.col, keys.row, keys.lastRow, keyCell(table, in), args[0], MatchMode::exact);
+    if (row < 0) {
+        error = ErrorCode::notAvailable;
+        return 0;
+    }
+    if (row - keys.row > values.lastRow - values.row) {
+        error = ErrorCode::ref;
+        return 0;
+    }
+    return resultOf(table, values.row + row - keys.row, values.col, error);
+}
+
+// How a conditional function reduces the selected cells
+enum class Reduction { sum, count, average };
+
+// Selects the rows of the criteria ranges that meet every criterion with the predicate kernels, one column of
+// the block at a time, then reduces the value range over the selection (masked sum, count of set bytes).
+// 'conditions' gives the argument positions of the first (criteria range, criterion) pair and of the pairs
+// after it; 'values' is the argument position of the value range, -1 to use the first criteria range.
+// The value range is read from its top left cell with the shape of the criteria ranges, as in Excel.
+static double reduceIf(SpreadSheet& table, const double* args, int count, const Criterion* criteria,
+                       int values, int conditions, Reduction reduction, ErrorCode& error) {
+    const ColumnStore& store = table.getStore();
+    const RangeNode& shape = table.getRange((int)args[conditions]);
+    int rows = shape.lastRow - shape.row + 1, cols = shape.lastCol - shape.col + 1;
+    if ((count - conditions) % 2 != 0) {
+        error = ErrorCode::value; // A criteria range without its criterion
+        return 0;
+    }
+    for (int i = conditions; i + 1 < count; i += 2) {
+        const RangeNode& range = table.getRange((int)args[i]);
+        if (range.lastRow - range.row + 1 != rows || range.lastCol - range.col + 1 != cols) {
+            error = ErrorCode::value;
+            return 0;
+        }
+    }
+    if (values >= 0 && values < conditions) {
+        // The value range of the multi-criteria forms must have the shape of the criteria ranges too;
+        // the single criterion forms take their value range from its top left cell, like Excel
+        const RangeNode& range = table.getRange((int)args[values]);
+        if (range.lastRow - range.row + 1 != rows || range.lastCol - range.col + 1 != cols) {
+            error = ErrorCode::value;
+            return 0;
+        }
+    }
+
+    const RangeNode& target = table.getRange((int)args[values >= 0 ? values : conditions]);
+    if (target.row + rows > table.getNumRows() || target.col + cols > table.getNumCols()) {
+        error = ErrorCode::ref;
+        return 0;
+    }
+
+    vector<unsigned char> selected(rows);
+    double sum = 0;
+    long long matched = 0;
+    for (int j = 0; j < cols; j++) {
+        fill(selected.begin(), selected.end(), 1);
+        for (int i = conditions; i + 1 < count; i += 2) {
+            const RangeNode& range = table.getRange((int)args[i]);
+            Criteria::select(store, range.col + j, range.row, rows, criteria[(int)args[i + 1]], selected.data());
+        }
+        if (reduction == Reduction::count) {
+            matched += RangeKernels::count(selected.data(), rows);
+            continue;
+        }
+
+        // Only numbers are summed and counted; an error value among the selected cells is passed on
+        int col = target.col + j;
+        if (store.firstError(target.row, col, target.row + rows - 1, col) != ErrorCode::none) {
+            for (int r = 0; r < rows && error == ErrorCode::none; r++)
+                if (selected[r])
+                    error = store.firstError(target.row + r, col, target.row + r, col);
+            if (error != ErrorCode::none)
+                return 0;
+        }
+        const unsigned char* mask = store.mask(col, target.row);
+        for (int r = 0; r < rows; r++)
+            selected[r] &= mask[r];
+        sum += RangeKernels::maskedSum(store.values(col, target.row), selected.data(), rows);
+        matched += RangeKernels::count(selected.data(), rows);
+    }
+
+    if (reduction == Reduction::sum)
+        return sum;
+    if (reduction == Reduction::count)
+        return matched;
+    if (matched == 0) {
+        error = ErrorCode::divZero;
+        return 0;
+    }
+    return sum / matched;
+}
+
+// SUMIF(X..Y, criterion[, Z..W]): sum of the cells of Z..W (X..Y if omitted) whose row meets the criterion
+static double sumIfOf(SpreadSheet& table, const Instruction& in, const double* args, int count, const Criterion* criteria, ErrorCode& error) {
+    return reduceIf(table, args, 2, criteria, count > 2 ? 2 : -1, 0, Reduction::sum, error);
+}
+
+// COUNTIF(X..Y, criterion): number of cells of X..Y that meet the criterion
+static double countIfOf(SpreadSheet& table, const Instruction& in, const double* args, int count, const Criterion* criteria, ErrorCode& error) {
+    return reduceIf(table, args, count, criteria, -1, 0, Reduction::count, error);
+}
+
+// AVERIF(X..Y, criterion[, Z..W]): mean of the cells of Z..W (X..Y if omitted) whose row meets the criterion
+static double averageIfOf(SpreadSheet& table, const Instruction& in, const double* args, int count, const Criterion* criteria, ErrorCode& error) {
+    return reduceIf(table, args, 2, criteria, count > 2 ? 2 : -1, 0, Reduction::average, error);
+}
+
+// SUMIFS(Z..W, X1..Y1, criterion1, ...): sum of the cells of Z..W whose row meets every criterion
+static double sumIfsOf(SpreadSheet& table, const Instruction& in, const double* args, int count, const Criterion* criteria, ErrorCode& error) {
+    return reduceIf(table, args, count, criteria, 0, 1, Reduction::sum, error);
+}
+
+// COUNTIFS(X1..Y1, criterion1, ...): number of rows that meet every criterion
+static double countIfsOf(SpreadSheet& table, const Instruction& in, const double* args, int count, const Criterion* criteria, ErrorCode& error) {
+    return reduceIf(table, args, count, criteria, -1, 0, Reduction::count, error);
+}
+
+// AVERIFS(Z..W, X1..Y1, criterion1, ...): mean of the cells of Z..W whose row meets every criterion
+static double averageIfsOf(SpreadSheet& table, const Instruction& in, const double* args, int count, const Criterion* criteria, ErrorCode& error) {
+    return reduceIf(table, args, count, criteria, 0, 1, Reduction::average, error);
+}
+
+// Numbers of the range being read by an order statistic, reused by every evaluation so that gathering a block
+// does not allocate once the buffer has grown to the largest block (one buffer per thread, since the sheets
+// of a workbook recalculate concurrently)
+static thread_local vector<double> scratch;
+
+// Numbers of a range for an order statistic. Sets 'order' to the order index of the range if it has one;
+// otherwise the numbers are gathered, unordered, at the start of the scratch buffer. Returns how many there are,
+// or sets 'error' to the first error value of the range.
+static int numbersOf(SpreadSheet& table, int range, const OrderIndex*& order, ErrorCode& error) {
+    error = table.getRangeError(range);
+    if (error != ErrorCode::none)
+        return 0;
+    order = table.getRangeOrder(range);
+    if (order != nullptr)
+        return order->size();
+
+    const RangeNode& node = table.getRange(range);
+    const ColumnStore& store = table.getStore();
+    int rows = node.lastRow - node.row + 1;
+    size_t cells = (size_t)rows * (node.lastCol - node.col + 1);
+    if (scratch.size() < cells)
+        scratch.resize(cells);
+    int count = 0;
+    for (int c = node.col; c <= node.lastCol; c++)
+        count += RangeKernels::gather(store.values(c, node.row), store.mask(c, node.row), rows, scratch.data() + count);
+    return count;
+}
+
+// k-th smallest of the n numbers (k zero based): O(log n) from the order index, O(n) by selection otherwise.
+// Selection leaves every number after position k at least as large as the result.
+static double smallestOf(const OrderIndex* order, int n, int k) {
+    if (order != nullptr)
+        return order->select(k);
+    nth_element(scratch.begin(), scratch.begin() + k, scratch.begin() + n);
+    return scratch[k];
+}
+
+// Percentile p (0..1) of the n numbers, interpolating between the two closest ranks as Excel's PERCENTILE does.
+// Without an index the upper rank is the smallest number after the selected one, so one selection is enough.
+static double percentileOf(const OrderIndex* order, int n, double p, ErrorCode& error) {
+    if (n == 0 || !(p >= 0 && p <= 1)) {
+        error = ErrorCode::num;
+        return 0;
+    }
+    double position = (n - 1) * p;
+    int k = (int)position;
+    double low = smallestOf(order, n, k);
+    if (k + 1 >= n || position == k)
+        return low;
+    double high = order != nullptr ? order->select(k + 1)
+                                   : *min_element(scratch.begin() + k + 1, scratch.begin() + n);
+    return low + (position - k) * (high - low);
+}
+
+// MEDIAN(X..Y): middle number of the range, the mean of the two middle ones for an even count
+static double medianOf(SpreadSheet& table, const Instruction& in, const double* args, int count, const Criterion* criteria, ErrorCode& error) {
+    const OrderIndex* order = nullptr;
+    int n = numbersOf(table, (int)args[0], order, error);
+    if (error != ErrorCode::none)
+        return 0;
+    return percentileOf(order, n, 0.5, error);
+}
+
+// PERCENTILE(X..Y, p): value below which the fraction p of the numbers of the range lies (#NUM! unless 0 <= p <= 1)
+static double percentileFunctionOf(SpreadSheet& table, const Instruction& in, const double* args, int count, const Criterion* criteria, ErrorCode& error) {
+    const OrderIndex* order = nullptr;
+    int n = numbersOf(table, (int)args[0], order, error);
+    if (error != ErrorCode::none)
+        return 0;
+    return percentileOf(order, n, args[1], error);
+}
+
+// QUARTILE(X..Y, q): minimum, first quartile, median, third quartile or maximum for q = 0..4 (q is truncated)
+static double quartileOf(SpreadSheet& table, const Instruction& in, const double* args, int count, const Criterion* criteria, ErrorCode& error) {
+    const OrderIndex* order = nullptr;
+    int n = numbersOf(table, (int)args[0], order, error);
+    if (error != ErrorCode::none)
+        return 0;
+    double quart = trunc(args[1]);
+    if (!(quart >= 0 && quart <= 4)) {
+        error = ErrorCode::num;
+        return 0;
+    }
+    return percentileOf(order, n, quart / 4, error);
+}
+
+// Position k (1 = first) of a k-th largest / k-th smallest query, rounded up as Excel does; -1 if out of 1..n
+static int positionOf(double k, int n) {
+    double position = ceil(k);
+    return (position >= 1 && position <= n) ? (int)position : -1;
+}
+
+// LARGE(X..Y, k): k-th largest number of the range
+static double largeOf(SpreadSheet& table, const Instruction& in, const double* args, int count, const Criterion* criteria, ErrorCode& error) {
+    const OrderIndex* order = nullptr;
+    int n = numbersOf(table, (int)args[0], order, error);
+    if (error != ErrorCode::none)
+        return 0;
+    int k = positionOf(args[1], n);
+    if (k < 0) {
+        error = ErrorCode::num;
+        return 0;
+    }
+    return smallestOf(order, n, n - k);
+}
+
+// SMALL(X..Y, k): k-th smallest number of the range
+static double smallOf(SpreadSheet& table, const Instruction& in, const double* args, int count, const Criterion* criteria, ErrorCode& error) {
+    const OrderIndex* order = nullptr;
+    int n = numbersOf(table, (int)args[0], order, error);
+    if (error != ErrorCode::none)
+        return 0;
+    int k = positionOf(args[1], n);
+    if (k < 0) {
+        error = ErrorCode::num;
+        return 0;
+    }
+    return smallestOf(order, n, k - 1);
+}
+
+// RANK(x, X..Y[, order]): position of x among the numbers of the range, largest first unless the order is
+// non zero. Equal numbers share the best position; #N/A if x is not in the range.
+// Counting needs no selection: one pass over the gathered numbers, or two O(log n) descents of the index.
+static double rankOf(SpreadSheet& table, const Instruction& in, const double* args, int count, const Criterion* criteria, ErrorCode& error) {
+    const OrderIndex* order = nullptr;
+    int n = numbersOf(table, (int)args[1], order, error);
+    if (error != ErrorCode::none)
+        return 0;
+    double x = args[0];
+    int less = 0, equal = 0;
+    if (order != nullptr) {
+        less = order->countLess(x);
+        equal = order->countLessOrEqual(x) - less;
+    }
+    else {
+        for (int i = 0; i < n; i++) {
+            less += scratch[i] < x;
+            equal += scratch[i] == x;
+        }
+    }
+    if (equal == 0) {
+        error = ErrorCode::notAvailable;
+        return 0;
+    }
+    bool ascending = count > 2 && args[2] != 0;
+    return ascending ? less + 1 : n - less - equal + 1;
+}
+
+// Argument masks of the conditional functions: ranges and criteria alternate after the optional value range
+static const unsigned int PAIRS = 0x55555555;      // Ranges at 0, 2, 4, ...; criteria at 1, 3, 5, ...
+static const unsigned int VALUE_PAIRS = 0xAAAAAAAB; // Ranges at 0, 1, 3, 5, ...; criteria at 2, 4, 6, ...
+
+// The functions, in the order of the Function enum
+static const vector<FunctionInfo> functions = {
+    {Function::sum,      "SUM",      "SUM",        FunctionKind::aggregate,   1, 1,  1, 0, true,  sumOf,       nullptr},
+    {Function::aver,     "AVER",     "AVERAGE",    FunctionKind::aggregate,   1, 1,  1, 0, true,  meanOf,      nullptr},
+    {Function::max,      "MAX",      "MAX",        FunctionKind::aggregate,   1, 1,  1, 0, false, maxOf,       nullptr},
+    {Function::min,      "MIN",      "MIN",        FunctionKind::aggregate,   1, 1,  1, 0, false, minOf,       nullptr},
+    {Function::stddev,   "STDDEV",   "STDEV",      FunctionKind::aggregate,   1, 1,  1, 0, true,  deviationOf, nullptr},
+    {Function::count,    "COUNT",    "COUNT",      FunctionKind::aggregate,   1, 1,  1, 0, true,  countOf,     nullptr},
+    {Function::match,    "MATCH",    "MATCH",      FunctionKind::lookup,      2, 3,  2, 0, true,  nullptr,     matchOf},
+    {Function::vlookup,  "VLOOKUP",  "VLOOKUP",    FunctionKind::lookup,      3, 4,  2, 0, true,  nullptr,     vlookupOf},
+    {Function::xlookup,  "XLOOKUP",  "XLOOKUP",    FunctionKind::lookup,      3, 3,  6, 0, true,  nullptr,     xlookupOf},
+    {Function::sumif,    "SUMIF",    "SUMIF",      FunctionKind::conditional, 2, 3,  5, 2, true,  nullptr,     sumIfOf},
+    {Function::countif,  "COUNTIF",  "COUNTIF",    FunctionKind::conditional, 2, 2,  1, 2, true,  nullptr,     countIfOf},
+    {Function::averif,   "AVERIF",   "AVERAGEIF",  FunctionKind::conditional, 2, 3,  5, 2, true,  nullptr,     averageIfOf},
+    {Function::sumifs,   "SUMIFS",   "SUMIFS",     FunctionKind::conditional, 3, 17, VALUE_PAIRS, ~VALUE_PAIRS, true, nullptr, sumIfsOf},
+    {Function::countifs, "COUNTIFS", "COUNTIFS",   FunctionKind::conditional, 2, 16, PAIRS, ~PAIRS, true, nullptr, countIfsOf},
+    {Function::averifs,  "AVERIFS",  "AVERAGEIFS", FunctionKind::conditional, 3, 17, VALUE_PAIRS, ~VALUE_PAIRS, true, nullptr, averageIfsOf},
+    {Function::mmult,    "MMULT",    "MMULT",      FunctionKind::matrix,      2, 2,  0, 0, true,  nullptr,     nullptr},
+    {Function::transpose, "TRANSPOSE", "TRANSPOSE", FunctionKind::matrix,    1, 1,  0, 0, true,  nullptr,     nullptr},
+    {Function::minverse, "MINVERSE", "MINVERSE",   FunctionKind::matrix,      1, 1,  0, 0, true,  nullptr,     nullptr},
+    {Function::median,   "MEDIAN",   "MEDIAN",     FunctionKind::order,       1, 1,  1, 0, true,  nullptr,     medianOf},
+    {Function::percentile, "PERCENTILE", "PERCENTILE", FunctionKind::order,  2, 2,  1, 0, true,  nullptr,     percentileFunctionOf},
+    {Function::quartile, "QUARTILE", "QUARTILE",   FunctionKind::order,       2, 2,  1, 0, true,  nullptr,     quartileOf},
+    {Function::rank,     "RANK",     "RANK",       FunctionKind::order,       2, 3,  2, 0, true,  nullptr,     rankOf},
+    {Function::large,    "LARGE",    "LARGE",      FunctionKind::order,       2, 2,  1, 0, true,  nullptr,     largeOf},
+    {Function::small,    "SMALL",    "SMALL",      FunctionKind::order,       2, 2,  1, 0, true,  nullptr,     smallOf},
+    {Function::msum,     "MSUM",     "SUM",        FunctionKind::window,      1, 1,  1, 0, true,  sumOf,       nullptr},
+    {Function::mavg,     "MAVG",     "AVERAGE",    FunctionKind::window,      1, 1,  1, 0, true,  meanOf,      nullptr},
+    {Function::mmin,     "MMIN",     "MIN",        FunctionKind::window,      1, 1,  1, 0, false, minOf,       nullptr},
+    {Function::mmax,     "MMAX",     "MAX",        FunctionKind::window,      1, 1,  1, 0, false, maxOf,       nullptr},
+    {Function::mstddev,  "MSTDDEV",  "STDEV",      FunctionKind::window,      1, 1,  1, 0, true,  deviationOf, nullptr},
+    {Function::ifThen,   "IF",       "IF",         FunctionKind::branch,      2, 3,  0, 0, true,  nullptr,     nullptr},
+    {Function::ifs,      "IFS",      "IFS",        FunctionKind::branch,      2, 32, 0, 0, true,  nullptr,     nullptr},
+    {Function::choose,   "CHOOSE",   "CHOOSE",     FunctionKind::branch,      2, 31, 0, 0, true,  nullptr,     nullptr},
+    {Function::let,      "LET",      "LET",        FunctionKind::binding,     3, 33, 0, 0, true,  nullptr,     nullptr},
+};
+
+// Returns the function with the given formula name
+const FunctionInfo* FunctionRegistry::find(const string& name) {
+    for (const FunctionInfo& info : functions)
+        if (name == info.name)
+            return &info;
+    return nullptr;
+}
+
+// Returns the function with the given Excel name
+const FunctionInfo* FunctionRegistry::findExcel(const string& excelName) {
+    for (const FunctionInfo& info : functions)
+        if (excelName == info.excelName)
+            return &info;
+    return nullptr;
+}
+
+// Returns the function with the given id
+const FunctionInfo& FunctionRegistry::get(Function id) {
+    return functions[(int)id];
+}
+
+// Returns every registered function
+const vector<FunctionInfo>& FunctionRegistry::all() {
+    return functions;
+}
+
+}
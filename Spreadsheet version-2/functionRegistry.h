@@ -0,0 +1,69 @@
+#ifndef FUNCTION_REGISTRY_H
+#define FUNCTION_REGISTRY_H
+
+#include <string>
+#include <vector>
+#include "formulaCompiler.h"
+#include "aggregateState.h"
+
+using namespace std;
+
+namespace utils {
+
+// How a function is compiled and evaluated
+enum class FunctionKind : unsigned char {
+    aggregate,  // @NAME(X..Y): a statistic of one range, read from the statistics the sheet caches for it
+    lookup,     // @NAME(key, X..Y, ...): finds a key in a range through the lookup indexes of the sheet
+    conditional, // @NAME(X..Y, criterion, ...): reduces the cells whose rows meet every criterion
+    matrix,     // @NAME(A, ...): computes a whole matrix from blocks or array expressions (see MatrixKernels)
+    order,      // @NAME(X..Y, ...): an order statistic of the numbers of a range, by selection or from an OrderIndex
+    window,     // @NAME(X..Y): an aggregate whose copies filled down a column are computed in one sliding pass
+    branch,     // @NAME(condition, a, ...): evaluates only the argument its condition or index selects
+    binding     // @NAME(name, value, ..., result): names values for its last argument (LET)
+};
+
+// Declaration of a built-in function. Every function is declared once, in the table of functionRegistry.cpp;
+// the compiler, the evaluator and the file converters all read this table.
+struct FunctionInfo {
+    Function id;             // Resolved id stored in compiled programs
+    const char* name;        // Name used in formulas (@NAME)
+    const char* excelName;   // Name used when exporting to Excel
+    FunctionKind kind;       // Aggregate of one range, or a function with several arguments
+    int minArgs, maxArgs;    // Number of arguments (aggregates take exactly one range)
+    unsigned int rangeArguments;     // Bit i is set if argument i is a range (X..Y)
+    unsigned int criterionArguments; // Bit i is set if argument i is a criterion (5, "<>apple", or a cell holding one)
+    bool invertible;         // The result can be kept up to date by removing old values (false for MIN / MAX)
+
+    // Aggregates: reads the result from the statistics of the range, which the vectorized kernels compute in one pass
+    double (*apply)(const AggregateState& state);
+
+    // Other functions: computes the result from the evaluated arguments. Ranges arrive as range node ids and
+    // criteria as slots of 'criteria'; 'in' is the call instruction, which names the key cell of a lookup when
+    // the key is a single reference. Sets 'error' (like #N/A when a key is missing) instead of throwing.
+    // Matrix functions have neither: array programs compute them with the matrix kernels.
+    // Branching functions have neither too: they compile to jumps (see FormulaCompiler::emitBranches),
+    // and LET compiles to its last argument.
+    double (*evaluate)(spreadsheet::SpreadSheet& table, const Instruction& in, const double* args, int count,
+                       const Criterion* criteria, ErrorCode& error);
+};
+
+// Lookup of the built-in functions. Names are resolved to an id when a formula is compiled,
+// so evaluation dispatches by indexing the table and never compares strings.
+class FunctionRegistry {
+public:
+    // Returns the function with the given formula name, nullptr if there is none
+    static const FunctionInfo* find(const string& name);
+
+    // Returns the function with the given Excel name, nullptr if there is none
+    static const FunctionInfo* findExcel(const string& excelName);
+
+    // Returns the function with the given id
+    static const FunctionInfo& get(Function id);
+
+    // Returns every registered function, ordered by id
+    static const vector<FunctionInfo>& all();
+};
+
+}
+
+#endif
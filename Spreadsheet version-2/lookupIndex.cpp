@@ -0,0 +1,149 @@
+#include "lookupIndex.h"
+#include <algorithm>
+#include <climits>
+
+namespace spreadsheet {
+
+// Creates an empty index for every column
+LookupIndex::LookupIndex(int rows, int cols) : rows(rows), columns(cols) {}
+
+// Exact numeric match through the hash of the column, built from the column store on first use
+int LookupIndex::findNumber(const ColumnStore& store, int col, int row, int lastRow, double key) {
+    ColumnLookup& column = columns[col];
+    if (!column.numbersBuilt) {
+        const double* values = store.values(col, 0);
+        const unsigned char* mask = store.mask(col, 0);
+        for (int r = 0; r < rows; r++)
+            if (mask[r])
+                column.numbers[values[r]].push_back(r); // Rows come in order, the lists stay sorted
+        column.numbersBuilt = true;
+    }
+
+    auto found = column.numbers.find(key);
+    return found == column.numbers.end() ? -1 : firstInside(found->second, row, lastRow);
+}
+
+// Exact text match through the hash of the column
+int LookupIndex::findText(int col, int row, int lastRow, const string& key) const {
+    const ColumnLookup& column = columns[col];
+    auto found = column.texts.find(key);
+    return found == column.texts.end() ? -1 : firstInside(found->second, row, lastRow);
+}
+
+// Builds the text hash of the column
+void LookupIndex::buildText(int col, const vector<string>& texts) {
+    ColumnLookup& column = columns[col];
+    column.rowTexts = texts;
+    for (int r = 0; r < rows; r++)
+        if (!texts[r].empty())
+            column.texts[texts[r]].push_back(r);
+    column.textsBuilt = true;
+}
+
+// Approximate match through the sorted numbers of the column. A binary search finds the closest number;
+// when the range covers only part of the column, the search walks on to the closest number inside it.
+int LookupIndex::findSorted(const ColumnStore& store, int col, int row, int lastRow, double key, MatchMode mode) {
+    ColumnLookup& column = columns[col];
+    if (!column.sortedBuilt) {
+        const double* values = store.values(col, 0);
+        const unsigned char* mask = store.mask(col, 0);
+        for (int r = 0; r < rows; r++)
+            if (mask[r])
+                column.sorted.push_back({values[r], r});
+        sort(column.sorted.begin(), column.sorted.end());
+        column.sortedBuilt = true;
+    }
+
+    const vector<pair<double, int>>& sorted = column.sorted;
+    if (mode == MatchMode::atMost) {
+        auto it = upper_bound(sorted.begin(), sorted.end(), make_pair(key, INT_MAX));
+        while (it != sorted.begin()) {
+            --it;
+            if (it->second >= row && it->second <= lastRow)
+                return it->second;
+        }
+    }
+    else {
+        for (auto it = lower_bound(sorted.begin(), sorted.end(), make_pair(key, INT_MIN)); it != sorted.end(); ++it)
+            if (it->second >= row && it->second <= lastRow)
+                return it->second;
+    }
+    return -1;
+}
+
+// Returns true if the column has a built text index
+bool LookupIndex::hasText(int col) const {
+    return columns[col].textsBuilt;
+}
+
+// Moves the row from its old keys to its new ones in every index the column has
+void LookupIndex::update(int row, int col, double oldValue, bool wasNumber, double newValue, bool isNumber, const string* text) {
+    ColumnLookup& column = columns[col];
+
+    if (column.numbersBuilt) {
+        if (wasNumber) {
+            auto found = column.numbers.find(oldValue);
+            if (found != column.numbers.end()) {
+                eraseRow(found->second, row);
+                if (found->second.empty())
+                    column.numbers.erase(found);
+            }
+        }
+        if (isNumber)
+            insertRow(column.numbers[newValue], row);
+    }
+
+    if (column.sortedBuilt) {
+        vector<pair<double, int>>& sorted = column.sorted;
+        if (wasNumber) {
+            auto it = lower_bound(sorted.begin(), sorted.end(), make_pair(oldValue, row));
+            if (it != sorted.end() && *it == make_pair(oldValue, row))
+                sorted.erase(it);
+        }
+        if (isNumber)
+            sorted.insert(upper_bound(sorted.begin(), sorted.end(), make_pair(newValue, row)), {newValue, row});
+    }
+
+    if (column.textsBuilt) {
+        string& old = column.rowTexts[row];
+        if (!old.empty()) {
+            auto found = column.texts.find(old);
+            if (found != column.texts.end()) {
+                eraseRow(found->second, row);
+                if (found->second.empty())
+                    column.texts.erase(found);
+            }
+        }
+        old = text != nullptr ? *text : "";
+        if (!old.empty())
+            insertRow(column.texts[old], row);
+    }
+}
+
+// Drops every index
+void LookupIndex::clear() {
+    for (ColumnLookup& column : columns)
+        column = ColumnLookup();
+}
+
+// Returns the first row of the ascending list inside row..lastRow
+int LookupIndex::firstInside(const vector<int>& list, int row, int lastRow) {
+    auto it = lower_bound(list.begin(), list.end(), row);
+    return (it != list.end() && *it <= lastRow) ? *it : -1;
+}
+
+// Inserts a row in an ascending row list
+void LookupIndex::insertRow(vector<int>& list, int row) {
+    auto it = lower_bound(list.begin(), list.end(), row);
+    if (it == list.end() || *it != row)
+        list.insert(it, row);
+}
+
+// Removes a row from an ascending row list
+void LookupIndex::eraseRow(vector<int>& list, int row) {
+    auto it = lower_bound(list.begin(), list.end(), row);
+    if (it != list.end() && *it == row)
+        list.erase(it);
+}
+
+}
@@ -0,0 +1,82 @@
+#ifndef LOOKUP_INDEX_H
+#define LOOKUP_INDEX_H
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <unordered_map>
+#include "columnStore.h"
+
+using namespace std;
+
+namespace spreadsheet {
+
+// How a lookup compares the key with the entries of a column
+enum class MatchMode : int {
+    atLeast = -1, // Smallest number not below the key
+    exact = 0,    // Equal number or text
+    atMost = 1    // Largest number not above the key
+};
+
+// Indexes that answer the lookup functions (MATCH, VLOOKUP, XLOOKUP) without scanning the column.
+// Every column has up to three indexes, each built the first time a lookup needs it:
+// a hash of numeric keys, a hash of text keys, and the numbers sorted by value for approximate matches.
+// Once built, an index is kept up to date on every edit of its column instead of being rebuilt,
+// so a lookup costs O(1) (hash) or O(log n) (sorted) however often the column changes.
+class LookupIndex {
+public:
+    // Creates an index for a sheet with the given number of rows and columns; nothing is built yet
+    LookupIndex(int rows, int cols);
+
+    // Finds the first row in row..lastRow of the column whose number equals the key, -1 if there is none
+    int findNumber(const ColumnStore& store, int col, int row, int lastRow, double key);
+
+    // Finds the first row in row..lastRow of the column whose text equals the key, -1 if there is none.
+    // The text index of the column must have been built with buildText.
+    int findText(int col, int row, int lastRow, const string& key) const;
+
+    // Builds the text index of the column from the text of every row ("" for rows without text)
+    void buildText(int col, const vector<string>& texts);
+
+    // Finds the row in row..lastRow of the column holding the largest number not above the key (MatchMode::atMost)
+    // or the smallest number not below it (MatchMode::atLeast), -1 if there is none.
+    // Among equal numbers the last row wins for atMost and the first row for atLeast.
+    int findSorted(const ColumnStore& store, int col, int row, int lastRow, double key, MatchMode mode);
+
+    // Returns true if the column has a built text index (the sheet only collects texts for those)
+    bool hasText(int col) const;
+
+    // Keeps the built indexes of the column up to date when the entry of a row changes.
+    // 'text' is the new text of the row, or nullptr if the cell does not hold text.
+    // Does nothing for columns no lookup has read.
+    void update(int row, int col, double oldValue, bool wasNumber, double newValue, bool isNumber, const string* text);
+
+    // Drops every index (they are rebuilt by the next lookups)
+    void clear();
+
+private:
+    // The indexes of one column. Row lists are kept in ascending order.
+    struct ColumnLookup {
+        bool numbersBuilt = false;
+        bool textsBuilt = false;
+        bool sortedBuilt = false;
+        unordered_map<double, vector<int>> numbers; // Numeric key -> rows holding it
+        unordered_map<string, vector<int>> texts;   // Text key -> rows holding it
+        vector<string> rowTexts;                    // Indexed text of every row ("" if none), to find it on removal
+        vector<pair<double, int>> sorted;           // (number, row) of every numeric row, ordered
+    };
+
+    // Returns the first row of the list inside row..lastRow, -1 if there is none
+    static int firstInside(const vector<int>& list, int row, int lastRow);
+
+    // Inserts / removes a row in an ascending row list
+    static void insertRow(vector<int>& list, int row);
+    static void eraseRow(vector<int>& list, int row);
+
+    int rows;                     // Number of rows of the sheet
+    vector<ColumnLookup> columns; // Indexes of every column
+};
+
+}
+
+#endif
@@ -3,7 +3,9 @@
 #include "spreadSheet.h"
 #include "formulaParser.h"
 #include "fileManager.h"
+#include "workbook.h"
 #include "cell.h"
+#include "cellAddress.h"
 #include "container.h"
 #include <iostream>
 #include <string>
@@ -26,7 +28,8 @@ int main() {
     
     int X=100;
     int Y=100;
-    SpreadSheet table(X,Y); // Initialize a spreadsheet 
+    Workbook book(X,Y); // Initialize a workbook with one spreadsheet; &SHEET adds and shows others
+    book.addSheet("Sheet1");
 
     string empty(CELL_SIZE,' ');
     int row = 4, col = 4; // Set initial cursor position to row 4, column 4
@@ -40,6 +43,7 @@ int main() {
     
     while (true) { // Infinite loop to keep processing input until the user quits
         checkIfNormal=1;
+        SpreadSheet& table = book.getActive(); // The sheet shown to the user
         // Display information about the selected cell
 
         table.infoCell(row - firstR, col / CELL_SIZE, firstR); 
@@ -102,38 +106,26 @@ int main() {
                         // Jump to a specific cell based on a user-input reference
                         string newP = ">";
                         string temp;
-                        int r, c,count=0,check=0,count2=0;
+                        int r, c;
                         // Handle user input for cell reference
                         handleInput(newP, row, col, firstR, table, terminal, 3); 
 
-                        // error checking
-                        for(char c: newP){
-                            if(isalpha(c))
-                                count++;
-                            if(islower(c))
-                                check=1;
-                            if(isdigit(c))
-                                count2++;
-                        }
-
                         try{
 
-                            if(count<=2 && check==0 && count2!=0){
-                                temp = newP.substr(1); // Remove the '>' symbol for processing
+                            temp = newP.substr(1); // Remove the '>' symbol for processing
+
+                            // error checking: letters followed by digits, parsed to a zero based row and column
+                            if(CellAddress::parse(temp, r, c)){
                                 string str=table.getCell(row - firstR, col / CELL_SIZE)->getContent();
                                 table.printCell(str, row, col, firstR, table);
                                 terminal.printAt(row, col,str.substr(0, CELL_SIZE));
 
-                                r = FormulaParser::getRows(temp); // Parse the row from the formula
-                                c = FormulaParser::getCols(temp); // Parse the column from the formula
-                            
-
                                 // Update cursor position based on parsed row and column, ensuring they're within bounds
                             try {
                                     // Check: Is the input row (r) and column (c) within the valid range?
-                                    if (r <= table.getNumRows() && r > 0 && c <= table.getNumCols() && c > 0) {
-                                        row = (r + firstR) - 1; // Set the new row index based on input and offset.
-                                        col = (c * CELL_SIZE + firstC) - CELL_SIZE; // Set the new column position based on input and offset.
+                                    if (r < table.getNumRows() && r >= 0 && c < table.getNumCols() && c >= 0) {
+                                        row = r + firstR; // Set the new row index based on input and offset.
+                                        col = c * CELL_SIZE + firstC; // Set the new column position based on input and offset.
                                     }
                                     else {
                                         throw out_of_range("Invalid Range"); // Throw an exception if the input is out of range.
@@ -169,13 +161,15 @@ int main() {
 
                         // If the reset string matches the expected command "~RESET"
                         if(reset == "~RESET") {
-            
+                            table.clearRangeDependents(); // The formulas reading ranges are removed below
+
+                            // Empty every cell; formulas of other sheets that read the sheet keep their edges
+                            table.load({});
+                            book.recalculate();
+
                             // Loop through all rows and columns of the spreadsheet
                             for(int i = 0; i < table.getNumRows(); i++) {
                                 for(int j = 0; j < table.getNumCols(); j++) {
-                                    // Reset the cell content in the table to an empty string
-                                    table.getCell(i,j,1)=make_shared<EmptyValueCell>();
-                    
                                     // Clear the cell display on the terminal by printing an empty string
                                     terminal.printAt(i + firstR, j * CELL_SIZE + firstC, empty);
                                 }
@@ -196,10 +190,11 @@ int main() {
                         handleInput(filename, row, col, firstR, table, terminal, 3); // Get file name from user input
                         try{
                             FileManager::fileHandle(table, filename); // Handle the file saving operation
+                            SpreadSheet& shown = book.getActive(); // &SHEET shows another sheet
                             // Iterate over all rows and columns
-                            for (int i = 0; i < table.getNumRows(); i++) { 
-                                for (int j = 0; j < table.getNumCols(); j++) {
-                                    table.printCell(print, i + firstR, j * CELL_SIZE + firstC, firstR, table); // Print each cell
+                            for (int i = 0; i < shown.getNumRows(); i++) { 
+                                for (int j = 0; j < shown.getNumCols(); j++) {
+                                    shown.printCell(print, i + firstR, j * CELL_SIZE + firstC, firstR, shown); // Print each cell
                                     terminal.printAt(i + firstR, j * CELL_SIZE + firstC, print.substr(0, CELL_SIZE)); // Update all grids
                                 }
                             }
@@ -244,6 +239,22 @@ int main() {
                     }
                 } break;
 
+                case '^' :{
+                    if(input.size()==0){
+                        checkIfNormal=0;
+                        // Handle the sort, pivot and name commands, like ^SORT(A1..C20,B,-A), ^PIVOT(A1..C20,A,C,SUM,E1)
+                        // or ^NAME(sales,C1..C20)
+                        string command="^";
+                        handleInput(command, row, col, firstR, table, terminal, 3); // Get user input for the command
+                        try {
+                            FormulaParser::runCommand(command, table);
+                        }
+                        catch (exception& e) {
+                            table.inputFunc(row, col, 1, e.what());
+                        }
+                    }
+                } break;
+
                 case '\n':
                 case 'J':
                     checkIfNormal=0;
@@ -0,0 +1,218 @@
+#include "matrixKernels.h"
+#include "threadPool.h"
+#include <vector>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace utils {
+
+#if defined(__AVX2__)
+// c += a * b on 4 lanes, fused when the compiler targets FMA
+static inline __m256d multiplyAdd(__m256d a, __m256d b, __m256d c) {
+#if defined(__FMA__)
+    return _mm256_fmadd_pd(a, b, c);
+#else
+    return _mm256_add_pd(c, _mm256_mul_pd(a, b));
+#endif
+}
+#endif
+
+// c (rows x cols, at most 8 x 4) += a (rows x depth) * b (depth x cols). 'lda', 'ldb' and 'ldc' are the distances
+// between the columns of the matrices. A full 8 x 4 tile keeps its results in registers for the whole depth.
+static void tile(const double* a, int lda, const double* b, int ldb, double* c, int ldc, int rows, int cols, int depth) {
+#if defined(__AVX2__)
+    if (rows == 8 && cols == 4) {
+        __m256d c00 = _mm256_loadu_pd(c),           c10 = _mm256_loadu_pd(c + 4);
+        __m256d c01 = _mm256_loadu_pd(c + ldc),     c11 = _mm256_loadu_pd(c + ldc + 4);
+        __m256d c02 = _mm256_loadu_pd(c + 2 * ldc), c12 = _mm256_loadu_pd(c + 2 * ldc + 4);
+        __m256d c03 = _mm256_loadu_pd(c + 3 * ldc), c13 = _mm256_loadu_pd(c + 3 * ldc + 4);
+        for (int p = 0; p < depth; p++) {
+            __m256d a0 = _mm256_loadu_pd(a + (size_t)p * lda), a1 = _mm256_loadu_pd(a + (size_t)p * lda + 4);
+            __m256d b0 = _mm256_set1_pd(b[p]);
+            c00 = multiplyAdd(a0, b0, c00); c10 = multiplyAdd(a1, b0, c10);
+            __m256d b1 = _mm256_set1_pd(b[p + ldb]);
+            c01 = multiplyAdd(a0, b1, c01); c11 = multiplyAdd(a1, b1, c11);
+            __m256d b2 = _mm256_set1_pd(b[p + 2 * ldb]);
+            c02 = multiplyAdd(a0, b2, c02); c12 = multiplyAdd(a1, b2, c12);
+            __m256d b3 = _mm256_set1_pd(b[p + 3 * ldb]);
+            c03 = multiplyAdd(a0, b3, c03); c13 = multiplyAdd(a1, b3, c13);
+        }
+        _mm256_storeu_pd(c, c00);           _mm256_storeu_pd(c + 4, c10);
+        _mm256_storeu_pd(c + ldc, c01);     _mm256_storeu_pd(c + ldc + 4, c11);
+        _mm256_storeu_pd(c + 2 * ldc, c02); _mm256_storeu_pd(c + 2 * ldc + 4, c12);
+        _mm256_storeu_pd(c + 3 * ldc, c03); _mm256_storeu_pd(c + 3 * ldc + 4, c13);
+        return;
+    }
+#elif defined(__SSE2__)
+    if (rows == 8 && cols == 4) {
+        for (int half = 0; half < 2; half++) {
+            // Two passes of 4 x 4 keep the results within the 16 SSE registers
+            const double* x = a + 4 * half;
+            double* y = c + 4 * half;
+            __m128d c00 = _mm_loadu_pd(y),           c10 = _mm_loadu_pd(y + 2);
+            __m128d c01 = _mm_loadu_pd(y + ldc),     c11 = _mm_loadu_pd(y + ldc + 2);
+            __m128d c02 = _mm_loadu_pd(y + 2 * ldc), c12 = _mm_loadu_pd(y + 2 * ldc + 2);
+            __m128d c03 = _mm_loadu_pd(y + 3 * ldc), c13 = _mm_loadu_pd(y + 3 * ldc + 2);
+            for (int p = 0; p < depth; p++) {
+                __m128d a0 = _mm_loadu_pd(x + (size_t)p * lda), a1 = _mm_loadu_pd(x + (size_t)p * lda + 2);
+                __m128d b0 = _mm_set1_pd(b[p]);
+                c00 = _mm_add_pd(c00, _mm_mul_pd(a0, b0)); c10 = _mm_add_pd(c10, _mm_mul_pd(a1, b0));
+                __m128d b1 = _mm_set1_pd(b[p + ldb]);
+                c01 = _mm_add_pd(c01, _mm_mul_pd(a0, b1)); c11 = _mm_add_pd(c11, _mm_mul_pd(a1, b1));
+                __m128d b2 = _mm_set1_pd(b[p + 2 * ldb]);
+                c02 = _mm_add_pd(c02, _mm_mul_pd(a0, b2)); c12 = _mm_add_pd(c12, _mm_mul_pd(a1, b2));
+                __m128d b3 = _mm_set1_pd(b[p + 3 * ldb]);
+                c03 = _mm_add_pd(c03, _mm_mul_pd(a0, b3)); c13 = _mm_add_pd(c13, _mm_mul_pd(a1, b3));
+            }
+            _mm_storeu_pd(y, c00);           _mm_storeu_pd(y + 2, c10);
+            _mm_storeu_pd(y + ldc, c01);     _mm_storeu_pd(y + ldc + 2, c11);
+            _mm_storeu_pd(y + 2 * ldc, c02); _mm_storeu_pd(y + 2 * ldc + 2, c12);
+            _mm_storeu_pd(y + 3 * ldc, c03); _mm_storeu_pd(y + 3 * ldc + 2, c13);
+        }
+        return;
+    }
+#endif
+    // Edges of the result
+    for (int q = 0; q < cols; q++) {
+        for (int r = 0; r < rows; r++) {
+            double sum = c[r + (size_t)q * ldc];
+            for (int p = 0; p < depth; p++)
+                sum += a[r + (size_t)p * lda] * b[p + (size_t)q * ldb];
+            c[r + (size_t)q * ldc] = sum;
+        }
+    }
+}
+
+// y -= f * x over n entries
+static void subtractScaled(double* y, const double* x, double f, int n) {
+    int i = 0;
+#if defined(__AVX2__)
+    __m256d factor = _mm256_set1_pd(-f);
+    for (; i + 4 <= n; i += 4)
+        _mm256_storeu_pd(y + i, multiplyAdd(_mm256_loadu_pd(x + i), factor, _mm256_loadu_pd(y + i)));
+#elif defined(__SSE2__)
+    __m128d factor = _mm_set1_pd(f);
+    for (; i + 2 <= n; i += 2)
+        _mm_storeu_pd(y + i, _mm_sub_pd(_mm_loadu_pd(y + i), _mm_mul_pd(_mm_loadu_pd(x + i), factor)));
+#endif
+    for (; i < n; i++)
+        y[i] -= f * x[i];
+}
+
+// Product of two matrices, block by block
+void MatrixKernels::multiply(const double* a, const double* b, double* out, int n, int k, int m) {
+    fill(out, out + (size_t)n * m, 0.0);
+
+    // Columns j0..j1-1 of the result: a block of a stays in the L2 cache while it meets every column of b,
+    // and the matching piece of four columns of b stays in the L1 cache while it meets every row of the block
+    auto columns = [&](int j0, int j1) {
+        for (int pb = 0; pb < k; pb += BLOCK_DEPTH) {
+            int depth = min(BLOCK_DEPTH, k - pb);
+            for (int ib = 0; ib < n; ib += BLOCK_ROWS) {
+                int last = min(n, ib + BLOCK_ROWS);
+                for (int j = j0; j < j1; j += 4)
+                    for (int i = ib; i < last; i += 8)
+                        tile(a + i + (size_t)pb * n, n, b + pb + (size_t)j * k, k, out + i + (size_t)j * n, n,
+                             min(8, last - i), min(4, j1 - j), depth);
+            }
+        }
+    };
+
+    if ((long long)n * k * m < PARALLEL_THRESHOLD) {
+        columns(0, m);
+        return;
+    }
+    int tasks = (m + PARALLEL_COLUMNS - 1) / PARALLEL_COLUMNS;
+    ThreadPool::instance().parallelFor(tasks, [&](int task) {
+        columns(task * PARALLEL_COLUMNS, min(m, (task + 1) * PARALLEL_COLUMNS));
+    });
+}
+
+// Transpose, one square tile at a time
+void MatrixKernels::transpose(const double* a, double* out, int rows, int cols) {
+    for (int jb = 0; jb < cols; jb += TILE) {
+        int lastCol = min(cols, jb + TILE);
+        for (int ib = 0; ib < rows; ib += TILE) {
+            int lastRow = min(rows, ib + TILE);
+            for (int j = jb; j < lastCol; j++)
+                for (int i = ib; i < lastRow; i++)
+                    out[j + (size_t)i * cols] = a[i + (size_t)j * rows];
+        }
+    }
+}
+
+// Gauss-Jordan elimination on a copy of the matrix, applied to the identity at the same time.
+// Step p picks the largest entry of column p at or below the diagonal as pivot, swaps it into row p,
+// scales row p and removes column p from every other row. In column-major order that last part is,
+// for every column c, column c -= column p (without row p) * row p entry of column c.
+bool MatrixKernels::invert(const double* a, double* out, int n) {
+    vector<double> work(a, a + (size_t)n * n);
+    fill(out, out + (size_t)n * n, 0.0);
+    for (int i = 0; i < n; i++)
+        out[i + (size_t)i * n] = 1.0;
+
+    double scale = 0;
+    for (size_t i = 0; i < (size_t)n * n; i++)
+        scale = max(scale, fabs(a[i]));
+    double tolerance = scale * n * numeric_limits<double>::epsilon();
+
+    vector<double> multipliers(n);
+    ThreadPool& pool = ThreadPool::instance();
+    bool parallel = (long long)n * n * n >= PARALLEL_THRESHOLD;
+
+    for (int p = 0; p < n; p++) {
+        double* column = work.data() + (size_t)p * n;
+        int pivotRow = p;
+        for (int i = p + 1; i < n; i++)
+            if (fabs(column[i]) > fabs(column[pivotRow]))
+                pivotRow = i;
+        if (scale == 0 || fabs(column[pivotRow]) <= tolerance)
+            return false;
+
+        // Columns left of p are unit columns with zeros in both rows, so they need no swap
+        if (pivotRow != p) {
+            for (int c = p; c < n; c++)
+                swap(work[p + (size_t)c * n], work[pivotRow + (size_t)c * n]);
+            for (int c = 0; c < n; c++)
+                swap(out[p + (size_t)c * n], out[pivotRow + (size_t)c * n]);
+        }
+        double inverse = 1.0 / column[p];
+        for (int c = p; c < n; c++)
+            work[p + (size_t)c * n] *= inverse;
+        for (int c = 0; c < n; c++)
+            out[p + (size_t)c * n] *= inverse;
+
+        multipliers.assign(column, column + n);
+        multipliers[p] = 0.0;  // Row p is kept
+
+        // Columns p..n-1 of the work matrix, then every column of the inverse
+        int columns = (n - p) + n;
+        auto update = [&](int first, int last) {
+            for (int index = first; index < last; index++) {
+                double* target = (index < n - p) ? work.data() + (size_t)(p + index) * n
+                                                 : out + (size_t)(index - (n - p)) * n;
+                double factor = target[p];
+                if (factor != 0.0)
+                    subtractScaled(target, multipliers.data(), factor, n);
+            }
+        };
+        if (!parallel) {
+            update(0, columns);
+            continue;
+        }
+        int tasks = (columns + PARALLEL_COLUMNS - 1) / PARALLEL_COLUMNS;
+        pool.parallelFor(tasks, [&](int task) {
+            update(task * PARALLEL_COLUMNS, min(columns, (task + 1) * PARALLEL_COLUMNS));
+        });
+    }
+    return true;
+}
+
+}
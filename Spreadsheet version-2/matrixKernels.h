@@ -0,0 +1,38 @@
+#ifndef MATRIX_KERNELS_H
+#define MATRIX_KERNELS_H
+
+using namespace std;
+
+namespace utils {
+
+// Dense matrix kernels of the matrix functions (MMULT, TRANSPOSE, MINVERSE).
+// Matrices are contiguous and column-major, like the column store and the results of array formulas:
+// element (i, j) of a matrix with 'rows' rows is at index i + j * rows.
+// The kernels use AVX2 when the compiler targets it (-mavx2 / -march=native), SSE2 otherwise,
+// and scalar loops for the edges or on other architectures.
+class MatrixKernels {
+public:
+    // out (n x m) = a (n x k) * b (k x m). The product is computed in cache sized blocks of a and b with a register
+    // tile of 8 x 4 results; large products are split by columns of the result over the thread pool.
+    // Every result is summed in the same order whatever the number of threads.
+    static void multiply(const double* a, const double* b, double* out, int n, int k, int m);
+
+    // out (cols x rows) = transpose of a (rows x cols), copied in square tiles so both sides stay in cache
+    static void transpose(const double* a, double* out, int rows, int cols);
+
+    // out (n x n) = inverse of a (n x n) by Gauss-Jordan elimination with partial pivoting.
+    // Every step updates whole columns with a vectorized a*x+y, split over the thread pool for large matrices.
+    // Returns false if the matrix is singular (a pivot vanishes against the size of its entries).
+    static bool invert(const double* a, double* out, int n);
+
+private:
+    static constexpr int BLOCK_ROWS = 128; // Rows of a block of a (with BLOCK_DEPTH, 256 KB, fits the L2 cache)
+    static constexpr int BLOCK_DEPTH = 256; // Columns of a block of a / rows of a block of b
+    static const int TILE = 32;            // Side of the tiles of the transpose
+    static const int PARALLEL_THRESHOLD = 1 << 21; // Products with fewer multiply-adds run on the calling thread
+    static const int PARALLEL_COLUMNS = 32; // Columns per task of the parallel kernels
+};
+
+}
+
+#endif
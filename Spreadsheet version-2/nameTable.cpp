@@ -0,0 +1,62 @@
+#include "nameTable.h"
+
+namespace spreadsheet {
+
+// Returns the id of the name, -1 if it is not known
+int NameTable::find(const string& name) const {
+    auto it = ids.find(name);
+    return it == ids.end() ? -1 : it->second;
+}
+
+// Returns the id of the name, adding it undefined if needed
+int NameTable::add(const string& name) {
+    auto it = ids.find(name);
+    if (it != ids.end())
+        return it->second;
+    int id = entries.size();
+    entries.push_back(NameEntry());
+    entries[id].name = name;
+    ids[name] = id;
+    return id;
+}
+
+// Returns the entry with the given id
+const NameEntry& NameTable::get(int id) const {
+    return entries[id];
+}
+
+// Replaces the definition of a name
+void NameTable::define(int id, const NameDefinition& definition) {
+    entries[id].definition = definition;
+}
+
+// Binds a formula to a name
+void NameTable::addDependent(int id, Cell* cell) {
+    if (entries[id].formulas.insert(cell).second)
+        bound[cell].push_back(id);
+}
+
+// Unbinds a formula, visiting only the names it is bound to
+void NameTable::removeDependent(Cell* cell) {
+    auto it = bound.find(cell);
+    if (it == bound.end())
+        return;
+    for (int id : it->second)
+        entries[id].formulas.erase(cell);
+    bound.erase(it);
+}
+
+// Unbinds a set of formulas
+void NameTable::removeDependents(const unordered_set<Cell*>& cells) {
+    for (Cell* cell : cells)
+        removeDependent(cell);
+}
+
+// Unbinds every formula
+void NameTable::clearDependents() {
+    for (NameEntry& entry : entries)
+        entry.formulas.clear();
+    bound.clear();
+}
+
+}
@@ -0,0 +1,66 @@
+#ifndef NAME_TABLE_H
+#define NAME_TABLE_H
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+
+using namespace std;
+
+namespace spreadsheet {
+    class Cell;
+
+    // What a sheet-level name stands for: a block of cells or a number
+    struct NameDefinition {
+        bool defined = false;            // False for a name that is used but not defined (#NAME?)
+        bool range = false;              // The name is a block, otherwise a constant
+        double value = 0.0;              // Value of a constant
+        int row = 0, col = 0, lastRow = 0, lastCol = 0; // Zero based corners of a block
+    };
+
+    // A name, its definition and the formulas compiled against it
+    struct NameEntry {
+        string name;
+        NameDefinition definition;
+        unordered_set<Cell*> formulas;   // Formulas bound to the name
+    };
+
+    // Sheet-level names. A formula that uses a name is compiled with the definition in place of the name
+    // and bound to the name's id, so the formulas to recompile when the name is redefined are found
+    // through the name, without looking at the text of any cell. Names are never removed, so ids stay
+    // valid; an undefined name keeps the formulas waiting for its definition.
+    class NameTable {
+    public:
+        // Returns the id of the name, -1 if it has never been used or defined
+        int find(const string& name) const;
+
+        // Returns the id of the name, adding it undefined if needed
+        int add(const string& name);
+
+        // Returns the entry with the given id
+        const NameEntry& get(int id) const;
+
+        // Replaces the definition of a name
+        void define(int id, const NameDefinition& definition);
+
+        // Binds a formula to a name
+        void addDependent(int id, Cell* cell);
+
+        // Unbinds a formula from every name it is bound to
+        void removeDependent(Cell* cell);
+
+        // Unbinds a set of formulas
+        void removeDependents(const unordered_set<Cell*>& cells);
+
+        // Unbinds every formula; the names and their definitions stay
+        void clearDependents();
+
+    private:
+        vector<NameEntry> entries;             // All names, indexed by id
+        unordered_map<string, int> ids;        // Name -> id
+        unordered_map<Cell*, vector<int>> bound; // Formula -> ids of the names it is bound to
+    };
+}
+
+#endif
@@ -0,0 +1,189 @@
+#include "orderIndex.h"
+#include <algorithm>
+
+namespace spreadsheet {
+
+// Builds the index of the given numbers. The distinct values are sorted, so the treap is built in one pass
+// with a stack holding its right spine: each new node takes as left child the part of the spine it outranks.
+OrderIndex::OrderIndex(vector<double> values) : root(-1), seed(2463534242u) {
+    sort(values.begin(), values.end());
+    vector<int> spine;
+    for (size_t i = 0; i < values.size(); ) {
+        size_t j = i;
+        while (j < values.size() && values[j] == values[i])
+            j++;
+        int node = create(values[i]);
+        counts[node] = sizes[node] = j - i;
+        i = j;
+
+        int last = -1;
+        while (!spine.empty() && priorities[spine.back()] < priorities[node]) {
+            last = spine.back();
+            spine.pop_back();
+            resize(last); // Its subtree is complete once it leaves the spine
+        }
+        lefts[node] = last;
+        if (!spine.empty())
+            rights[spine.back()] = node;
+        spine.push_back(node);
+    }
+    for (size_t i = spine.size(); i-- > 0; )
+        resize(spine[i]);
+    if (!spine.empty())
+        root = spine[0];
+}
+
+// Adds one value: the node of the value is split out of the tree, created if needed, and merged back
+void OrderIndex::insert(double value) {
+    int less, rest, equal, greater;
+    split(root, value, false, less, rest);
+    split(rest, value, true, equal, greater);
+    if (equal == -1)
+        equal = create(value);
+    else {
+        counts[equal]++;
+        sizes[equal]++;
+    }
+    root = merge(merge(less, equal), greater);
+}
+
+// Removes one occurrence of a value
+bool OrderIndex::erase(double value) {
+    int less, rest, equal, greater;
+    split(root, value, false, less, rest);
+    split(rest, value, true, equal, greater);
+    bool found = equal != -1;
+    if (found && --counts[equal] > 0)
+        sizes[equal]--;
+    else if (found) {
+        unused.push_back(equal);
+        equal = -1;
+    }
+    root = merge(merge(less, equal), greater);
+    return found;
+}
+
+// Number of values
+int OrderIndex::size() const {
+    return sizeOf(root);
+}
+
+// k-th smallest value
+double OrderIndex::select(int k) const {
+    int node = root;
+    while (true) {
+        int left = sizeOf(lefts[node]);
+        if (k < left)
+            node = lefts[node];
+        else if (k < left + counts[node])
+            return keys[node];
+        else {
+            k -= left + counts[node];
+            node = rights[node];
+        }
+    }
+}
+
+// Number of values smaller than 'value'
+int OrderIndex::countLess(double value) const {
+    int count = 0;
+    for (int node = root; node != -1; ) {
+        if (keys[node] < value) {
+            count += sizeOf(lefts[node]) + counts[node];
+            node = rights[node];
+        }
+        else
+            node = lefts[node];
+    }
+    return count;
+}
+
+// Number of values smaller than or equal to 'value'
+int OrderIndex::countLessOrEqual(double value) const {
+    int count = 0;
+    for (int node = root; node != -1; ) {
+        if (keys[node] <= value) {
+            count += sizeOf(lefts[node]) + counts[node];
+            node = rights[node];
+        }
+        else
+            node = lefts[node];
+    }
+    return count;
+}
+
+// Splits a subtree into the values below 'value' (at most 'value' when 'inclusive') and the others
+void OrderIndex::split(int node, double value, bool inclusive, int& left, int& right) {
+    if (node == -1) {
+        left = right = -1;
+        return;
+    }
+    if (keys[node] < value || (inclusive && keys[node] == value)) {
+        split(rights[node], value, inclusive, rights[node], right);
+        left = node;
+    }
+    else {
+        split(lefts[node], value, inclusive, left, lefts[node]);
+        right = node;
+    }
+    resize(node);
+}
+
+// Joins two subtrees, the root with the higher priority staying on top
+int OrderIndex::merge(int left, int right) {
+    if (left == -1)
+        return right;
+    if (right == -1)
+        return left;
+    if (priorities[left] > priorities[right]) {
+        rights[left] = merge(rights[left], right);
+        resize(left);
+        return left;
+    }
+    lefts[right] = merge(left, lefts[right]);
+    resize(right);
+    return right;
+}
+
+// Recomputes the size of a node from its children
+void OrderIndex::resize(int node) {
+    sizes[node] = sizeOf(lefts[node]) + counts[node] + sizeOf(rights[node]);
+}
+
+// Size of a subtree
+int OrderIndex::sizeOf(int node) const {
+    return node == -1 ? 0 : sizes[node];
+}
+
+// Creates a node holding one occurrence of a value, reusing a freed node if there is one
+int OrderIndex::create(double value) {
+    int node;
+    if (!unused.empty()) {
+        node = unused.back();
+        unused.pop_back();
+    }
+    else {
+        node = keys.size();
+        keys.push_back(0);
+        priorities.push_back(0);
+        counts.push_back(0);
+        sizes.push_back(0);
+        lefts.push_back(-1);
+        rights.push_back(-1);
+    }
+    keys[node] = value;
+    priorities[node] = nextPriority();
+    counts[node] = sizes[node] = 1;
+    lefts[node] = rights[node] = -1;
+    return node;
+}
+
+// Next pseudo random priority
+uint32_t OrderIndex::nextPriority() {
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return seed;
+}
+
+}
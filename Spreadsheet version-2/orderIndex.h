@@ -0,0 +1,70 @@
+#ifndef ORDER_INDEX_H
+#define ORDER_INDEX_H
+
+#include <vector>
+#include <cstdint>
+
+using namespace std;
+
+namespace spreadsheet {
+
+// Order statistic tree over the numbers of a block of cells, for blocks that are both edited and read
+// by MEDIAN / PERCENTILE / QUARTILE / RANK / LARGE / SMALL often (see RangeIndex::getOrder).
+// It is a treap keyed by value: equal values share a node with a multiplicity, and every node knows
+// how many values its subtree holds, so the k-th smallest value and the rank of a value take O(log n)
+// expected steps, and so does replacing the value of an edited cell.
+class OrderIndex {
+public:
+    // Builds the index of the given numbers in O(n log n)
+    OrderIndex(vector<double> values);
+
+    // Adds one value
+    void insert(double value);
+
+    // Removes one occurrence of a value. Returns false if the value is not in the index.
+    bool erase(double value);
+
+    // Number of values
+    int size() const;
+
+    // k-th smallest value, k zero based and below size()
+    double select(int k) const;
+
+    // Number of values smaller than 'value'
+    int countLess(double value) const;
+
+    // Number of values smaller than or equal to 'value'
+    int countLessOrEqual(double value) const;
+
+private:
+    // Splits a subtree into the values below 'value' (or at most 'value' when 'inclusive') and the others
+    void split(int node, double value, bool inclusive, int& left, int& right);
+
+    // Joins two subtrees, every value of 'left' being below every value of 'right'
+    int merge(int left, int right);
+
+    // Recomputes the size of a node from its children
+    void resize(int node);
+
+    // Size of a subtree (0 for -1)
+    int sizeOf(int node) const;
+
+    // Creates a node holding one occurrence of a value
+    int create(double value);
+
+    // Next pseudo random priority (xorshift)
+    uint32_t nextPriority();
+
+    vector<double> keys;        // Value of each node
+    vector<uint32_t> priorities; // Heap priority of each node
+    vector<int> counts;         // Occurrences of the value
+    vector<int> sizes;          // Occurrences in the subtree
+    vector<int> lefts, rights;  // Children, -1 if none
+    vector<int> unused;         // Nodes freed by erase, reused by create
+    int root;                   // Root node, -1 if empty
+    uint32_t seed;              // State of the priority generator
+};
+
+}
+
+#endif
@@ -0,0 +1,416 @@
+#include "pivotTable.h"
+#include "spreadSheet.h"
+#include "threadPool.h"
+#include "stringPool.h"
+#include "functionRegistry.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+
+using namespace utils;
+
+namespace spreadsheet {
+
+// Mixes the bits of a word (splitmix64 finalizer), so nearby numbers land in different partitions
+static size_t mix(uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return (size_t)x;
+}
+
+// Two keys are equal if they hold the same kind of value and the same value
+bool PivotTable::Key::operator==(const Key& other) const {
+    return kind == other.kind && number == other.number && text == other.text;
+}
+
+// Two group keys are equal if both of their keys are
+bool PivotTable::GroupKey::operator==(const GroupKey& other) const {
+    return row == other.row && col == other.col;
+}
+
+// Hashes the kind, the number and the text id of a key
+size_t PivotTable::KeyHash::operator()(const Key& key) const {
+    uint64_t bits;
+    memcpy(&bits, &key.number, sizeof(bits));
+    return mix(bits ^ ((uint64_t)key.text << 8) ^ key.kind);
+}
+
+// Combines the hashes of both keys
+size_t PivotTable::GroupHash::operator()(const GroupKey& key) const {
+    KeyHash hash;
+    return mix(hash(key.row) * 31 + hash(key.col));
+}
+
+// Creates the pivot
+PivotTable::PivotTable(const PivotSpec& spec) : spec(spec) {}
+
+// Returns the definition of the pivot
+const PivotSpec& PivotTable::getSpec() const {
+    return spec;
+}
+
+// Aggregates the source in three passes on the thread pool:
+// every part of the rows is grouped into one hash table per partition (partition = bits of the key hash),
+// every partition is then merged by one thread, and finally every row looks up the id of its group.
+void PivotTable::build(SpreadSheet& table) {
+    const ColumnStore& store = table.getStore();
+    int rows = spec.lastRow - spec.row + 1;
+    ThreadPool& pool = ThreadPool::instance();
+    int parts = (rows < PARALLEL_THRESHOLD) ? 1 : pool.size();
+    int partSize = (rows + parts - 1) / parts;
+    GroupHash hash;
+
+    typedef unordered_map<GroupKey, Totals, GroupHash> Tables;
+    vector<vector<Tables>> local(parts, vector<Tables>(parts));
+    pool.parallelFor(parts, [&](int part) {
+        int end = min(rows, (part + 1) * partSize);
+        const double* values = store.values(spec.valueCol, 0);
+        const unsigned char* mask = store.mask(spec.valueCol, 0);
+        for (int i = part * partSize; i < end; i++) {
+            int row = spec.row + i;
+            GroupKey key = groupOf(store, row);
+            Totals& totals = local[part][(hash(key) >> 40) % parts][key];
+            totals.rows++;
+            if (mask[row]) {
+                totals.sum += values[row];
+                totals.count++;
+            }
+            if (totals.firstRow < 0)
+                totals.firstRow = row;
+        }
+    });
+
+    // Parts are merged in row order, so the first row of every group is the first one of the source
+    vector<Tables> merged(parts);
+    pool.parallelFor(parts, [&](int partition) {
+        merged[partition].swap(local[0][partition]);
+        for (int part = 1; part < parts; part++) {
+            for (const auto& entry : local[part][partition])
+                merge(merged[partition][entry.first], entry.second);
+            Tables().swap(local[part][partition]);
+        }
+    });
+
+    groups.clear();
+    keys.clear();
+    ids.clear();
+    rowAxis.clear();
+    colAxis.clear();
+    // Groups are numbered in the order of their first rows, so every key is labelled by its first cell
+    vector<pair<int, const pair<const GroupKey, Totals>*>> order;
+    for (const Tables& partition : merged)
+        for (const auto& entry : partition)
+            order.push_back({entry.second.firstRow, &entry});
+    std::sort(order.begin(), order.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+    for (const auto& item : order) {
+        const GroupKey& key = item.second->first;
+        const Totals& totals = item.second->second;
+        ids[key] = groups.size();
+        groups.push_back(totals);
+        keys.push_back(key);
+        addKey(rowAxis, key.row, totals.rows, table, totals.firstRow, spec.rowKey);
+        addKey(colAxis, key.col, totals.rows, table, totals.firstRow, spec.colKey);
+    }
+
+    rowGroup.assign(rows, 0);
+    rowValue.assign(rows, 0.0);
+    rowNumeric.assign(rows, 0);
+    pool.parallelFor(parts, [&](int part) {
+        int end = min(rows, (part + 1) * partSize);
+        for (int i = part * partSize; i < end; i++) {
+            int row = spec.row + i;
+            rowGroup[i] = ids.find(groupOf(store, row))->second;
+            rowNumeric[i] = *store.mask(spec.valueCol, row);
+            rowValue[i] = *store.values(spec.valueCol, row);
+        }
+    });
+
+    changed.assign(rows, 0);
+    changedRows.clear();
+    layoutChanged = true;
+}
+
+// Marks the row as changed if the cell is read by the pivot
+void PivotTable::touch(int row, int col) {
+    if (!reads(row, col))
+        return;
+    int i = row - spec.row;
+    if (!changed[i]) {
+        changed[i] = 1;
+        changedRows.push_back(i);
+    }
+}
+
+// Returns true if rows changed since the last refresh
+bool PivotTable::isDirty() const {
+    return !changedRows.empty() || layoutChanged;
+}
+
+// Returns true if the cell is a key or value cell of the source
+bool PivotTable::reads(int row, int col) const {
+    return row >= spec.row && row <= spec.lastRow &&
+           (col == spec.rowKey || col == spec.colKey || col == spec.valueCol);
+}
+
+// Moves every changed row to its new group. While the keys stay the same, only the cells of the touched
+// groups are compared with what is shown; when keys appear or disappear, the whole result is laid out again.
+vector<PivotCell> PivotTable::refresh(SpreadSheet& table) {
+    vector<int> touched;
+    for (int i : changedRows) {
+        changed[i] = 0;
+        touched.push_back(removeRow(spec.row + i));
+        touched.push_back(addRow(table, spec.row + i));
+    }
+    changedRows.clear();
+
+    vector<PivotCell> cells;
+    int rows = table.getNumRows() - spec.targetRow, cols = table.getNumCols() - spec.targetCol;
+    if (!layoutChanged) {
+        std::sort(touched.begin(), touched.end());
+        touched.erase(unique(touched.begin(), touched.end()), touched.end());
+        for (int group : touched) {
+            auto row = rowIndex.find(keys[group].row);
+            auto col = colIndex.find(keys[group].col);
+            if (row == rowIndex.end() || col == colIndex.end() || row->second >= (int)shown.size() ||
+                col->second >= (int)shown[row->second].size())
+                continue;  // Outside the sheet
+            string text = cellOf(group);
+            if (shown[row->second][col->second] != text) {
+                shown[row->second][col->second] = text;
+                cells.push_back({spec.targetRow + row->second, spec.targetCol + col->second, text});
+            }
+        }
+        return cells;
+    }
+
+    // Compare the new result with the old one over both extents, clipped to the sheet
+    vector<vector<string>> texts = layout();
+    size_t height = max(texts.size(), shown.size());
+    for (size_t r = 0; r < height && (int)r < rows; r++) {
+        size_t oldWidth = r < shown.size() ? shown[r].size() : 0;
+        size_t newWidth = r < texts.size() ? texts[r].size() : 0;
+        for (size_t c = 0; c < max(oldWidth, newWidth) && (int)c < cols; c++) {
+            const string& oldText = c < oldWidth ? shown[r][c] : "";
+            const string& newText = c < newWidth ? texts[r][c] : "";
+            if (oldText != newText)
+                cells.push_back({spec.targetRow + (int)r, spec.targetCol + (int)c, newText});
+        }
+    }
+    // Only the part inside the sheet is shown
+    if ((int)texts.size() > rows)
+        texts.resize(max(rows, 0));
+    for (vector<string>& line : texts)
+        if ((int)line.size() > cols)
+            line.resize(max(cols, 0));
+    shown.swap(texts);
+    layoutChanged = false;
+    return cells;
+}
+
+// Forgets the result and returns the cells that clear it
+vector<PivotCell> PivotTable::clear() {
+    vector<PivotCell> cells;
+    for (size_t r = 0; r < shown.size(); r++)
+        for (size_t c = 0; c < shown[r].size(); c++)
+            if (!shown[r][c].empty())
+                cells.push_back({spec.targetRow + (int)r, spec.targetCol + (int)c, ""});
+    shown.clear();
+    layoutChanged = true;
+    return cells;
+}
+
+// Reads the key of a cell from the column store: its number, its interned text, its error value or blank
+PivotTable::Key PivotTable::keyOf(const ColumnStore& store, int row, int col) {
+    Key key = {3, 0.0, 0};
+    if (col < 0)
+        return key;
+    if (*store.mask(col, row)) {
+        key.kind = 0;
+        key.number = *store.values(col, row) + 0.0; // -0 and 0 are the same key
+    }
+    else if (*store.textIds(col, row) != 0) {
+        key.kind = 1;
+        key.text = *store.textIds(col, row);
+    }
+    else {
+        ErrorCode error = store.firstError(row, col, row, col);
+        if (error != ErrorCode::none) {
+            key.kind = 2;
+            key.number = (double)error;
+        }
+    }
+    return key;
+}
+
+// Reads the keys of a row
+PivotTable::GroupKey PivotTable::groupOf(const ColumnStore& store, int row) const {
+    return {keyOf(store, row, spec.rowKey), keyOf(store, row, spec.colKey)};
+}
+
+// Adds a group of rows to the totals
+void PivotTable::merge(Totals& into, const Totals& from) {
+    into.sum += from.sum;
+    into.count += from.count;
+    into.rows += from.rows;
+    if (into.firstRow < 0)
+        into.firstRow = from.firstRow;
+}
+
+// Adds the current content of a row to its group, creating the group if it is new
+int PivotTable::addRow(SpreadSheet& table, int row) {
+    const ColumnStore& store = table.getStore();
+    int i = row - spec.row;
+    GroupKey key = groupOf(store, row);
+    auto found = ids.find(key);
+    if (found == ids.end()) {
+        found = ids.emplace(key, groups.size()).first;
+        groups.push_back(Totals());
+        keys.push_back(key);
+    }
+
+    Totals& totals = groups[found->second];
+    rowGroup[i] = found->second;
+    rowNumeric[i] = *store.mask(spec.valueCol, row);
+    rowValue[i] = *store.values(spec.valueCol, row);
+    totals.rows++;
+    if (rowNumeric[i]) {
+        totals.sum += rowValue[i];
+        totals.count++;
+    }
+    addKey(rowAxis, key.row, 1, table, row, spec.rowKey);
+    addKey(colAxis, key.col, 1, table, row, spec.colKey);
+    return found->second;
+}
+
+// Takes the remembered content of a row out of its group
+int PivotTable::removeRow(int row) {
+    int i = row - spec.row;
+    int group = rowGroup[i];
+    Totals& totals = groups[group];
+    totals.rows--;
+    if (rowNumeric[i]) {
+        totals.sum -= rowValue[i];
+        totals.count--;
+    }
+    if (totals.count == 0)
+        totals.sum = 0; // No rounding left over from the removed numbers
+    removeKey(rowAxis, keys[group].row);
+    removeKey(colAxis, keys[group].col);
+    return group;
+}
+
+// Orders the keys and computes the texts of the whole result
+vector<vector<string>> PivotTable::layout() {
+    vector<Key> rowKeys = ordered(rowAxis);
+    vector<Key> colKeys = ordered(colAxis);
+    int header = (spec.colKey >= 0) ? 1 : 0;
+
+    rowIndex.clear();
+    colIndex.clear();
+    for (size_t r = 0; r < rowKeys.size(); r++)
+        rowIndex[rowKeys[r]] = header + r;
+    for (size_t c = 0; c < colKeys.size(); c++)
+        colIndex[colKeys[c]] = 1 + c;
+
+    vector<vector<string>> texts(header + rowKeys.size(), vector<string>(1 + colKeys.size()));
+    if (header) {
+        texts[0][0] = FunctionRegistry::get(spec.function).name;
+        for (size_t c = 0; c < colKeys.size(); c++)
+            texts[0][1 + c] = colAxis.at(colKeys[c]).label;
+    }
+    for (size_t r = 0; r < rowKeys.size(); r++)
+        texts[header + r][0] = rowAxis.at(rowKeys[r]).label;
+    for (size_t group = 0; group < groups.size(); group++)
+        if (groups[group].rows > 0)
+            texts[rowIndex[keys[group].row]][colIndex[keys[group].col]] = cellOf(group);
+    return texts;
+}
+
+// Text of the result cell of a group: empty once its last row is gone
+string PivotTable::cellOf(int group) const {
+    return groups[group].rows > 0 ? resultOf(groups[group]) : "";
+}
+
+// Adds rows to a key; a new key takes the text of the cell it was read from as its label
+bool PivotTable::addKey(unordered_map<Key, Axis, KeyHash>& axis, const Key& key, long long rows,
+                        SpreadSheet& table, int row, int col) {
+    auto found = axis.find(key);
+    if (found != axis.end()) {
+        found->second.rows += rows;
+        return false;
+    }
+
+    Axis entry;
+    entry.rows = rows;
+    if (key.kind == 0)
+        entry.label = format(key.number);
+    else if (key.kind == 1)
+        entry.label = table.getCell(row, col)->getValue();
+    else if (key.kind == 2)
+        entry.label = ErrorValue::toString((ErrorCode)(int)key.number);
+    else if (col >= 0)
+        entry.label = "(blank)";
+    axis.emplace(key, entry);
+    layoutChanged = true;
+    return true;
+}
+
+// Removes a row from a key; the key disappears with its last row
+bool PivotTable::removeKey(unordered_map<Key, Axis, KeyHash>& axis, const Key& key) {
+    auto found = axis.find(key);
+    if (found == axis.end() || --found->second.rows > 0)
+        return false;
+    axis.erase(found);
+    layoutChanged = true;
+    return true;
+}
+
+// Orders the keys: numbers ascending, then texts alphabetically (they are lower case), then errors, then blank
+vector<PivotTable::Key> PivotTable::ordered(const unordered_map<Key, Axis, KeyHash>& axis) {
+    vector<Key> result;
+    for (const auto& entry : axis)
+        result.push_back(entry.first);
+    std::sort(result.begin(), result.end(), [](const Key& a, const Key& b) {
+        if (a.kind != b.kind)
+            return a.kind < b.kind;
+        if (a.kind == 1)
+            return StringPool::get(a.text) < StringPool::get(b.text);
+        return a.number < b.number;
+    });
+    return result;
+}
+
+// Text of the aggregate of a group; the average of a group without numbers is left empty
+string PivotTable::resultOf(const Totals& totals) const {
+    if (spec.function == Function::count)
+        return format(totals.count);
+    if (spec.function == Function::aver)
+        return totals.count > 0 ? format(totals.sum / totals.count) : "";
+    return format(totals.sum);
+}
+
+// Formats a number as cell content: whole numbers without a decimal point, others with up to ten decimals
+string PivotTable::format(double value) {
+    if (value == 0)
+        return "0";
+    char buffer[64];
+    if (value > -1e15 && value < 1e15 && value == (long long)value)
+        snprintf(buffer, sizeof(buffer), "%lld", (long long)value);
+    else {
+        snprintf(buffer, sizeof(buffer), "%.10f", value);
+        char* end = buffer + strlen(buffer) - 1;
+        while (*end == '0')
+            *end-- = '\0';
+        if (*end == '.')
+            *end = '\0';
+        if (strcmp(buffer, "-0") == 0)
+            return "0";
+    }
+    return buffer;
+}
+
+}
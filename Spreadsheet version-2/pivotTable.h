@@ -0,0 +1,164 @@
+#ifndef PIVOT_TABLE_H
+#define PIVOT_TABLE_H
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include "formulaCompiler.h"
+#include "columnStore.h"
+
+using namespace std;
+using namespace utils;
+
+namespace spreadsheet {
+
+class SpreadSheet;
+
+// Definition of a pivot command
+struct PivotSpec {
+    int row, lastRow;         // Zero based rows of the source block
+    int rowKey;               // Column whose values become the rows of the result
+    int colKey;               // Column whose values become the columns of the result, -1 for a single key
+    int valueCol;             // Column whose numbers are aggregated
+    Function function;        // Function::sum, Function::count or Function::aver
+    int targetRow, targetCol; // Top left cell of the result
+};
+
+// Cell of the result whose text changed
+struct PivotCell {
+    int row, col;  // Zero based position in the sheet
+    string text;   // New content ("" to clear the cell)
+};
+
+// Summary of a block of rows grouped by one or two key columns (a pivot table).
+// With one key the result is two columns: every key, then the aggregate of its rows.
+// With two keys it is a cross table: the values of the second key form a header row, the values of the
+// first key the rows, and every cell holds the aggregate of the rows with both keys.
+// Keys are ordered numbers first, then texts (without case), then error values and blanks.
+// Only numbers of the value column are aggregated; texts, errors and blanks are skipped (COUNT counts numbers).
+//
+// The first aggregation is a partitioned hash aggregation on the thread pool: every thread groups its part of
+// the rows into its own tables, one per partition of the key hash, then every partition is merged by one thread.
+// Afterwards the group of every row is remembered, so a changed row only moves its value from its old group
+// to its new one and the result is rewritten for the cells whose text changed.
+class PivotTable {
+public:
+    // Creates the pivot; nothing is aggregated until build
+    explicit PivotTable(const PivotSpec& spec);
+
+    // Returns the definition of the pivot
+    const PivotSpec& getSpec() const;
+
+    // Aggregates every row of the source from scratch
+    void build(SpreadSheet& table);
+
+    // Marks the row as changed if the cell is a key or value cell of the source
+    void touch(int row, int col);
+
+    // Returns true if rows changed since the last refresh
+    bool isDirty() const;
+
+    // Applies the changed rows and returns the cells of the result whose text changed
+    // (cells the result no longer covers are cleared). The result is clipped to the sheet.
+    vector<PivotCell> refresh(SpreadSheet& table);
+
+    // Returns true if the cell is a key or value cell of the source
+    bool reads(int row, int col) const;
+
+    // Forgets the result and returns the cells that clear it (used when the pivot is replaced)
+    vector<PivotCell> clear();
+
+private:
+    // Value of a key cell
+    struct Key {
+        unsigned char kind; // 0 number, 1 text, 2 error value, 3 blank
+        double number;      // Number, or the error code
+        int text;           // Interned lower case text
+        bool operator==(const Key& other) const;
+    };
+
+    // Keys of a row
+    struct GroupKey {
+        Key row, col;
+        bool operator==(const GroupKey& other) const;
+    };
+
+    // Hash of a group key
+    struct GroupHash {
+        size_t operator()(const GroupKey& key) const;
+    };
+
+    // Hash of a key
+    struct KeyHash {
+        size_t operator()(const Key& key) const;
+    };
+
+    // Running totals of a group
+    struct Totals {
+        double sum = 0;        // Sum of the numbers
+        long long count = 0;   // Number of numbers
+        long long rows = 0;    // Number of rows, numeric or not
+        int firstRow = -1;     // A row of the group, to read the text of its keys
+    };
+
+    // A distinct value of one key column
+    struct Axis {
+        long long rows = 0;    // Number of rows holding it
+        string label;          // Text shown in the result
+    };
+
+    // Reads the key of a cell
+    static Key keyOf(const ColumnStore& store, int row, int col);
+
+    // Reads the keys of a row
+    GroupKey groupOf(const ColumnStore& store, int row) const;
+
+    // Adds a group of rows to the totals
+    static void merge(Totals& into, const Totals& from);
+
+    // Adds / removes a row to / from its group and the key axes; returns the id of the group
+    int addRow(SpreadSheet& table, int row);
+    int removeRow(int row);
+
+    // Orders the keys of both axes and computes the texts of the whole result
+    vector<vector<string>> layout();
+
+    // Text of the result cell of a group
+    string cellOf(int group) const;
+
+    // Adds / removes rows to / from a key axis. Returns true if a new key appeared or a key disappeared.
+    bool addKey(unordered_map<Key, Axis, KeyHash>& axis, const Key& key, long long rows, SpreadSheet& table, int row, int col);
+    bool removeKey(unordered_map<Key, Axis, KeyHash>& axis, const Key& key);
+
+    // Orders the keys of an axis for the result
+    static vector<Key> ordered(const unordered_map<Key, Axis, KeyHash>& axis);
+
+    // Text of the aggregate of a group
+    string resultOf(const Totals& totals) const;
+
+    // Formats a number like the cells of the sheet hold it
+    static string format(double value);
+
+    PivotSpec spec;
+    vector<Totals> groups;                           // Totals of every group, by id
+    vector<GroupKey> keys;                           // Keys of every group, by id
+    unordered_map<GroupKey, int, GroupHash> ids;     // Group key -> id
+    vector<int> rowGroup;                            // Group id of every source row
+    vector<double> rowValue;                         // Number of every source row
+    vector<unsigned char> rowNumeric;                // The row holds a number
+    unordered_map<Key, Axis, KeyHash> rowAxis;       // Values of the first key
+    unordered_map<Key, Axis, KeyHash> colAxis;       // Values of the second key
+    vector<unsigned char> changed;                   // Row changed since the last refresh
+    vector<int> changedRows;                         // Rows marked in 'changed'
+    vector<vector<string>> shown;                    // Texts written by the last refresh
+    unordered_map<Key, int, KeyHash> rowIndex;       // First key -> row of the result
+    unordered_map<Key, int, KeyHash> colIndex;       // Second key -> column of the result
+    bool layoutChanged = true;                       // Keys appeared or disappeared since the last refresh
+
+    // Sources with fewer rows than this are aggregated on the calling thread
+    static const int PARALLEL_THRESHOLD = 1 << 14;
+};
+
+}
+
+#endif
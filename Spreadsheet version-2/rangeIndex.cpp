@@ -0,0 +1,199 @@
+#include "rangeIndex.h"
+#include "rangeKernels.h"
+#include <algorithm>
+#include <cmath>
+
+using namespace utils;
+
+namespace spreadsheet {
+
+// Creates an index for a sheet with the given number of columns
+RangeIndex::RangeIndex(int cols) : byColumn(cols) {}
+
+// Returns the id of the node of the block, creating it if needed
+int RangeIndex::add(int row, int col, int lastRow, int lastCol) {
+    array<int, 4> key = {row, col, lastRow, lastCol};
+    auto it = ids.find(key);
+    if (it != ids.end())
+        return it->second;
+
+    int id = nodes.size();
+    nodes.push_back(RangeNode());
+    nodes[id].row = row;
+    nodes[id].col = col;
+    nodes[id].lastRow = lastRow;
+    nodes[id].lastCol = lastCol;
+    ids[key] = id;
+    for (int c = col; c <= lastCol; c++)
+        byColumn[c].push_back(id);
+    return id;
+}
+
+// Registers a formula as a dependent of the node
+void RangeIndex::addDependent(int id, Cell* cell) {
+    RangeNode& node = nodes[id];
+    if (node.dependentSet) {
+        if (node.dependentSet->insert(cell).second)
+            node.dependents.push_back(cell);
+    }
+    else if (find(node.dependents.begin(), node.dependents.end(), cell) == node.dependents.end()) {
+        node.dependents.push_back(cell);
+        if ((int)node.dependents.size() > DEPENDENT_SET_THRESHOLD)
+            indexDependents(node);
+    }
+}
+
+// Removes a formula from every node. Nodes nobody reads any more stop maintaining their cache.
+void RangeIndex::removeDependent(Cell* cell) {
+    for (RangeNode& node : nodes) {
+        if (node.dependentSet && !node.dependentSet->erase(cell))
+            continue;
+        auto it = std::remove(node.dependents.begin(), node.dependents.end(), cell);
+        node.dependents.erase(it, node.dependents.end());
+        if (node.dependents.empty()) {
+            node.valid = false;
+            node.order.reset();
+        }
+    }
+}
+
+// Removes a set of formulas from every node in one pass
+void RangeIndex::removeDependents(const unordered_set<Cell*>& cells) {
+    for (RangeNode& node : nodes) {
+        auto it = std::remove_if(node.dependents.begin(), node.dependents.end(),
+                                 [&](Cell* cell) { return cells.count(cell) > 0; });
+        if (it != node.dependents.end()) {
+            node.dependents.erase(it, node.dependents.end());
+            indexDependents(node);
+        }
+        if (node.dependents.empty()) {
+            node.valid = false;
+            node.order.reset();
+        }
+    }
+}
+
+// Keeps the hash set only for nodes with more than DEPENDENT_SET_THRESHOLD dependents
+void RangeIndex::indexDependents(RangeNode& node) {
+    if ((int)node.dependents.size() > DEPENDENT_SET_THRESHOLD)
+        node.dependentSet = make_unique<unordered_set<Cell*>>(node.dependents.begin(), node.dependents.end());
+    else
+        node.dependentSet.reset();
+}
+
+// Appends the dependents of every node that contains (row, col)
+void RangeIndex::collect(int row, int col, vector<Cell*>& out) const {
+    for (int id : byColumn[col]) {
+        const RangeNode& node = nodes[id];
+        if (row >= node.row && row <= node.lastRow)
+            out.insert(out.end(), node.dependents.begin(), node.dependents.end());
+    }
+}
+
+// Updates the cached statistics of every node that contains the changed cell and collects their dependents
+void RangeIndex::applyChange(const CellChange& change, vector<Cell*>& out) {
+    for (int id : byColumn[change.col]) {
+        RangeNode& node = nodes[id];
+        if (change.row < node.row || change.row > node.lastRow || node.dependents.empty())
+            continue;
+        if (node.valid)
+            node.valid = update(node, change);
+        updateOrder(node, change);
+        out.insert(out.end(), node.dependents.begin(), node.dependents.end());
+    }
+}
+
+// Returns the statistics of the node, scanning the block if needed
+const AggregateState& RangeIndex::getState(int id, const ColumnStore& store, bool exactExtremes) {
+    RangeNode& node = nodes[id];
+    if (!node.valid || (exactExtremes && !node.state.hasExactExtremes())) {
+        node.state = scan(node, store);
+        node.valid = true;
+        node.updates = 0;
+        node.scale = fabs(node.state.getSum());
+    }
+    return node.state;
+}
+
+// Returns the order index of the node, building it once the block has been edited and reread often enough
+const OrderIndex* RangeIndex::getOrder(int id, const ColumnStore& store) {
+    RangeNode& node = nodes[id];
+    if (node.order || !node.edited)
+        return node.order.get();
+    node.edited = false;
+    int rows = node.lastRow - node.row + 1;
+    long long cells = (long long)rows * (node.lastCol - node.col + 1);
+    if (++node.rereads < ORDER_INDEX_REREADS || cells < ORDER_INDEX_CELLS)
+        return nullptr;
+
+    vector<double> numbers(cells);
+    int count = 0;
+    for (int c = node.col; c <= node.lastCol; c++)
+        count += RangeKernels::gather(store.values(c, node.row), store.mask(c, node.row), rows, numbers.data() + count);
+    numbers.resize(count);
+    node.order.reset(new OrderIndex(move(numbers)));
+    return node.order.get();
+}
+
+// Removes the old value of the changed cell from the cached state and adds the new one.
+// SUM, AVER, COUNT and STDDEV are invertible; MIN and MAX are rescanned on read only when the removed
+// value was the extreme (see getState).
+bool RangeIndex::update(RangeNode& node, const CellChange& change) {
+    if (change.wasNumber) {
+        node.state.remove(change.oldValue);
+        node.scale = max(node.scale, fabs(change.oldValue));
+    }
+    if (change.isNumber) {
+        node.state.add(change.newValue);
+        node.scale = max(node.scale, fabs(change.newValue));
+    }
+
+    // Periodic rescan, and a rescan when the sum lost most of its significant digits to cancellation
+    if (++node.updates >= MAX_INCREMENTAL_UPDATES)
+        return false;
+    if (node.state.getCount() > 0 && fabs(node.state.getSum()) < node.scale * 1e-9)
+        return false;
+    return true;
+}
+
+// Replaces the old value of the changed cell by the new one in the order index. An index that does not hold
+// the old value has missed a change, so it is dropped and rebuilt by later reads.
+void RangeIndex::updateOrder(RangeNode& node, const CellChange& change) {
+    node.edited = true;
+    if (node.order && change.wasNumber && !node.order->erase(change.oldValue))
+        node.order.reset();
+    if (node.order && change.isNumber)
+        node.order->insert(change.newValue);
+}
+
+// Computes the statistics of the block, from the column indexes in O(log n) per column when available
+AggregateState RangeIndex::scan(const RangeNode& node, const ColumnStore& store) {
+    for (int c = node.col; c <= node.lastCol; c++)
+        if (!store.index(c))
+            return RangeKernels::accumulate(store, node.row, node.col, node.lastRow, node.lastCol);
+
+    AggregateState state;
+    for (int c = node.col; c <= node.lastCol; c++)
+        state.merge(store.index(c)->query(node.row, node.lastRow));
+    return state;
+}
+
+// Returns the number of nodes covering a column
+int RangeIndex::countOnColumn(int col) const {
+    return byColumn[col].size();
+}
+
+// Returns the node with the given id
+const RangeNode& RangeIndex::get(int id) const {
+    return nodes[id];
+}
+
+// Removes all nodes
+void RangeIndex::clear() {
+    nodes.clear();
+    ids.clear();
+    for (vector<int>& list : byColumn)
+        list.clear();
+}
+
+}
@@ -0,0 +1,114 @@
+#ifndef RANGE_INDEX_H
+#define RANGE_INDEX_H
+
+#include <vector>
+#include <map>
+#include <array>
+#include <unordered_set>
+#include <memory>
+#include "aggregateState.h"
+#include "columnStore.h"
+#include "orderIndex.h"
+
+using namespace std;
+
+namespace spreadsheet {
+    class Cell;
+
+    // A rectangular block of cells that one or more formulas read as a whole.
+    // The node also caches the statistics of the block, shared by every formula over it
+    // (one state serves SUM, AVER, MIN, MAX, STDDEV and COUNT alike).
+    struct RangeNode {
+        int row, col, lastRow, lastCol; // Zero based corners of the block
+        vector<Cell*> dependents;      // Formulas that read the block
+        unique_ptr<unordered_set<Cell*>> dependentSet; // The same formulas, once many read the block
+        utils::AggregateState state;    // Cached statistics of the block
+        bool valid = false;             // False until the block has been scanned
+        int updates = 0;                // Incremental updates since the last full scan
+        double scale = 0;               // Largest magnitude seen since the last full scan
+        unique_ptr<OrderIndex> order;   // Sorted numbers of the block, once order statistics reread it often
+        bool edited = true;             // Changed since the last order statistic read
+        int rereads = 0;                // Order statistic reads that found the block changed
+    };
+
+    // Dependency nodes for ranges. A formula over a block registers one node instead of one edge per cell;
+    // identical blocks share a node. Nodes are listed under every column they cover, so finding the ranges
+    // that contain a changed cell costs the number of ranges over its column, not the size of the ranges.
+    // The index is also the sheet-level cache of range statistics: a block is scanned once, then every
+    // change inside it updates the cached state once, however many formulas read it.
+    class RangeIndex {
+    public:
+        // Creates an index for a sheet with the given number of columns
+        RangeIndex(int cols);
+
+        // Returns the id of the node of the block, creating it if needed
+        int add(int row, int col, int lastRow, int lastCol);
+
+        // Registers a formula as a dependent of the node
+        void addDependent(int id, Cell* cell);
+
+        // Removes a formula from every node
+        void removeDependent(Cell* cell);
+
+        // Removes a set of formulas from every node in one pass
+        void removeDependents(const unordered_set<Cell*>& cells);
+
+        // Appends the dependents of every node that contains (row, col) to 'out'
+        void collect(int row, int col, vector<Cell*>& out) const;
+
+        // Updates the cached statistics of every node that contains the changed cell
+        // and appends the dependents of those nodes to 'out'
+        void applyChange(const CellChange& change, vector<Cell*>& out);
+
+        // Returns the statistics of the node, scanning the block if the cache is not valid.
+        // 'exactExtremes' asks for a rescan if a removed value may have been the minimum or maximum.
+        const utils::AggregateState& getState(int id, const ColumnStore& store, bool exactExtremes);
+
+        // Returns the order index of the node, or nullptr while order statistics can gather the block instead.
+        // Every call counts as a read; the index is built on the read that finds the block edited for the
+        // ORDER_INDEX_REREADS-th time, and then kept up to date by applyChange.
+        const OrderIndex* getOrder(int id, const ColumnStore& store);
+
+        // Returns the node with the given id
+        const RangeNode& get(int id) const;
+
+        // Returns the number of nodes covering a column
+        int countOnColumn(int col) const;
+
+        // Removes all nodes
+        void clear();
+
+    private:
+        // Full scans are forced after this many incremental updates to bound floating point drift
+        static const int MAX_INCREMENTAL_UPDATES = 1024;
+
+        // Nodes read by more formulas than this also keep them in a hash set, so that adding one does not
+        // scan the list (a fixed range filled down a column)
+        static const int DEPENDENT_SET_THRESHOLD = 32;
+
+        // Blocks edited and reread by order statistics this many times get an order index
+        static const int ORDER_INDEX_REREADS = 8;
+
+        // Smaller blocks are always gathered, which costs less than keeping an index
+        static const int ORDER_INDEX_CELLS = 4096;
+
+        // Rebuilds the hash set of the dependents of the node, or drops it when there are few of them
+        static void indexDependents(RangeNode& node);
+
+        // Removes the old value of the changed cell from the cached state and adds the new one.
+        // Returns false if the node must be rescanned.
+        static bool update(RangeNode& node, const CellChange& change);
+
+        // Replaces the old value of the changed cell by the new one in the order index of the node
+        static void updateOrder(RangeNode& node, const CellChange& change);
+
+        // Computes the statistics of the block, from the column indexes when every column has one
+        static utils::AggregateState scan(const RangeNode& node, const ColumnStore& store);
+
+        vector<RangeNode> nodes;                 // All nodes, indexed by id
+        map<array<int, 4>, int> ids;             // Block corners -> node id
+        vector<vector<int>> byColumn;            // Ids of the nodes covering each column
+    };
+}
+
+#endif
@@ -0,0 +1,462 @@
+#include "rangeKernels.h"
+#include "threadPool.h"
+#include <vector>
+#include <cstring>
+#include <cstdint>
+#include <limits>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace utils {
+
+#if defined(__AVX2__)
+// Expands 4 mask bytes into a 4 lane double mask (all bits set where the byte is non zero)
+static inline __m256d loadMask4(const unsigned char* mask) {
+    int32_t bytes;
+    memcpy(&bytes, mask, sizeof(bytes));
+    __m256i wide = _mm256_cvtepu8_epi64(_mm_cvtsi32_si128(bytes));
+    return _mm256_castsi256_pd(_mm256_cmpgt_epi64(wide, _mm256_setzero_si256()));
+}
+
+// Adds the 4 lanes of a vector together
+static inline double horizontalSum(__m256d v) {
+    __m128d pair = _mm_add_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1));
+    return _mm_cvtsd_f64(_mm_add_sd(pair, _mm_unpackhi_pd(pair, pair)));
+}
+#elif defined(__SSE2__)
+// Expands 2 mask bytes into a 2 lane double mask
+static inline __m128d loadMask2(const unsigned char* mask) {
+    return _mm_castsi128_pd(_mm_set_epi64x(mask[1] ? -1 : 0, mask[0] ? -1 : 0));
+}
+
+// Adds the 2 lanes of a vector together
+static inline double horizontalSum(__m128d v) {
+    return _mm_cvtsd_f64(_mm_add_sd(v, _mm_unpackhi_pd(v, v)));
+}
+#endif
+
+// Four selection bytes (0 or 1) for every 4 bit comparison mask, lowest lane first
+static const uint32_t laneBytes[16] = {
+    0x00000000, 0x00000001, 0x00000100, 0x00000101, 0x00010000, 0x00010001, 0x00010100, 0x00010101,
+    0x01000000, 0x01000001, 0x01000100, 0x01000101, 0x01010000, 0x01010001, 0x01010100, 0x01010101
+};
+
+// Scalar form of the comparisons, numbered as in compareSpan: 0 ==, 1 <, 2 <=, 3 >, 4 >=
+template <int P>
+static inline bool compareScalar(double x, double operand) {
+    if (P == 0) return x == operand;
+    if (P == 1) return x < operand;
+    if (P == 2) return x <= operand;
+    if (P == 3) return x > operand;
+    return x >= operand;
+}
+
+#if defined(__AVX2__)
+// Vector form of the comparisons, 4 lanes
+template <int P>
+static inline __m256d compareLanes(__m256d x, __m256d operand) {
+    if (P == 0) return _mm256_cmp_pd(x, operand, _CMP_EQ_OQ);
+    if (P == 1) return _mm256_cmp_pd(x, operand, _CMP_LT_OQ);
+    if (P == 2) return _mm256_cmp_pd(x, operand, _CMP_LE_OQ);
+    if (P == 3) return _mm256_cmp_pd(x, operand, _CMP_GT_OQ);
+    return _mm256_cmp_pd(x, operand, _CMP_GE_OQ);
+}
+#elif defined(__SSE2__)
+// Vector form of the comparisons, 2 lanes
+template <int P>
+static inline __m128d compareLanes(__m128d x, __m128d operand) {
+    if (P == 0) return _mm_cmpeq_pd(x, operand);
+    if (P == 1) return _mm_cmplt_pd(x, operand);
+    if (P == 2) return _mm_cmple_pd(x, operand);
+    if (P == 3) return _mm_cmpgt_pd(x, operand);
+    return _mm_cmpge_pd(x, operand);
+}
+#endif
+
+// Clears the selection of the entries that fail the comparison. The lanes of a vector comparison become
+// selection bytes through laneBytes, so the mask and the selection are combined 4 (or 2) bytes at a time.
+// 'negate' keeps the entries that fail instead (used for notEqual).
+template <int P>
+static void compareSpan(const double* values, const unsigned char* mask, int n, double operand, bool negate,
+                        unsigned char* selected) {
+    int i = 0;
+#if defined(__AVX2__)
+    __m256d o = _mm256_set1_pd(operand);
+    for (; i + 4 <= n; i += 4) {
+        uint32_t hit = laneBytes[_mm256_movemask_pd(compareLanes<P>(_mm256_loadu_pd(values + i), o))];
+        uint32_t valid, keep;
+        memcpy(&valid, mask + i, sizeof(valid));
+        memcpy(&keep, selected + i, sizeof(keep));
+        hit &= valid;
+        keep &= negate ? ~hit : hit;
+        memcpy(selected + i, &keep, sizeof(keep));
+    }
+#elif defined(__SSE2__)
+    __m128d o = _mm_set1_pd(operand);
+    for (; i + 2 <= n; i += 2) {
+        uint16_t hit = (uint16_t)laneBytes[_mm_movemask_pd(compareLanes<P>(_mm_loadu_pd(values + i), o))];
+        uint16_t valid, keep;
+        memcpy(&valid, mask + i, sizeof(valid));
+        memcpy(&keep, selected + i, sizeof(keep));
+        hit &= valid;
+        keep &= negate ? ~hit : hit;
+        memcpy(selected + i, &keep, sizeof(keep));
+    }
+#endif
+    for (; i < n; i++) {
+        bool hit = mask[i] && compareScalar<P>(values[i], operand);
+        selected[i] &= (negate ? !hit : hit);
+    }
+}
+
+// Predicate mask of a numeric criterion
+void RangeKernels::compare(const double* values, const unsigned char* mask, int n, CompareOp op, double operand,
+                           unsigned char* selected) {
+    switch (op) {
+        case CompareOp::equal:        compareSpan<0>(values, mask, n, operand, false, selected); break;
+        case CompareOp::notEqual:     compareSpan<0>(values, mask, n, operand, true, selected); break;
+        case CompareOp::less:         compareSpan<1>(values, mask, n, operand, false, selected); break;
+        case CompareOp::lessEqual:    compareSpan<2>(values, mask, n, operand, false, selected); break;
+        case CompareOp::greater:      compareSpan<3>(values, mask, n, operand, false, selected); break;
+        case CompareOp::greaterEqual: compareSpan<4>(values, mask, n, operand, false, selected); break;
+    }
+}
+
+// Predicate mask of a text criterion, comparing interned ids 8 (or 4) at a time
+void RangeKernels::matchIds(const int* ids, int n, int id, bool equal, unsigned char* selected) {
+    int i = 0;
+#if defined(__AVX2__)
+    __m256i key = _mm256_set1_epi32(id);
+    for (; i + 8 <= n; i += 8) {
+        __m256i same = _mm256_cmpeq_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(ids + i)), key);
+        int bits = _mm256_movemask_ps(_mm256_castsi256_ps(same));
+        uint64_t hit = laneBytes[bits & 15] | (uint64_t)laneBytes[bits >> 4] << 32;
+        uint64_t keep;
+        memcpy(&keep, selected + i, sizeof(keep));
+        keep &= equal ? hit : ~hit;
+        memcpy(selected + i, &keep, sizeof(keep));
+    }
+#elif defined(__SSE2__)
+    __m128i key = _mm_set1_epi32(id);
+    for (; i + 4 <= n; i += 4) {
+        __m128i same = _mm_cmpeq_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(ids + i)), key);
+        uint32_t hit = laneBytes[_mm_movemask_ps(_mm_castsi128_ps(same))];
+        uint32_t keep;
+        memcpy(&keep, selected + i, sizeof(keep));
+        keep &= equal ? hit : ~hit;
+        memcpy(selected + i, &keep, sizeof(keep));
+    }
+#endif
+    for (; i < n; i++)
+        selected[i] &= ((ids[i] == id) == equal);
+}
+
+// Sum of the selected entries, the selection bytes are widened to lane masks
+double RangeKernels::maskedSum(const double* values, const unsigned char* selected, int n) {
+    int i = 0;
+    double result = 0.0;
+#if defined(__AVX2__)
+    __m256d acc = _mm256_setzero_pd();
+    for (; i + 4 <= n; i += 4)
+        acc = _mm256_add_pd(acc, _mm256_and_pd(loadMask4(selected + i), _mm256_loadu_pd(values + i)));
+    result = horizontalSum(acc);
+#elif defined(__SSE2__)
+    __m128d acc = _mm_setzero_pd();
+    for (; i + 2 <= n; i += 2)
+        acc = _mm_add_pd(acc, _mm_and_pd(loadMask2(selected + i), _mm_loadu_pd(values + i)));
+    result = horizontalSum(acc);
+#endif
+    for (; i < n; i++)
+        if (selected[i])
+            result += values[i];
+    return result;
+}
+
+// Numeric entries of the span. Every entry is written and the output position only advances past numbers,
+// so the loop has no branch to mispredict on mixed spans.
+int RangeKernels::gather(const double* values, const unsigned char* mask, int n, double* out) {
+    int count = 0;
+    for (int i = 0; i < n; i++) {
+        out[count] = values[i];
+        count += mask[i];
+    }
+    return count;
+}
+
+// Sum of the span, four independent accumulators keep the adders busy
+double RangeKernels::sum(const double* values, int n) {
+    int i = 0;
+    double result = 0.0;
+#if defined(__AVX2__)
+    __m256d a0 = _mm256_setzero_pd(), a1 = _mm256_setzero_pd();
+    __m256d a2 = _mm256_setzero_pd(), a3 = _mm256_setzero_pd();
+    for (; i + 16 <= n; i += 16) {
+        a0 = _mm256_add_pd(a0, _mm256_loadu_pd(values + i));
+        a1 = _mm256_add_pd(a1, _mm256_loadu_pd(values + i + 4));
+        a2 = _mm256_add_pd(a2, _mm256_loadu_pd(values + i + 8));
+        a3 = _mm256_add_pd(a3, _mm256_loadu_pd(values + i + 12));
+    }
+    for (; i + 4 <= n; i += 4)
+        a0 = _mm256_add_pd(a0, _mm256_loadu_pd(values + i));
+    result = horizontalSum(_mm256_add_pd(_mm256_add_pd(a0, a1), _mm256_add_pd(a2, a3)));
+#elif defined(__SSE2__)
+    __m128d a0 = _mm_setzero_pd(), a1 = _mm_setzero_pd();
+    __m128d a2 = _mm_setzero_pd(), a3 = _mm_setzero_pd();
+    for (; i + 8 <= n; i += 8) {
+        a0 = _mm_add_pd(a0, _mm_loadu_pd(values + i));
+        a1 = _mm_add_pd(a1, _mm_loadu_pd(values + i + 2));
+        a2 = _mm_add_pd(a2, _mm_loadu_pd(values + i + 4));
+        a3 = _mm_add_pd(a3, _mm_loadu_pd(values + i + 6));
+    }
+    for (; i + 2 <= n; i += 2)
+        a0 = _mm_add_pd(a0, _mm_loadu_pd(values + i));
+    result = horizontalSum(_mm_add_pd(_mm_add_pd(a0, a1), _mm_add_pd(a2, a3)));
+#endif
+    for (; i < n; i++)
+        result += values[i];
+    return result;
+}
+
+// Number of numeric entries, the mask bytes are 0 or 1 so summing them counts
+int RangeKernels::count(const unsigned char* mask, int n) {
+    int i = 0;
+    long long result = 0;
+#if defined(__AVX2__)
+    __m256i acc = _mm256_setzero_si256();
+    for (; i + 32 <= n; i += 32) {
+        __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(mask + i));
+        acc = _mm256_add_epi64(acc, _mm256_sad_epu8(bytes, _mm256_setzero_si256()));
+    }
+    long long lanes[4];
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), acc);
+    result = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#elif defined(__SSE2__)
+    __m128i acc = _mm_setzero_si128();
+    for (; i + 16 <= n; i += 16) {
+        __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(mask + i));
+        acc = _mm_add_epi64(acc, _mm_sad_epu8(bytes, _mm_setzero_si128()));
+    }
+    long long lanes[2];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), acc);
+    result = lanes[0] + lanes[1];
+#endif
+    for (; i < n; i++)
+        result += mask[i];
+    return result;
+}
+
+// Smallest numeric entry, masked entries are replaced by +infinity before comparing
+double RangeKernels::min(const double* values, const unsigned char* mask, int n) {
+    const double inf = numeric_limits<double>::infinity();
+    int i = 0;
+    double result = inf;
+#if defined(__AVX2__)
+    __m256d acc = _mm256_set1_pd(inf);
+    for (; i + 4 <= n; i += 4) {
+        __m256d v = _mm256_blendv_pd(_mm256_set1_pd(inf), _mm256_loadu_pd(values + i), loadMask4(mask + i));
+        acc = _mm256_min_pd(acc, v);
+    }
+    double lanes[4];
+    _mm256_storeu_pd(lanes, acc);
+    for (double x : lanes)
+        result = (x < result) ? x : result;
+#elif defined(__SSE2__)
+    __m128d acc = _mm_set1_pd(inf);
+    for (; i + 2 <= n; i += 2) {
+        __m128d m = loadMask2(mask + i);
+        __m128d v = _mm_or_pd(_mm_and_pd(m, _mm_loadu_pd(values + i)), _mm_andnot_pd(m, _mm_set1_pd(inf)));
+        acc = _mm_min_pd(acc, v);
+    }
+    double lanes[2];
+    _mm_storeu_pd(lanes, acc);
+    result = (lanes[0] < lanes[1]) ? lanes[0] : lanes[1];
+#endif
+    for (; i < n; i++)
+        if (mask[i] && values[i] < result)
+            result = values[i];
+    return result;
+}
+
+// Largest numeric entry, masked entries are replaced by -infinity before comparing
+double RangeKernels::max(const double* values, const unsigned char* mask, int n) {
+    const double inf = numeric_limits<double>::infinity();
+    int i = 0;
+    double result = -inf;
+#if defined(__AVX2__)
+    __m256d acc = _mm256_set1_pd(-inf);
+    for (; i + 4 <= n; i += 4) {
+        __m256d v = _mm256_blendv_pd(_mm256_set1_pd(-inf), _mm256_loadu_pd(values + i), loadMask4(mask + i));
+        acc = _mm256_max_pd(acc, v);
+    }
+    double lanes[4];
+    _mm256_storeu_pd(lanes, acc);
+    for (double x : lanes)
+        result = (x > result) ? x : result;
+#elif defined(__SSE2__)
+    __m128d acc = _mm_set1_pd(-inf);
+    for (; i + 2 <= n; i += 2) {
+        __m128d m = loadMask2(mask + i);
+        __m128d v = _mm_or_pd(_mm_and_pd(m, _mm_loadu_pd(values + i)), _mm_andnot_pd(m, _mm_set1_pd(-inf)));
+        acc = _mm_max_pd(acc, v);
+    }
+    double lanes[2];
+    _mm_storeu_pd(lanes, acc);
+    result = (lanes[0] > lanes[1]) ? lanes[0] : lanes[1];
+#endif
+    for (; i < n; i++)
+        if (mask[i] && values[i] > result)
+            result = values[i];
+    return result;
+}
+
+// Sum of squared deviations from the mean, masked entries contribute 0
+double RangeKernels::squaredDeviations(const double* values, const unsigned char* mask, int n, double mean) {
+    int i = 0;
+    double result = 0.0;
+#if defined(__AVX2__)
+    __m256d acc = _mm256_setzero_pd(), m = _mm256_set1_pd(mean);
+    for (; i + 4 <= n; i += 4) {
+        __m256d d = _mm256_sub_pd(_mm256_loadu_pd(values + i), m);
+        acc = _mm256_add_pd(acc, _mm256_and_pd(loadMask4(mask + i), _mm256_mul_pd(d, d)));
+    }
+    result = horizontalSum(acc);
+#elif defined(__SSE2__)
+    __m128d acc = _mm_setzero_pd(), m = _mm_set1_pd(mean);
+    for (; i + 2 <= n; i += 2) {
+        __m128d d = _mm_sub_pd(_mm_loadu_pd(values + i), m);
+        acc = _mm_add_pd(acc, _mm_and_pd(loadMask2(mask + i), _mm_mul_pd(d, d)));
+    }
+    result = horizontalSum(acc);
+#endif
+    for (; i < n; i++)
+        if (mask[i])
+            result += (values[i] - mean) * (values[i] - mean);
+    return result;
+}
+
+// Element-wise operation over a span. OP is the ElementOp; A and B are set for operands spread over the span.
+template <int OP, bool A, bool B>
+static int elementwiseSpan(const double* a, const double* b, double* out, int n) {
+    int i = 0, zeros = 0;
+#if defined(__AVX2__)
+    __m256d spreadA = _mm256_set1_pd(a[0]), spreadB = _mm256_set1_pd(b[0]), zero = _mm256_setzero_pd();
+    for (; i + 4 <= n; i += 4) {
+        __m256d x = A ? spreadA : _mm256_loadu_pd(a + i);
+        __m256d y = B ? spreadB : _mm256_loadu_pd(b + i);
+        __m256d r;
+        if (OP == 0) r = _mm256_add_pd(x, y);
+        else if (OP == 1) r = _mm256_sub_pd(x, y);
+        else if (OP == 2) r = _mm256_mul_pd(x, y);
+        else {
+            r = _mm256_div_pd(x, y);
+            zeros += __builtin_popcount(_mm256_movemask_pd(_mm256_cmp_pd(y, zero, _CMP_EQ_OQ)));
+        }
+        _mm256_storeu_pd(out + i, r);
+    }
+#elif defined(__SSE2__)
+    __m128d spreadA = _mm_set1_pd(a[0]), spreadB = _mm_set1_pd(b[0]), zero = _mm_setzero_pd();
+    for (; i + 2 <= n; i += 2) {
+        __m128d x = A ? spreadA : _mm_loadu_pd(a + i);
+        __m128d y = B ? spreadB : _mm_loadu_pd(b + i);
+        __m128d r;
+        if (OP == 0) r = _mm_add_pd(x, y);
+        else if (OP == 1) r = _mm_sub_pd(x, y);
+        else if (OP == 2) r = _mm_mul_pd(x, y);
+        else {
+            r = _mm_div_pd(x, y);
+            zeros += __builtin_popcount(_mm_movemask_pd(_mm_cmpeq_pd(y, zero)));
+        }
+        _mm_storeu_pd(out + i, r);
+    }
+#endif
+    for (; i < n; i++) {
+        double x = A ? a[0] : a[i], y = B ? b[0] : b[i];
+        if (OP == 0) out[i] = x + y;
+        else if (OP == 1) out[i] = x - y;
+        else if (OP == 2) out[i] = x * y;
+        else {
+            zeros += (y == 0);
+            out[i] = x / y;
+        }
+    }
+    return zeros;
+}
+
+// Picks the instantiation for the operand layout
+template <int OP>
+static int elementwiseLayout(const double* a, bool spreadA, const double* b, bool spreadB, double* out, int n) {
+    if (spreadA && spreadB)
+        return elementwiseSpan<OP, true, true>(a, b, out, n);
+    if (spreadA)
+        return elementwiseSpan<OP, true, false>(a, b, out, n);
+    if (spreadB)
+        return elementwiseSpan<OP, false, true>(a, b, out, n);
+    return elementwiseSpan<OP, false, false>(a, b, out, n);
+}
+
+// Element-wise a op b over a span
+int RangeKernels::elementwise(ElementOp op, const double* a, bool spreadA, const double* b, bool spreadB, double* out, int n) {
+    switch (op) {
+        case ElementOp::add:
+            return elementwiseLayout<0>(a, spreadA, b, spreadB, out, n);
+        case ElementOp::subtract:
+            return elementwiseLayout<1>(a, spreadA, b, spreadB, out, n);
+        case ElementOp::multiply:
+            return elementwiseLayout<2>(a, spreadA, b, spreadB, out, n);
+        default:
+            return elementwiseLayout<3>(a, spreadA, b, spreadB, out, n);
+    }
+}
+
+// All statistics of a span, one cache sized chunk at a time
+AggregateState RangeKernels::accumulate(const double* values, const unsigned char* mask, int n) {
+    AggregateState state;
+    for (int start = 0; start < n; start += CHUNK_SIZE) {
+        int size = (n - start < CHUNK_SIZE) ? n - start : CHUNK_SIZE;
+        const double* v = values + start;
+        const unsigned char* m = mask + start;
+
+        int count = RangeKernels::count(m, size);
+        if (count == 0)
+            continue;
+        double sum = RangeKernels::sum(v, size);
+        double m2 = squaredDeviations(v, m, size, sum / count);
+        state.merge(AggregateState::fromMoments(count, sum, RangeKernels::min(v, m, size), RangeKernels::max(v, m, size), m2));
+    }
+    return state;
+}
+
+// Statistics of a block of the store, reduced in parallel when the block is large
+AggregateState RangeKernels::accumulate(const spreadsheet::ColumnStore& store, int row, int col, int lastRow, int lastCol) {
+    int rows = lastRow - row + 1;
+    long long cells = (long long)rows * (lastCol - col + 1);
+    AggregateState state;
+
+    if (cells < PARALLEL_THRESHOLD) {
+        for (int c = col; c <= lastCol; c++)
+            state.merge(accumulate(store.values(c, row), store.mask(c, row), rows));
+        return state;
+    }
+
+    // Fixed chunks of every column span, independent of the number of threads
+    int chunksPerColumn = (rows + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    int chunks = chunksPerColumn * (lastCol - col + 1);
+    vector<AggregateState> partial(chunks);
+
+    ThreadPool::instance().parallelFor(chunks, [&](int index) {
+        int c = col + index / chunksPerColumn;
+        int start = row + (index % chunksPerColumn) * CHUNK_SIZE;
+        int size = (lastRow + 1 - start < CHUNK_SIZE) ? lastRow + 1 - start : CHUNK_SIZE;
+        partial[index] = accumulate(store.values(c, start), store.mask(c, start), size);
+    });
+
+    for (const AggregateState& part : partial)
+        state.merge(part);
+    return state;
+}
+
+}
@@ -0,0 +1,88 @@
+#ifndef RANGE_KERNELS_H
+#define RANGE_KERNELS_H
+
+#include "aggregateState.h"
+#include "columnStore.h"
+
+using namespace std;
+
+namespace utils {
+
+// Comparison of the conditional kernels
+enum class CompareOp : unsigned char {
+    equal,
+    notEqual,
+    less,
+    lessEqual,
+    greater,
+    greaterEqual
+};
+
+// Operation of the element-wise kernel
+enum class ElementOp : unsigned char {
+    add,
+    subtract,
+    multiply,
+    divide
+};
+
+// Aggregate kernels over a contiguous column span (see ColumnStore).
+// 'values' holds the numbers of the span and 'mask' marks which entries are numeric (1) or empty/string (0);
+// entries with mask 0 are expected to hold 0.
+// The kernels use AVX2 when the compiler targets it (-mavx2 / -march=native), SSE2 otherwise,
+// and a scalar loop for the tail of the span or on other architectures.
+class RangeKernels {
+public:
+    // Sum of the span. Masked entries are 0, so no mask is needed.
+    static double sum(const double* values, int n);
+
+    // Number of numeric entries in the span
+    static int count(const unsigned char* mask, int n);
+
+    // Smallest numeric entry, +infinity if there is none
+    static double min(const double* values, const unsigned char* mask, int n);
+
+    // Largest numeric entry, -infinity if there is none
+    static double max(const double* values, const unsigned char* mask, int n);
+
+    // Sum of (x - mean)^2 over the numeric entries
+    static double squaredDeviations(const double* values, const unsigned char* mask, int n, double mean);
+
+    // Predicate mask of a conditional function: clears the entries of 'selected' (0 or 1 per entry) whose value does
+    // not compare to the operand as 'op' asks. Non numeric entries never match, except for CompareOp::notEqual.
+    static void compare(const double* values, const unsigned char* mask, int n, CompareOp op, double operand,
+                        unsigned char* selected);
+
+    // Clears the entries of 'selected' whose id differs from 'id' (or equals it when 'equal' is false)
+    static void matchIds(const int* ids, int n, int id, bool equal, unsigned char* selected);
+
+    // Sum of the entries whose byte in 'selected' is 1
+    static double maskedSum(const double* values, const unsigned char* selected, int n);
+
+    // Copies the numeric entries of the span to 'out', in order, and returns how many there are.
+    // 'out' must have room for n entries.
+    static int gather(const double* values, const unsigned char* mask, int n, double* out);
+
+    // Element-wise a op b over a span, written into 'out' (which may be 'a' or 'b'). An operand whose 'spread' flag
+    // is set is a single value used for every entry. Returns the number of zero divisors (always 0 unless dividing);
+    // their entries are left as IEEE division makes them, for the caller to replace by an error value.
+    static int elementwise(ElementOp op, const double* a, bool spreadA, const double* b, bool spreadB, double* out, int n);
+
+    // All statistics of a span in one pass over memory. The span is processed in cache sized chunks:
+    // count, sum and extremes are computed first, then M2 around the chunk mean while the chunk is still
+    // in cache, and the chunk states are merged in order.
+    static AggregateState accumulate(const double* values, const unsigned char* mask, int n);
+
+    // Statistics of the block rows row..lastRow x columns col..lastCol of the store.
+    // Large blocks are cut into fixed chunks that are reduced on the thread pool; the partial states are
+    // merged in chunk order, so the result does not depend on the number of threads.
+    static AggregateState accumulate(const spreadsheet::ColumnStore& store, int row, int col, int lastRow, int lastCol);
+
+private:
+    static const int CHUNK_SIZE = 2048;         // Values per chunk (16 KB, fits the L1 cache)
+    static const int PARALLEL_THRESHOLD = 65536; // Blocks smaller than this are reduced on the calling thread
+};
+
+}
+
+#endif
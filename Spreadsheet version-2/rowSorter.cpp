@@ -0,0 +1,100 @@
+#include "rowSorter.h"
+#include "spreadSheet.h"
+#include "threadPool.h"
+#include <algorithm>
+#include <numeric>
+#include <cctype>
+
+using namespace utils;
+
+namespace spreadsheet {
+
+// Sorts a permutation of the rows. Small blocks use one stable sort; large blocks are cut into one part per
+// thread, the parts are sorted on the thread pool and then merged pairwise, each round of merges in parallel.
+// Stable sorts and stable merges give the same order whatever the number of threads.
+vector<int> RowSorter::order(SpreadSheet& table, int row, int lastRow, const vector<SortKey>& keys) {
+    int rows = lastRow - row + 1;
+    ThreadPool& pool = ThreadPool::instance();
+    int parts = (rows < PARALLEL_THRESHOLD) ? 1 : pool.size();
+    int partSize = (rows + parts - 1) / parts;
+
+    // Keys are read once, column by column, so comparisons never call into the cells
+    vector<vector<Entry>> entries(keys.size(), vector<Entry>(rows));
+    pool.parallelFor(parts, [&](int part) {
+        int end = min(rows, (part + 1) * partSize);
+        for (size_t k = 0; k < keys.size(); k++)
+            for (int i = part * partSize; i < end; i++)
+                entries[k][i] = keyOf(table.getCell(row + i, keys[k].col));
+    });
+
+    vector<int> order(rows);
+    iota(order.begin(), order.end(), 0);
+    auto less = [&](int a, int b) { return compare(entries, keys, a, b) < 0; };
+
+    pool.parallelFor(parts, [&](int part) {
+        int begin = min(rows, part * partSize), end = min(rows, (part + 1) * partSize);
+        stable_sort(order.begin() + begin, order.begin() + end, less);
+    });
+
+    vector<int> merged(rows);
+    for (int width = partSize; width < rows; width *= 2) {
+        int pairs = (rows + 2 * width - 1) / (2 * width);
+        pool.parallelFor(pairs, [&](int pair) {
+            int begin = pair * 2 * width;
+            int middle = min(rows, begin + width), end = min(rows, begin + 2 * width);
+            merge(order.begin() + begin, order.begin() + middle, order.begin() + middle, order.begin() + end,
+                  merged.begin() + begin, less);
+        });
+        order.swap(merged);
+    }
+
+    for (int& r : order)
+        r += row;
+    return order;
+}
+
+// Reads the key of a cell
+RowSorter::Entry RowSorter::keyOf(const Cell* cell) {
+    Entry entry = {3, 0.0, ""};
+    Type type = cell->getType();
+    if (cell->getError() != ErrorCode::none)
+        entry.kind = 2;
+    else if (type == Type::value || type == Type::formula || type == Type::spill) {
+        entry.kind = 0;
+        entry.number = cell->getNumber();
+    }
+    else if (type == Type::string) {
+        entry.kind = 1;
+        entry.text = cell->getValue();
+        for (char& ch : entry.text)
+            ch = tolower((unsigned char)ch);
+    }
+    return entry;
+}
+
+// Compares two rows key by key. A descending key reverses the order of its values, but empty cells stay last.
+int RowSorter::compare(const vector<vector<Entry>>& entries, const vector<SortKey>& keys, int a, int b) {
+    for (size_t k = 0; k < keys.size(); k++) {
+        const Entry& x = entries[k][a];
+        const Entry& y = entries[k][b];
+        if (x.kind == 3 || y.kind == 3) {
+            if (x.kind != y.kind)
+                return x.kind == 3 ? 1 : -1;
+            continue;
+        }
+
+        int result = 0;
+        if (x.kind != y.kind)
+            result = (x.kind < y.kind) ? -1 : 1;
+        else if (x.kind == 0)
+            result = (x.number < y.number) ? -1 : (x.number > y.number ? 1 : 0);
+        else if (x.kind == 1)
+            result = x.text.compare(y.text);
+
+        if (result != 0)
+            return keys[k].descending ? -result : result;
+    }
+    return 0;
+}
+
+}
@@ -0,0 +1,48 @@
+#ifndef ROW_SORTER_H
+#define ROW_SORTER_H
+
+#include <string>
+#include <vector>
+#include "cell.h"
+
+using namespace std;
+
+namespace spreadsheet {
+
+// Key column of the sort command
+struct SortKey {
+    int col;         // Zero based column of the key
+    bool descending; // Largest first instead of smallest first
+};
+
+// Computes the order of the rows of a block for the sort command.
+// The keys of every row are read once into flat arrays; then a permutation of row indexes is sorted,
+// so the cells themselves are moved only once, after the order is known.
+// Numbers come before texts (compared without case), then error values; empty cells are always last.
+// The sort is stable: rows with equal keys keep their order.
+class RowSorter {
+public:
+    // Returns the rows row..lastRow of the sheet in sorted order, as zero based row numbers
+    static vector<int> order(SpreadSheet& table, int row, int lastRow, const vector<SortKey>& keys);
+
+private:
+    // Key of one row in one key column
+    struct Entry {
+        unsigned char kind; // 0 number, 1 text, 2 error value, 3 empty
+        double number;      // Value of a number
+        string text;        // Lower case text of a text cell
+    };
+
+    // Reads the key of a cell
+    static Entry keyOf(const Cell* cell);
+
+    // Compares the keys of two rows (offsets into the block): negative, zero or positive
+    static int compare(const vector<vector<Entry>>& entries, const vector<SortKey>& keys, int a, int b);
+
+    // Blocks with fewer rows than this are sorted on the calling thread
+    static const int PARALLEL_THRESHOLD = 1 << 14;
+};
+
+}
+
+#endif
@@ -1,16 +1,25 @@
 #include "spreadSheet.h"
-
+#include "formulaParser.h"
+#include "stringPool.h"
+#include "functionRegistry.h"
+#include "windowKernels.h"
+#include "workbook.h"
+#include "cellAddress.h"
 
 #include <iostream>
 #include <string>
 #include <iomanip>
+#include <algorithm>
+#include <unordered_set>
+#include <unordered_map>
+#include <tuple>
 
 using namespace utils;
 
 namespace spreadsheet{
 
 // Constructor to initialize a spreadsheet with given columns and rows
-SpreadSheet::SpreadSheet(int cols, int rows) : grid(rows, Container<shared_ptr<Cell>>(cols)), colsLabel(cols, ""), rowsLabel(rows) {
+SpreadSheet::SpreadSheet(int cols, int rows) : colsLabel(cols, ""), rowsLabel(rows), grid(rows, Container<shared_ptr<Cell>>(cols)), store(rows, cols), ranges(cols), lookups(rows, cols) {
     // Set positions for each cell in the grid
     initCols();  // Initialize column labels
     initRows();  // Initialize row labels
@@ -19,6 +28,7 @@ SpreadSheet::SpreadSheet(int cols, int rows) : grid(rows, Container<shared_ptr<C
         for (int j = 0; j < cols; j++) {
          
            grid[i][j]=make_shared<EmptyValueCell>();
+           grid[i][j]->setPosition(i + 4, j * CELL_SIZE + 4);
         }
     }
 }
@@ -34,10 +44,9 @@ void SpreadSheet::initLabels(int x,int y) {
     cout << "\033[7m" << "   " << "\033[0m" << std::flush;
     int size= (colsLabel.size()>SPRERAD_COL_SIZE) ? SPRERAD_COL_SIZE : colsLabel.size();
     for (int i=x;i<size+x;i++) {
-        if (colsLabel[i].size() == 1)
-            cout << "\033[7m" << "   " << colsLabel[i] << "   " << "\033[0m" << std::flush;
-        else if (colsLabel[i].size() == 2)
-            cout << "\033[7m" << "   " << colsLabel[i] << "  " << "\033[0m" << std::flush;
+        // The label is padded to the cell width (labels have up to three letters up to XFD)
+        string padding(max(0, CELL_SIZE - 3 - (int)colsLabel[i].size()), ' ');
+        cout << "\033[7m" << "   " << colsLabel[i] << padding << "\033[0m" << std::flush;
     }
     cout << endl;
     int size2 =(rowsLabel.size()>SPRERAD_ROW_SIZE) ? SPRERAD_ROW_SIZE : rowsLabel.size();
@@ -57,43 +66,35 @@ void SpreadSheet::initRows() {
     }
 }
 
-// Function to initialize column labels (e.g., A, B, C, ... Z, AA, AB, etc.)
+// Function to initialize column labels (e.g., A, B, C, ... Z, AA, AB, ... XFD) from the shared label table
 void SpreadSheet::initCols() {
-    char ch;
-    for (int i = 0, ch = 'A'; i < colsLabel.size(); i++, ch++) {
-        // Handle cases where column index exceeds 26 (e.g., AA, AB, etc.)
-        if ((i / 26) != 0)
-            colsLabel[i] += (i / 26) + 'A' - 1;
-
-        if (i % 26 == 0)
-            ch = 'A';
-        
-        colsLabel[i] += ch;  // Add the character label for the column
-    }
+    for (int i = 0; i < colsLabel.size(); i++)
+        colsLabel[i] = CellAddress::columnLabel(i);
 }
 
 // Function to display information about a specific cell (row, col) in a formatted way
 void SpreadSheet::infoCell(int row, int col, int firstR) const {
     string empty(50, ' ');  // Create an empty string for clearing previous outputs
-    string temp = "";
+    string temp = CellAddress::toString(row, col);  // The cell reference (e.g., A1, AB12, XFD1048576)
 
-    // Calculate the column label (e.g., A, B, C, ..., Z, AA, AB, etc.)
-    if ((col / 26) != 0)
-        temp += (col / 26 - 1) + 'A';
-    temp += (col % 26) + 'A';
+    // The content starts at column 6, or after a reference too long for it
+    int text = max(6, (int)temp.size() + 2);
 
     // Print row and column info with formatting and clearing old data
     cout << "\033[" << 1 << ";" << 1 << "H" << empty<< std::flush;;
-    cout << "\033[" << 1 << ";" << 6 << "H" << empty<< std::flush;;
+    cout << "\033[" << 1 << ";" << text << "H" << empty<< std::flush;;
     cout << "\033[" << 1 << ";" << 1 << "H" << temp<< std::flush;
-    cout << "\033[" << 1 << ";" << 2 + col / 26 << "H" << row + 1<< std::flush;
 
     // Check if the cell contains a formula or a regular value, and print accordingly
-    if (grid[row][col]->getType() == Type::formula)
-        cout << "\033[" << 1 << ";" << 6 << "H" << grid[row][col]->getContent() << "    "
+    bool evaluated = grid[row][col]->getType() == Type::formula || grid[row][col]->getType() == Type::spill;
+    if (evaluated && grid[row][col]->getError() != ErrorCode::none)
+        cout << "\033[" << 1 << ";" << text << "H" << grid[row][col]->getContent() << "    "
+             << grid[row][col]->getValue() << std::flush;
+    else if (evaluated)
+        cout << "\033[" << 1 << ";" << text << "H" << grid[row][col]->getContent() << "    "
              << fixed << setprecision(2) << stod(grid[row][col]->getValue())<< std::flush;
     else
-        cout << "\033[" << 1 << ";" << 6 << "H" << grid[row][col]->getContent()<< std::flush;
+        cout << "\033[" << 1 << ";" << text << "H" << grid[row][col]->getContent()<< std::flush;
 
     // Move the cursor back to the cell position
     cout << "\033[" << row + firstR << ";" << col *  CELL_SIZE + 4 << "H" << std::flush;
@@ -135,6 +136,14 @@ shared_ptr<Cell>& SpreadSheet::getCell(int row, int col,int a) {
 
 void SpreadSheet::setContent(int row, int col, const string& str) {
 
+    // A cell of the result of an array formula cannot be cleared, and anything entered into it blocks the formula
+    if (grid[row][col]->getType() == Type::spill && str.empty())
+        return;
+    vector<Cell*> released;
+    releaseSpill(row, col, released);
+    if (!released.empty())
+        recalculate(released, false);
+
     // If the current cell is of type formula, remove its dependencies from all other cells.
     if (grid[row][col]->getType() == Type::formula) {
         for (int i = 0; i < getNumRows(); i++) {
@@ -142,57 +151,1097 @@ void SpreadSheet::setContent(int row, int col, const string& str) {
                 grid[i][j]->remove(grid[row][col].get()); // Remove dependency.
             }
         }
+        ranges.removeDependent(grid[row][col].get());
+        names.removeDependent(grid[row][col].get());
+        removeSheetDependents({grid[row][col].get()});
     }
 
+    // Create the cell for the new content and transfer the dependencies of the old cell.
+    shared_ptr<Cell> ptr = makeCell(str);
+    ptr->setDependents(grid[row][col]->getDependents()); // Set dependents from the previous cell.
+    grid[row][col] = ptr; // Assign the new cell to the grid.
+    ptr->setPosition(row + 4, col * CELL_SIZE + 4); // Update its position.
+    ptr->setContent(str, *this); // Set its content and notify the dependents.
+
+    if (str.empty() && !blockedSpills.empty())
+        retrySpills(row, col);
+}
+
+// Creates an empty cell of the type that holds the given content
+shared_ptr<Cell> SpreadSheet::makeCell(const string& str) {
     // Check if the new content is empty.
-    if (str.empty()) {
-        // Create an EmptyValueCell and transfer the dependencies of the old cell.
-        shared_ptr<Cell> ptr = make_shared<EmptyValueCell>();
-        ptr->setDependents(grid[row][col]->getDependents()); // Set dependents from the previous cell.
-        grid[row][col] = ptr; // Assign the new cell to the grid.
-        ptr->setPosition(row + 4, col * CELL_SIZE + 4); // Update its position.
-        ptr->setContent(str, *this); // Set its content as an empty string.
-    }
+    if (str.empty())
+        return make_shared<EmptyValueCell>();
     // Check if the new content is a formula (starts with '=' or '@').
-    else if (str[0] == '=' || str[0] == '@') {
-        // Create a FormulaCell and transfer dependencies.
-        shared_ptr<Cell> ptr = make_shared<FormulaCell>();
-        ptr->setDependents(grid[row][col]->getDependents());
-        grid[row][col] = ptr;
-        ptr->setPosition(row + 4, col * CELL_SIZE + 4);
-        ptr->setContent(str, *this);
-    }
+    if (str[0] == '=' || str[0] == '@')
+        return make_shared<FormulaCell>();
     // Check if the new content is a double value (contains digits or '-' and has a decimal point).
-    else if ((isdigit(str[0]) || str[0] == '-') && (str.find('.') != std::string::npos)) {
-        // Create a DoubleValueCell and transfer dependencies.
-        shared_ptr<Cell> ptr = make_shared<DoubleValueCell>();
-        ptr->setDependents(grid[row][col]->getDependents());
-        grid[row][col] = ptr;
-        ptr->setPosition(row + 4, col * CELL_SIZE + 4);
-        ptr->setContent(str, *this);
-    }
+    if ((isdigit(str[0]) || str[0] == '-') && (str.find('.') != std::string::npos))
+        return make_shared<DoubleValueCell>();
     // Check if the new content is an integer value (contains digits or '-').
-    else if ((isdigit(str[0]) || str[0] == '-')) {
-        // Create an IntValueCell and transfer dependencies.
-        shared_ptr<Cell> ptr = make_shared<IntValueCell>();
-        ptr->setDependents(grid[row][col]->getDependents());
-        grid[row][col] = ptr;
-        ptr->setPosition(row + 4, col * CELL_SIZE + 4);
-        ptr->setContent(str, *this);
-    }
+    if (isdigit(str[0]) || str[0] == '-')
+        return make_shared<IntValueCell>();
     // Otherwise, treat the new content as a string value.
-    else if (!str.empty()) {
-        // Create a StringValueCell and transfer dependencies.
-        shared_ptr<Cell> ptr = make_shared<StringValueCell>();
-        ptr->setDependents(grid[row][col]->getDependents());
-        grid[row][col] = ptr;
-        ptr->setPosition(row + 4, col * CELL_SIZE + 4);
-        ptr->setContent(str, *this);
+    return make_shared<StringValueCell>();
+}
+
+// Fills the block row..lastRow x col..lastCol with the content of the source cell.
+// A formula source is moved to every target: relative references are rewritten, absolute ('$') ones are kept,
+// and the compiled program of the source is relocated instead of compiling every target again.
+// A source of a family (see FormulaTemplate) makes the targets members of it: they share its text and program.
+// All targets are placed first, then recalculated once in dependency order, then the formulas outside
+// the block that read it are updated once each.
+void SpreadSheet::fill(int sourceRow, int sourceCol, int row, int col, int lastRow, int lastCol) {
+    shared_ptr<Cell> source = grid[sourceRow][sourceCol];
+    string content = source->getContent();
+    const FormulaCell* sourceFormula = dynamic_cast<const FormulaCell*>(source.get());
+    shared_ptr<const FormulaTemplate> family = sourceFormula ? sourceFormula->getTemplate() : nullptr;
+    int offsetRows = 0, offsetCols = 0;  // The source program is compiled this far from the source
+    if (sourceFormula)
+        sourceFormula->getOffset(offsetRows, offsetCols);
+
+    // Results of array formulas covering the block are removed first
+    vector<Cell*> released;
+    for (int r = row; r <= lastRow; r++)
+        for (int c = col; c <= lastCol; c++)
+            if (r != sourceRow || c != sourceCol)
+                releaseSpill(r, c, released);
+    if (!released.empty())
+        recalculate(released, false);
+
+    // Formulas being replaced stop depending on their inputs, in one pass over the grid
+    unordered_set<Cell*> replaced;
+    for (int r = row; r <= lastRow; r++)
+        for (int c = col; c <= lastCol; c++)
+            if (grid[r][c]->getType() == Type::formula && (r != sourceRow || c != sourceCol))
+                replaced.insert(grid[r][c].get());
+    if (!replaced.empty()) {
+        for (int i = 0; i < getNumRows(); i++)
+            for (int j = 0; j < getNumCols(); j++)
+                grid[i][j]->removeDependents(replaced);
+        ranges.removeDependents(replaced);
+        names.removeDependents(replaced);
+        removeSheetDependents(replaced);
+    }
+
+    // Place every target without evaluating anything
+    vector<Cell*> placed;
+    vector<FormulaCell*> formulas;
+    for (int r = row; r <= lastRow; r++) {
+        for (int c = col; c <= lastCol; c++) {
+            if (r == sourceRow && c == sourceCol)
+                continue;
+            bool member = family != nullptr && family->program.fits(r - family->row, c - family->col, *this);
+            string text = (sourceFormula && !member) ? FormulaCompiler::relocate(content, r - sourceRow, c - sourceCol, *this) : content;
+            shared_ptr<Cell> ptr = makeCell(text);
+            ptr->setDependents(grid[r][c]->getDependents());
+            grid[r][c] = ptr;
+            ptr->setPosition(r + 4, c * CELL_SIZE + 4);
+
+            if (sourceFormula) {
+                FormulaCell* formula = static_cast<FormulaCell*>(ptr.get());
+                if (member)
+                    formula->setTemplate(family);
+                else
+                    formula->setFormula(text, FormulaCompiler::relocate(sourceFormula->getProgram(),
+                                                                        r - sourceRow + offsetRows,
+                                                                        c - sourceCol + offsetCols, *this));
+                formulas.push_back(formula);
+            }
+            else {
+                ptr->setValue(text);
+            }
+            placed.push_back(ptr.get());
+        }
+    }
+    for (FormulaCell* formula : formulas) {
+        formula->setCyclic(FormulaParser::addDependencies(formula, *this));
+        if (formula->getProgram().isArray())
+            placeSpill(formula);
+    }
+
+    // One recalculation for the whole block and everything that reads it
+    recalculate(placed, true);
+}
+
+// Sorts the rows of the block. The order is computed on a permutation of row numbers (on the thread pool
+// for large blocks), then every column of the block is moved in one batch.
+// Formulas that read a moved cell are found through the dependents of the cell; their single references
+// are pointed at its new row, so they read the same cells and keep their values. Ranges keep their corners.
+// Dependency edges belong to the cells, so they move along and need no rebuilding.
+// Moved formulas of a family leave it first, as their references stay where they are.
+void SpreadSheet::sort(int row, int col, int lastRow, int lastCol, const vector<SortKey>& keys) {
+    // The result of an array formula stays where its formula puts it, so it cannot be sorted
+    for (int r = row; r <= lastRow; r++) {
+        for (int c = col; c <= lastCol; c++) {
+            const FormulaCell* formula = dynamic_cast<const FormulaCell*>(grid[r][c].get());
+            if (grid[r][c]->getType() == Type::spill ||
+                (formula != nullptr && formula->isSpilled() && formula->getProgram().getRows() * formula->getProgram().getCols() > 1))
+                throw out_of_range("Invalid Range.");
+        }
+    }
+
+    vector<int> order = RowSorter::order(*this, row, lastRow, keys);
+
+    RowMove move = {row, col, lastRow, lastCol, vector<int>(order.size())};
+    for (size_t i = 0; i < order.size(); i++)
+        move.target[order[i] - row] = row + i;
+
+    vector<Cell*> moved;
+    unordered_set<Cell*> readers;
+    for (int r = row; r <= lastRow; r++) {
+        if (move.target[r - row] == r)
+            continue;
+        for (int c = col; c <= lastCol; c++) {
+            moved.push_back(grid[r][c].get());
+            for (Cell* dep : grid[r][c]->getDependents())
+                readers.insert(dep);
+            if (grid[r][c]->getType() == Type::formula)
+                static_cast<FormulaCell*>(grid[r][c].get())->detach(*this);
+        }
+    }
+    if (moved.empty())
+        return;  // Already in order
+
+    // Rewrite the readers; their values do not change, so they keep their results.
+    // Readers on other sheets only follow their references to this sheet; the rest are on their own sheet.
+    for (Cell* reader : readers) {
+        FormulaCell* formula = dynamic_cast<FormulaCell*>(reader);
+        if (formula == nullptr)
+            continue;
+        int readerRow, readerCol;
+        bool local = locate(reader, readerRow, readerCol);
+        if (!local && (workbook == nullptr || workbook->owner(reader) < 0))
+            continue;
+        double value = formula->getNumber();
+        ErrorCode error = formula->getError();
+        bool cyclic = formula->isCyclic();
+        if (local) {
+            formula->detach(*this);
+            formula->setFormula(FormulaCompiler::follow(formula->getContent(), move),
+                                FormulaCompiler::follow(formula->getProgram(), move));
+        }
+        else
+            formula->setFormula(FormulaCompiler::follow(formula->getContent(), move, workbook->getSheetName(index)),
+                                FormulaCompiler::follow(formula->getProgram(), move, index));
+        formula->setResult(value, error);
+        formula->setCyclic(cyclic);
+    }
+
+    // Move the cells column by column
+    vector<shared_ptr<Cell>> column(order.size());
+    for (int c = col; c <= lastCol; c++) {
+        for (size_t i = 0; i < order.size(); i++)
+            column[i] = grid[order[i]][c];
+        for (size_t i = 0; i < order.size(); i++) {
+            grid[row + i][c] = column[i];
+            column[i]->setPosition(row + i + 4, c * CELL_SIZE + 4);
+        }
+    }
+
+    // One recalculation: the column store, the range caches and the lookup indexes take the new order,
+    // and the formulas reading the block through ranges are evaluated once
+    recalculate(moved, false);
+}
+
+// Recalculates the sheet after the given cells changed.
+// The new values of the changed cells are published first; then every formula that reads them, directly,
+// through a range or further down the chain, is found and evaluated once in dependency order (Kahn's algorithm).
+// Formulas left waiting on each other at the end form a cycle and get #CYCLE!.
+// The work is iterative, so long chains (like a filled running total) do not grow the call stack.
+void SpreadSheet::recalculate(const vector<Cell*>& changed, bool evaluateChanged) {
+    vector<Cell*> cells;                // Changed cells, then every formula reached from them
+    unordered_map<Cell*, int> position; // Cell -> index in 'cells'
+    vector<vector<int>> next;           // Readers of each cell
+    vector<bool> evaluate;              // The cell gets a new value during this recalculation
+    vector<pair<int, Cell*>> untaken;   // Cell and a reader whose last evaluation skipped the branch reading it
+    vector<Cell*> foreign;              // Readers on other sheets of the workbook
+
+    for (Cell* cell : changed) {
+        if (position.count(cell))
+            continue;
+        position[cell] = cells.size();
+        cells.push_back(cell);
+        evaluate.push_back(evaluateChanged && cell->getType() == Type::formula);
+    }
+
+    // Publish the changed cells and find the formulas that read them, following the chain
+    for (size_t i = 0; i < cells.size(); i++) {
+        CellChange change;
+        vector<Cell*> readers;
+        int row, col;
+        if (i < changed.size() && publish(cells[i], change))
+            ranges.applyChange(change, readers);
+        else if (i >= changed.size() && locate(cells[i], row, col))
+            ranges.collect(row, col, readers);
+        for (Cell* dep : cells[i]->getDependents())
+            readers.push_back(dep);
+
+        // The result of a spilled array formula is written by the formula itself, not visited cell by cell:
+        // the readers of its cells read the formula. Those of a formula evaluated here are all collected;
+        // an already evaluated formula writes its result now, and only the changed cells are followed.
+        if (cells[i]->getType() == Type::formula && static_cast<FormulaCell*>(cells[i])->isSpilled() &&
+            locate(cells[i], row, col)) {
+            FormulaCell* anchor = static_cast<FormulaCell*>(cells[i]);
+            if (evaluate[i]) {
+                for (int c = col; c < col + anchor->getProgram().getCols(); c++) {
+                    for (int r = row; r < row + anchor->getProgram().getRows(); r++) {
+                        if (r == row && c == col)
+                            continue;
+                        ranges.collect(r, c, readers);
+                        for (Cell* dep : grid[r][c]->getDependents())
+                            readers.push_back(dep);
+                    }
+                }
+            }
+            else {
+                writeSpill(anchor, row, col, &readers);
+            }
+        }
+        std::sort(readers.begin(), readers.end());
+        readers.erase(unique(readers.begin(), readers.end()), readers.end());
+
+        // A formula that read the cell only in a branch it did not take keeps its value
+        bool single = locate(cells[i], row, col) &&
+                      !(cells[i]->getType() == Type::formula && static_cast<FormulaCell*>(cells[i])->isSpilled());
+        next.push_back({});
+        for (Cell* reader : readers) {
+            if (reader->getType() != Type::formula)
+                continue;
+            int readerRow, readerCol;
+            if (workbook != nullptr && !locate(reader, readerRow, readerCol)) {
+                foreign.push_back(reader);
+                continue;
+            }
+            if (single && !static_cast<FormulaCell*>(reader)->getProgram().reads(row, col)) {
+                untaken.push_back({(int)i, reader});
+                continue;
+            }
+            auto it = position.find(reader);
+            if (it == position.end()) {
+                it = position.emplace(reader, cells.size()).first;
+                cells.push_back(reader);
+                evaluate.push_back(true);
+            }
+            if (it->second == (int)i)
+                continue;
+            // A changed formula reached again reads its own result: it is re-evaluated with the rest,
+            // which leaves the whole cycle waiting and marks it #CYCLE! below
+            evaluate[it->second] = true;
+            next[i].push_back(it->second);
+        }
+    }
+    if (cells.size() == changed.size() && !evaluateChanged) {
+        refreshPivots();
+        if (!foreign.empty())
+            workbook->recalculate(foreign);
+        return;  // No formula of the sheet reads the changed cells
+    }
+
+    // A skipped reader that is evaluated anyway may take the branch now, so it still waits for the cell
+    for (const pair<int, Cell*>& edge : untaken) {
+        auto it = position.find(edge.second);
+        if (it != position.end() && evaluate[it->second] && it->second != edge.first)
+            next[edge.first].push_back(it->second);
+    }
+
+    // A cell waits for every input that is re-evaluated in this pass
+    vector<int> pending(cells.size(), 0);
+    for (size_t i = 0; i < cells.size(); i++)
+        if (evaluate[i])
+            for (int j : next[i])
+                pending[j]++;
+
+    vector<int> ready;
+    for (size_t i = 0; i < cells.size(); i++)
+        if (evaluate[i] && pending[i] == 0)
+            ready.push_back(i);
+
+    // Publishes an evaluated cell and releases the formulas waiting on it
+    auto finish = [&](int i) {
+        CellChange change;
+        vector<Cell*> ignored;
+        if (publish(cells[i], change))
+            ranges.applyChange(change, ignored);
+        writeSpill(cells[i]);
+        for (int j : next[i])
+            if (--pending[j] == 0)
+                ready.push_back(j);
+    };
+
+    // Moving functions and formulas of a family wait until nothing else is ready, so that the copies of
+    // a formula filled down a column are evaluated together
+    vector<int> windows, families;
+    while (!ready.empty() || !windows.empty() || !families.empty()) {
+        if (ready.empty()) {
+            vector<Cell*> batch;
+            for (int i : windows)
+                batch.push_back(cells[i]);
+            evaluateWindows(batch);
+            batch.clear();
+            for (int i : families)
+                batch.push_back(cells[i]);
+            evaluateFamilies(batch);
+            for (int i : windows)
+                finish(i);
+            for (int i : families)
+                finish(i);
+            windows.clear();
+            families.clear();
+            continue;
+        }
+        int i = ready.back();
+        ready.pop_back();
+        if (windowOf(cells[i]) != nullptr) {
+            windows.push_back(i);
+            continue;
+        }
+        if (inFamily(cells[i])) {
+            families.push_back(i);
+            continue;
+        }
+        cells[i]->updateValue(*this);
+        finish(i);
+    }
+
+    // Formulas still waiting depend on each other
+    for (size_t i = 0; i < cells.size(); i++)
+        if (evaluate[i] && pending[i] > 0)
+            setCycle(cells[i]);
+    refreshPivots();
+
+    // The formulas of other sheets read the new values now that they are all computed
+    if (!foreign.empty())
+        workbook->recalculate(foreign);
+}
+
+// Evaluates every formula of the sheet: they are all changed cells of one recalculation
+void SpreadSheet::recalculateAll() {
+    vector<Cell*> formulas;
+    for (int i = 0; i < getNumRows(); i++)
+        for (int j = 0; j < getNumCols(); j++)
+            if (grid[i][j]->getType() == Type::formula)
+                formulas.push_back(grid[i][j].get());
+    if (!formulas.empty())
+        recalculate(formulas, true);
+}
+
+// Gives the formulas and their readers #CYCLE!. A formula that has it already is not followed again,
+// so the walk ends although the formulas read each other.
+void SpreadSheet::markCycle(const vector<Cell*>& cells) {
+    vector<Cell*> pending = cells;
+    vector<Cell*> foreign;
+    while (!pending.empty()) {
+        Cell* cell = pending.back();
+        pending.pop_back();
+        int row, col;
+        if (cell->getType() != Type::formula || cell->getError() == ErrorCode::cycle)
+            continue;
+        if (!locate(cell, row, col)) {
+            foreign.push_back(cell);
+            continue;
+        }
+        static_cast<FormulaCell*>(cell)->setResult(0.0, ErrorCode::cycle);
+        CellChange change;
+        if (publish(cell, change))
+            ranges.applyChange(change, pending);
+        writeSpill(cell);
+        for (Cell* dep : cell->getDependents())
+            pending.push_back(dep);
+    }
+    if (!foreign.empty() && workbook != nullptr)
+        workbook->markCycle(foreign);
+}
+
+// Gives a formula #CYCLE! and publishes it, with the result of an array formula
+void SpreadSheet::setCycle(Cell* cell) {
+    static_cast<FormulaCell*>(cell)->setResult(0.0, ErrorCode::cycle);
+    CellChange change;
+    vector<Cell*> ignored;
+    if (publish(cell, change))
+        ranges.applyChange(change, ignored);
+    writeSpill(cell);
+}
+
+// Returns the aggregate instruction of a compiled moving function formula
+const Instruction* SpreadSheet::windowOf(const Cell* cell) {
+    if (cell->getType() != Type::formula)
+        return nullptr;
+    const FormulaCell* formula = static_cast<const FormulaCell*>(cell);
+    const vector<Instruction>& code = formula->getProgram().getCode();
+    if (formula->isCyclic() || code.size() != 1 || code[0].op != OpCode::aggregate ||
+        FunctionRegistry::get(code[0].func).kind != FunctionKind::window)
+        return nullptr;
+    return &code[0];
+}
+
+// Evaluates moving function formulas. The formulas are grouped by function, columns and window placed
+// relative to their own row, then sorted by row: every run of consecutive rows in a group reads windows
+// that move down one row at a time, which one sliding pass computes in O(rows + height).
+void SpreadSheet::evaluateWindows(const vector<Cell*>& cells) {
+    struct Member {
+        array<int, 6> key; // Function, column of the formula, first and last column, row offset and height
+        int row;           // Row of the formula
+        Cell* cell;
+    };
+    vector<Member> members;
+    for (Cell* cell : cells) {
+        const Instruction* in = windowOf(cell);
+        int row, col;
+        if (!locate(cell, row, col)) {
+            cell->updateValue(*this);
+            continue;
+        }
+        members.push_back({{(int)in->func, col, in->col, in->lastCol, in->row - row, in->lastRow - in->row + 1},
+                           row, cell});
+    }
+    std::sort(members.begin(), members.end(), [](const Member& a, const Member& b) {
+        return a.key != b.key ? a.key < b.key : a.row < b.row;
+    });
+
+    vector<double> results;
+    for (size_t begin = 0, end; begin < members.size(); begin = end) {
+        end = begin + 1;
+        while (end < members.size() && members[end].key == members[begin].key &&
+               members[end].row == members[end - 1].row + 1)
+            end++;
+
+        const array<int, 6>& key = members[begin].key;
+        int count = end - begin, first = members[begin].row + key[4], height = key[5];
+        if (count < WINDOW_BATCH ||
+            store.firstError(first, key[2], first + count + height - 2, key[3]) != ErrorCode::none) {
+            for (size_t m = begin; m < end; m++)
+                members[m].cell->updateValue(*this);
+            continue;
+        }
+
+        results.resize(count);
+        WindowKernels::slide(store, key[2], key[3], first, height, count,
+                             FunctionRegistry::get((Function)key[0]).apply, results.data());
+        for (size_t m = begin; m < end; m++) {
+            static_cast<FormulaCell*>(members[m].cell)->setResult(results[m - begin], ErrorCode::none);
+            if (isShown())
+                members[m].cell->show();
+        }
+    }
+}
+
+// Returns true for a formula of a family. A formula reading itself is left to the single evaluation,
+// which gives it #CYCLE!.
+bool SpreadSheet::inFamily(const Cell* cell) {
+    if (cell->getType() != Type::formula)
+        return false;
+    const FormulaCell* formula = static_cast<const FormulaCell*>(cell);
+    return formula->getTemplate() != nullptr && !formula->isCyclic();
+}
+
+// Evaluates family formulas. The formulas are grouped by template and column, then sorted by row: every run of
+// consecutive rows in a group is one span of the program's input columns. All of them were ready together, so
+// none reads another, and the whole run is computed before any result is written.
+void SpreadSheet::evaluateFamilies(const vector<Cell*>& cells) {
+    struct Member {
+        const FormulaTemplate* family;
+        int col, row;
+        FormulaCell* cell;
+    };
+    vector<Member> members;
+    for (Cell* cell : cells) {
+        FormulaCell* formula = static_cast<FormulaCell*>(cell);
+        int row, col;
+        if (!locate(cell, row, col)) {
+            cell->updateValue(*this);
+            continue;
+        }
+        members.push_back({formula->getTemplate().get(), col, row, formula});
+    }
+    std::sort(members.begin(), members.end(), [](const Member& a, const Member& b) {
+        return make_tuple(a.family, a.col, a.row) < make_tuple(b.family, b.col, b.row);
+    });
+
+    vector<double> results;
+    vector<ErrorCode> errors;
+    for (size_t begin = 0, end; begin < members.size(); begin = end) {
+        end = begin + 1;
+        while (end < members.size() && members[end].family == members[begin].family &&
+               members[end].col == members[begin].col && members[end].row == members[end - 1].row + 1)
+            end++;
+
+        int count = end - begin;
+        if (count < FAMILY_BATCH) {
+            for (size_t m = begin; m < end; m++)
+                members[m].cell->updateValue(*this);
+            continue;
+        }
+
+        const FormulaTemplate* family = members[begin].family;
+        results.resize(count);
+        errors.resize(count);
+        family->program.evaluateFamily(*this, members[begin].row - family->row, members[begin].col - family->col,
+                                       count, results.data(), errors.data());
+        for (size_t m = begin; m < end; m++) {
+            members[m].cell->setResult(results[m - begin], errors[m - begin]);
+            if (isShown())
+                members[m].cell->show();
+        }
+    }
+}
+
+// Adds a pivot table and writes its first result
+void SpreadSheet::pivot(const PivotSpec& spec) {
+    for (size_t i = 0; i < pivots.size(); i++) {
+        if (pivots[i]->getSpec().targetRow == spec.targetRow && pivots[i]->getSpec().targetCol == spec.targetCol) {
+            vector<PivotCell> cleared = pivots[i]->clear();
+            pivots.erase(pivots.begin() + i);
+            writeCells(cleared);
+            break;
+        }
+    }
+    pivots.push_back(unique_ptr<PivotTable>(new PivotTable(spec)));
+    pivots.back()->build(*this);
+    refreshPivots();
+}
+
+// Writes the changed cells of the dirty pivot tables. A result may be the source of another pivot,
+// so this runs until no pivot is dirty, with one pass per pivot at most (results feeding each other stop there).
+void SpreadSheet::refreshPivots() {
+    if (refreshingPivots)
+        return;
+    refreshingPivots = true;
+    for (size_t pass = 0; pass <= pivots.size(); pass++) {
+        bool dirty = false;
+        for (size_t i = 0; i < pivots.size(); i++) {
+            if (!pivots[i]->isDirty())
+                continue;
+            dirty = true;
+            writeCells(pivots[i]->refresh(*this));
+        }
+        if (!dirty)
+            break;
+    }
+    refreshingPivots = false;
+}
+
+// Places plain contents without evaluating anything, then recalculates once
+void SpreadSheet::writeCells(const vector<PivotCell>& cells) {
+    if (cells.empty())
+        return;
+
+    vector<Cell*> released;
+    for (const PivotCell& cell : cells)
+        releaseSpill(cell.row, cell.col, released);
+    if (!released.empty())
+        recalculate(released, false);
+
+    // Formulas being replaced stop depending on their inputs, in one pass over the grid
+    unordered_set<Cell*> replaced;
+    for (const PivotCell& cell : cells)
+        if (grid[cell.row][cell.col]->getType() == Type::formula)
+            replaced.insert(grid[cell.row][cell.col].get());
+    if (!replaced.empty()) {
+        for (int i = 0; i < getNumRows(); i++)
+            for (int j = 0; j < getNumCols(); j++)
+                grid[i][j]->removeDependents(replaced);
+        ranges.removeDependents(replaced);
+        names.removeDependents(replaced);
+        removeSheetDependents(replaced);
+    }
+
+    vector<Cell*> placed;
+    for (const PivotCell& cell : cells) {
+        shared_ptr<Cell> ptr = makeCell(cell.text);
+        ptr->setDependents(grid[cell.row][cell.col]->getDependents());
+        grid[cell.row][cell.col] = ptr;
+        ptr->setPosition(cell.row + 4, cell.col * CELL_SIZE + 4);
+        ptr->setValue(cell.text);
+        placed.push_back(ptr.get());
     }
+    recalculate(placed, false);
 }
 
-// Function to set the content of a specific cell in the grid
+// Replaces every cell of the sheet. The formulas of the old content lose their edges first; the new cells take
+// over the edges of the cells they replace, since formulas of other sheets may read them. Every cell is placed
+// before any formula gets its edges, so a formula may read a cell that comes after it in the file.
+void SpreadSheet::load(const vector<vector<string>>& contents) {
+    unordered_set<Cell*> replaced;
+    for (int i = 0; i < getNumRows(); i++)
+        for (int j = 0; j < getNumCols(); j++)
+            if (grid[i][j]->getType() == Type::formula)
+                replaced.insert(grid[i][j].get());
+    if (!replaced.empty()) {
+        for (int i = 0; i < getNumRows(); i++)
+            for (int j = 0; j < getNumCols(); j++)
+                grid[i][j]->removeDependents(replaced);
+        ranges.removeDependents(replaced);
+        names.removeDependents(replaced);
+        removeSheetDependents(replaced);
+    }
+    blockedSpills.clear();
+
+    vector<pair<FormulaCell*, string>> formulas;
+    for (int r = 0; r < getNumRows(); r++) {
+        for (int c = 0; c < getNumCols(); c++) {
+            string text = (r < (int)contents.size() && c < (int)contents[r].size()) ? contents[r][c] : "";
+            shared_ptr<Cell> ptr = makeCell(text);
+            ptr->setDependents(grid[r][c]->getDependents());
+            grid[r][c] = ptr;
+            ptr->setPosition(r + 4, c * CELL_SIZE + 4);
+            if (ptr->getType() == Type::formula)
+                formulas.push_back({static_cast<FormulaCell*>(ptr.get()), text});
+            else
+                ptr->setValue(text);
+        }
+    }
 
+    vector<FormulaCell*> compiled;
+    for (const pair<FormulaCell*, string>& formula : formulas) {
+        try {
+            // Formulas of one shape, like a column filled before saving, share one template
+            formula.first->setFormula(formula.second, CompiledFormula());
+            formula.first->compile(*this);
+            compiled.push_back(formula.first);
+        }
+        catch (exception& e) {
+            // Like a formula typed in that does not compile, the cell is left empty
+            int row, col;
+            locate(formula.first, row, col);
+            shared_ptr<Cell> ptr = make_shared<EmptyValueCell>();
+            ptr->setDependents(grid[row][col]->getDependents());
+            grid[row][col] = ptr;
+            ptr->setPosition(row + 4, col * CELL_SIZE + 4);
+        }
+    }
+
+    // The cached statistics of the ranges follow the new values, but nothing is evaluated yet
+    for (int r = 0; r < getNumRows(); r++) {
+        for (int c = 0; c < getNumCols(); c++) {
+            CellChange change;
+            vector<Cell*> ignored;
+            if (publish(grid[r][c].get(), change))
+                ranges.applyChange(change, ignored);
+        }
+    }
+    for (FormulaCell* formula : compiled) {
+        formula->setCyclic(FormulaParser::addDependencies(formula, *this));
+        if (formula->getProgram().isArray())
+            placeSpill(formula);
+    }
+}
+
+// Copies the numeric value (or error value) of the cell at (row, col) into the column store,
+// and keeps the lookup indexes of the column up to date
+void SpreadSheet::publish(int row, int col) {
+    double oldValue = *store.values(col, row);
+    bool wasNumber = *store.mask(col, row);
+
+    Type type = grid[row][col]->getType();
+    string text;
+    if (grid[row][col]->getError() != ErrorCode::none)
+        store.setError(row, col, grid[row][col]->getError());
+    else if (type == Type::formula || type == Type::value || type == Type::spill)
+        store.set(row, col, grid[row][col]->getNumber());
+    else if (type == Type::string) {
+        text = grid[row][col]->getValue();
+        store.setText(row, col, StringPool::intern(StringPool::fold(text)));
+    }
+    else
+        store.clear(row, col);
+
+    lookups.update(row, col, oldValue, wasNumber, *store.values(col, row), *store.mask(col, row),
+                   type == Type::string ? &text : nullptr);
+    for (const unique_ptr<PivotTable>& pivot : pivots)
+        pivot->touch(row, col);
+}
+
+// Finds the grid position of a cell from its screen position.
+// Returns false for cells that are not part of the grid (like the temporary cell of the copy command).
+bool SpreadSheet::locate(const Cell* cell, int& row, int& col) const {
+    row = cell->getRow() - 4;
+    col = (cell->getCol() - 4) / CELL_SIZE;
+    return row >= 0 && row < getNumRows() && col >= 0 && col < getNumCols() && grid[row][col].get() == cell;
+}
+
+// Copies the numeric value of a cell into the column store. The previous entry of the store is the old value
+// of the cell, so the change can be described to incremental aggregates.
+// Cells that are not part of the grid (like the temporary cell of the copy command) are ignored.
+bool SpreadSheet::publish(const Cell* cell, CellChange& change) {
+    int row, col;
+    if (!locate(cell, row, col))
+        return false;
+
+    change.row = row;
+    change.col = col;
+    change.oldValue = *store.values(col, row);
+    change.wasNumber = *store.mask(col, row);
+    publish(row, col);
+    change.newValue = *store.values(col, row);
+    change.isNumber = *store.mask(col, row);
+    return true;
+}
+
+// Returns the column-major numeric mirror of the grid
+const ColumnStore& SpreadSheet::getStore() const {
+    return store;
+}
+
+
+
+// Returns the id of the range node of a block of cells
+int SpreadSheet::addRange(int row, int col, int lastRow, int lastCol) {
+    int id = ranges.add(row, col, lastRow, lastCol);
+    for (int c = col; c <= lastCol; c++)
+        if (ranges.countOnColumn(c) >= COLUMN_INDEX_THRESHOLD)
+            store.buildIndex(c);
+    return id;
+}
+
+// Registers a formula as a dependent of a range node
+void SpreadSheet::addRangeDependent(Cell* cell, int range) {
+    ranges.addDependent(range, cell);
+}
+
+// Returns the cached statistics of a range node
+const AggregateState& SpreadSheet::getRangeState(int range, bool exactExtremes) {
+    return ranges.getState(range, store, exactExtremes);
+}
+
+// Returns the order index of a range node
+const OrderIndex* SpreadSheet::getRangeOrder(int range) {
+    return ranges.getOrder(range, store);
+}
+
+// Removes formulas from the range nodes
+void SpreadSheet::removeRangeDependents(const unordered_set<Cell*>& cells) {
+    ranges.removeDependents(cells);
+}
+
+// Returns the first error value inside a range node
+ErrorCode SpreadSheet::getRangeError(int range) const {
+    const RangeNode& node = ranges.get(range);
+    return store.firstError(node.row, node.col, node.lastRow, node.lastCol);
+}
+
+// Returns the corners and dependents of a range node
+const RangeNode& SpreadSheet::getRange(int range) const {
+    return ranges.get(range);
+}
+
+// Returns the id of a sheet name, adding it undefined if needed
+int SpreadSheet::addName(const string& name) {
+    return names.add(name);
+}
+
+// Returns the definition of a sheet name
+const NameDefinition& SpreadSheet::getName(int id) const {
+    return names.get(id).definition;
+}
+
+// Binds a formula to a sheet name
+void SpreadSheet::addNameDependent(Cell* cell, int id) {
+    names.addDependent(id, cell);
+}
+
+// Redefines a name and recompiles the formulas bound to it, found through the name table.
+// Their edges are removed through their own programs, so no other cell of the sheet is visited;
+// the cells stay in place, so the formulas that read them keep their edges.
+void SpreadSheet::defineName(const string& name, const NameDefinition& definition) {
+    int id = names.add(name);
+    names.define(id, definition);
+    unordered_set<Cell*> bound = names.get(id).formulas;
+    if (bound.empty())
+        return;
+
+    vector<Cell*> released;
+    vector<FormulaCell*> formulas;
+    for (Cell* cell : bound) {
+        int row, col;
+        if (!locate(cell, row, col))
+            continue;
+        releaseSpill(row, col, released);
+        formulas.push_back(static_cast<FormulaCell*>(cell));
+    }
+    if (!released.empty())
+        recalculate(released, false);
+
+    for (FormulaCell* formula : formulas) {
+        formula->getProgram().forEach([&](const Instruction& in) {
+            if (in.op == OpCode::pushCell || (in.op == OpCode::criterion && in.row >= 0))
+                grid[in.row][in.col]->remove(formula);
+        });
+    }
+    ranges.removeDependents(bound);
+    names.removeDependents(bound);
+    removeSheetDependents(bound);
+
+    vector<Cell*> placed;
+    for (FormulaCell* formula : formulas) {
+        string text = formula->getContent();
+        try {
+            formula->setFormula(text, FormulaCompiler::compile(text, *this));
+        }
+        catch (exception& e) {
+            // Like a block name now given as a constant to a matrix function
+            formula->setFormula(text, FormulaCompiler::failed(ErrorCode::name));
+        }
+        names.addDependent(id, formula);
+        formula->setCyclic(FormulaParser::addDependencies(formula, *this));
+        if (formula->getProgram().isArray())
+            placeSpill(formula);
+        placed.push_back(formula);
+    }
+    recalculate(placed, true);
+}
+
+// Finds the row of the key through the lookup indexes of the column. Text keys use the text hash,
+// numeric keys the number hash (exact match) or the sorted numbers (approximate match).
+int SpreadSheet::findRow(int col, int row, int lastRow, const Cell* keyCell, double key, MatchMode mode) {
+    if (keyCell != nullptr && keyCell->getType() == Type::string) {
+        // First text lookup on the column: collect its texts to build the index
+        if (!lookups.hasText(col)) {
+            vector<string> texts(getNumRows());
+            for (int r = 0; r < getNumRows(); r++)
+                if (grid[r][col]->getType() == Type::string)
+                    texts[r] = grid[r][col]->getValue();
+            lookups.buildText(col, texts);
+        }
+        return lookups.findText(col, row, lastRow, keyCell->getValue());
+    }
+
+    if (mode == MatchMode::exact)
+        return lookups.findNumber(store, col, row, lastRow, key);
+    return lookups.findSorted(store, col, row, lastRow, key, mode);
+}
+
+// Looks the family up by the R1C1 text of the formula. The formula joins it only if its references stay on
+// the sheet and the template writes it back the same way (an R1C1 text typed in as it is would match too).
+shared_ptr<const FormulaTemplate> SpreadSheet::findTemplate(const string& formula, int row, int col) {
+    auto it = templates.find(FormulaCompiler::toTemplate(formula, row, col));
+    if (it == templates.end())
+        return nullptr;
+    shared_ptr<const FormulaTemplate> family = it->second.lock();
+    if (family == nullptr || !family->program.fits(row - family->row, col - family->col, *this) ||
+        FormulaCompiler::fromTemplate(family->text, row, col) != formula)
+        return nullptr;
+    return family;
+}
+
+// Registers a new family. The entries of the families that are gone are swept once the table has doubled.
+shared_ptr<const FormulaTemplate> SpreadSheet::addTemplate(const string& formula, int row, int col, CompiledFormula program) {
+    if (templates.size() >= 2 * liveTemplates + 64) {
+        for (auto it = templates.begin(); it != templates.end(); )
+            it = it->second.expired() ? templates.erase(it) : next(it);
+        liveTemplates = templates.size();
+    }
+    shared_ptr<const FormulaTemplate> family = make_shared<const FormulaTemplate>(
+        FormulaTemplate{FormulaCompiler::toTemplate(formula, row, col), move(program), row, col});
+    templates[family->text] = family;
+    return family;
+}
+
+// Attaches the sheet to a workbook
+void SpreadSheet::setWorkbook(Workbook* book, int sheetIndex) {
+    workbook = book;
+    index = sheetIndex;
+}
+
+// Returns the workbook of the sheet
+Workbook* SpreadSheet::getWorkbook() const {
+    return workbook;
+}
+
+// Returns the index of the sheet in its workbook
+int SpreadSheet::getIndex() const {
+    return index;
+}
+
+// A sheet on its own is always on screen
+bool SpreadSheet::isShown() const {
+    return workbook == nullptr || workbook->paints(index);
+}
+
+// Prints the formula values of the cells on screen (the rest of the grid does not change in a recalculation)
+void SpreadSheet::showValues() const {
+    for (int r = 0; r < min(getNumRows(), SPRERAD_ROW_SIZE); r++) {
+        for (int c = 0; c < min(getNumCols(), SPRERAD_COL_SIZE); c++) {
+            Type type = grid[r][c]->getType();
+            if (type == Type::formula || type == Type::spill)
+                grid[r][c]->show();
+        }
+    }
+}
+
+// Removes the edges the formulas have on other sheets, through their own programs: the single references have
+// their edge on the cell of the other sheet, the ranges one on its range node (removed once per sheet)
+void SpreadSheet::removeSheetDependents(const unordered_set<Cell*>& formulas) {
+    if (workbook == nullptr)
+        return;
+    vector<unordered_set<Cell*>> ranged(workbook->size());
+    for (Cell* cell : formulas) {
+        if (cell->getType() != Type::formula)
+            continue;
+        static_cast<FormulaCell*>(cell)->getProgram().forEach([&](const Instruction& in) {
+            if (in.op == OpCode::pushSheetCell)
+                workbook->getSheet((int)in.value).getCell(in.row, in.col)->remove(cell);
+            else if (in.op == OpCode::sheetAggregate)
+                ranged[(int)in.value].insert(cell);
+        });
+    }
+    for (size_t i = 0; i < ranged.size(); i++)
+        if (!ranged[i].empty())
+            workbook->getSheet(i).removeRangeDependents(ranged[i]);
+}
+
+// Removes all range dependencies. The range nodes of the sheet stay when it is in a workbook, since
+// formulas of other sheets may still read them; only the formulas of the sheet leave them.
+void SpreadSheet::clearRangeDependents() {
+    unordered_set<Cell*> formulas;
+    for (int i = 0; i < getNumRows(); i++)
+        for (int j = 0; j < getNumCols(); j++)
+            if (grid[i][j]->getType() == Type::formula)
+                formulas.insert(grid[i][j].get());
+    removeSheetDependents(formulas);
+    if (workbook != nullptr)
+        ranges.removeDependents(formulas);
+    else
+        ranges.clear();
+    names.clearDependents();
+    store.clearIndexes();
+    lookups.clear();
+    pivots.clear();
+    blockedSpills.clear();
+}
+
+// Places the cells of the result of an array formula. Every cell of the result but the formula itself
+// becomes a SpillCell that copies its element from the formula when the recalculation reaches it.
+bool SpreadSheet::placeSpill(FormulaCell* anchor) {
+    int row, col;
+    if (!locate(anchor, row, col))
+        return false;
+    int rows = anchor->getProgram().getRows(), cols = anchor->getProgram().getCols();
+
+    bool free = row + rows <= getNumRows() && col + cols <= getNumCols();
+    for (int c = col; free && c < col + cols; c++)
+        for (int r = row; free && r < row + rows; r++)
+            if ((r != row || c != col) && grid[r][c]->getType() != Type::empty)
+                free = false;
+    if (!free) {
+        anchor->setSpilled(false);
+        if (find(blockedSpills.begin(), blockedSpills.end(), make_pair(row, col)) == blockedSpills.end())
+            blockedSpills.push_back({row, col});
+        return false;
+    }
+
+    for (int c = col; c < col + cols; c++) {
+        for (int r = row; r < row + rows; r++) {
+            if (r == row && c == col)
+                continue;
+            shared_ptr<Cell> ptr = make_shared<SpillCell>(row, col, (c - col) * rows + (r - row));
+            ptr->setDependents(grid[r][c]->getDependents());
+            grid[r][c] = ptr;
+            ptr->setPosition(r + 4, c * CELL_SIZE + 4);
+        }
+    }
+    anchor->setSpilled(true);
+    return true;
+}
+
+// Writes the result of a spilled array formula into its cells. Cells whose element changed are published,
+// and the formulas reading them through ranges or single references are added to 'readers' if it is given.
+void SpreadSheet::writeSpill(FormulaCell* anchor, int row, int col, vector<Cell*>* readers) {
+    int rows = anchor->getProgram().getRows(), cols = anchor->getProgram().getCols();
+    vector<Cell*> ignored;
+    for (int c = col; c < col + cols; c++) {
+        for (int r = row; r < row + rows; r++) {
+            if (r == row && c == col)
+                continue;
+            SpillCell* spill = dynamic_cast<SpillCell*>(grid[r][c].get());
+            if (spill == nullptr || !spill->pull(anchor))
+                continue;
+            CellChange change;
+            publish(spill, change);
+            ranges.applyChange(change, readers ? *readers : ignored);
+            if (readers)
+                for (Cell* dep : spill->getDependents())
+                    readers->push_back(dep);
+        }
+    }
+}
+
+// Writes the result of the cell if it is a spilled array formula
+void SpreadSheet::writeSpill(Cell* cell) {
+    int row, col;
+    if (cell->getType() == Type::formula && static_cast<FormulaCell*>(cell)->isSpilled() && locate(cell, row, col))
+        writeSpill(static_cast<FormulaCell*>(cell), row, col, nullptr);
+}
+
+// Removes the result of a spilled array formula that is replaced, or blocks the formula of a result cell
+// that is replaced
+void SpreadSheet::releaseSpill(int row, int col, vector<Cell*>& changed) {
+    Type type = grid[row][col]->getType();
+    if (type == Type::spill) {
+        const SpillCell* spill = static_cast<const SpillCell*>(grid[row][col].get());
+        int anchorRow = spill->getAnchorRow(), anchorCol = spill->getAnchorCol();
+        FormulaCell* anchor = dynamic_cast<FormulaCell*>(grid[anchorRow][anchorCol].get());
+        if (anchor == nullptr) {
+            // A result cell left behind; it is only emptied
+            shared_ptr<Cell> ptr = make_shared<EmptyValueCell>();
+            ptr->setDependents(grid[row][col]->getDependents());
+            grid[row][col] = ptr;
+            ptr->setPosition(row + 4, col * CELL_SIZE + 4);
+            changed.push_back(ptr.get());
+            return;
+        }
+        removeSpill(anchorRow, anchorCol, anchor, changed);
+        if (!anchor->isCyclic())
+            anchor->setResult(0.0, ErrorCode::spill);
+        if (find(blockedSpills.begin(), blockedSpills.end(), make_pair(anchorRow, anchorCol)) == blockedSpills.end())
+            blockedSpills.push_back({anchorRow, anchorCol});
+        changed.push_back(anchor);
+    }
+    else if (type == Type::formula) {
+        FormulaCell* anchor = static_cast<FormulaCell*>(grid[row][col].get());
+        if (anchor->isSpilled())
+            removeSpill(row, col, anchor, changed);
+    }
+}
+
+// Replaces the cells of the result of an array formula with empty cells
+void SpreadSheet::removeSpill(int row, int col, FormulaCell* anchor, vector<Cell*>& changed) {
+    int rows = anchor->getProgram().getRows(), cols = anchor->getProgram().getCols();
+    for (int c = col; c < col + cols && c < getNumCols(); c++) {
+        for (int r = row; r < row + rows && r < getNumRows(); r++) {
+            const SpillCell* spill = dynamic_cast<const SpillCell*>(grid[r][c].get());
+            if (spill == nullptr || spill->getAnchorRow() != row || spill->getAnchorCol() != col)
+                continue;
+            shared_ptr<Cell> ptr = make_shared<EmptyValueCell>();
+            ptr->setDependents(grid[r][c]->getDependents());
+            grid[r][c] = ptr;
+            ptr->setPosition(r + 4, c * CELL_SIZE + 4);
+            changed.push_back(ptr.get());
+        }
+    }
+    anchor->setSpilled(false);
+}
+
+// Spills the blocked array formulas whose result covers the emptied cell. Positions that no longer hold
+// a blocked array formula are forgotten.
+void SpreadSheet::retrySpills(int row, int col) {
+    vector<pair<int, int>> blocked;
+    blocked.swap(blockedSpills);
+    for (const pair<int, int>& position : blocked) {
+        FormulaCell* anchor = dynamic_cast<FormulaCell*>(grid[position.first][position.second].get());
+        if (anchor == nullptr || !anchor->getProgram().isArray() || anchor->isSpilled())
+            continue;
+        const CompiledFormula& program = anchor->getProgram();
+        bool covers = row >= position.first && row < position.first + program.getRows() &&
+                      col >= position.second && col < position.second + program.getCols();
+        if (!covers || !placeSpill(anchor)) {
+            if (find(blockedSpills.begin(), blockedSpills.end(), position) == blockedSpills.end())
+                blockedSpills.push_back(position);
+            continue;
+        }
+        recalculate(vector<Cell*>(1, anchor), true);
+    }
+}
 
 // Function to set the content of a cell using a string value
 void SpreadSheet::setCell(int row, int col, const string& newContent) {
@@ -209,13 +1258,18 @@ void SpreadSheet::printCell(string& printOnTerminal, int row, int col, int first
         }
     }
     // If the cell does not contain a formula, print the content with spaces padded to the right
-    else if (table.getCell(row - firstR, col / CELL_SIZE)->getType() != Type::formula) {
+    else if (table.getCell(row - firstR, col / CELL_SIZE)->getType() != Type::formula &&
+             table.getCell(row - firstR, col / CELL_SIZE)->getType() != Type::spill) {
         printOnTerminal = table.getCell(row - firstR, col / CELL_SIZE)->getContent(); // Get cell content
         while (printOnTerminal.size() < CELL_SIZE) {
             printOnTerminal += " "; // Add spaces to the right if the content is smaller than the cell size
         }
     }
-    // If the cell contains a formula, print the evaluated result with padding
+    // If the formula evaluated to an error value, print the error text (it fills the whole cell)
+    else if (table.getCell(row - firstR, col / CELL_SIZE)->getError() != ErrorCode::none) {
+        printOnTerminal = table.getCell(row - firstR, col / CELL_SIZE)->getValue().substr(0,CELL_SIZE);
+    }
+    // If the cell contains a formula (or an element of an array result), print the evaluated result with padding
     else {
         printOnTerminal = table.getCell(row - firstR, col / CELL_SIZE)->getValue().substr(0,CELL_SIZE-1); // Get the evaluated value of the formula
         printOnTerminal = " "+printOnTerminal; // Add spaces to the right to ensure the content fits the cell size
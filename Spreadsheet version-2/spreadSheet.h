@@ -5,9 +5,17 @@
 #include <string>  // Include the string library
 #include <vector>  // Include the vector library
 #include <memory>
+#include <unordered_set>
+#include <unordered_map>
 #include "container.h"
 #include"container.cpp"
 #include "AnsiTerminal.h"
+#include "columnStore.h"
+#include "rangeIndex.h"
+#include "lookupIndex.h"
+#include "rowSorter.h"
+#include "pivotTable.h"
+#include "nameTable.h"
 
 #define CELL_SIZE 7  // Define the default size for cells 
 #define SPRERAD_ROW_SIZE 40
@@ -20,6 +28,8 @@ using namespace utils;
 
 namespace spreadsheet {
 
+class Workbook;
+
 class SpreadSheet {
 public:
     // Default constructor: initializes the spreadsheet with default values
@@ -54,12 +64,121 @@ public:
     // Sets the content of a specific cell in the spreadsheet.
     void setContent(int row,int col,const string& str);
 
+    // Publishes the new values of the changed cells and re-evaluates every formula that depends on them,
+    // once each and in dependency order. 'evaluateChanged' also evaluates the changed formulas themselves.
+    // Pivot tables over the changed cells write their new results afterwards, and the formulas of other sheets
+    // of the workbook that read the cells are handed to their sheets (see Workbook::recalculate).
+    void recalculate(const vector<Cell*>& changed, bool evaluateChanged);
+
+    // Evaluates every formula of the sheet once, in dependency order (after a load)
+    void recalculateAll();
+
+    // Gives the formulas, and every formula that reads them on any sheet, the error value #CYCLE! without
+    // evaluating them (see Workbook::recalculate)
+    void markCycle(const vector<Cell*>& cells);
+
+    // Replaces the content of every cell with contents[row][col] (missing ones are emptied) without evaluating
+    // anything: the formulas are compiled and get their edges. Formulas that do not compile are left empty.
+    // Used to load the sheets of a workbook, which are then recalculated together.
+    void load(const vector<vector<string>>& contents);
+
+    // Fills the block row..lastRow x col..lastCol with the content of the source cell, moving the relative
+    // references of a formula source, and recalculates the block once
+    void fill(int sourceRow, int sourceCol, int row, int col, int lastRow, int lastCol);
+
+    // Sorts the rows of the block row..lastRow x col..lastCol by the key columns, moving the cells once.
+    // Formulas that read moved cells follow them, and the block is recalculated once.
+    void sort(int row, int col, int lastRow, int lastCol, const vector<SortKey>& keys);
+
+    // Adds a pivot table: the rows of the source are grouped by the key columns and the result is written
+    // at the target cell. The result follows later edits of the source. A pivot on the same target replaces it.
+    void pivot(const PivotSpec& spec);
+
     // Displays the spreadsheet grid
     void display(int row,int col,AnsiTerminal& terminal,SpreadSheet& table);
 
     // Converts the cell to a printable format
     void printCell(string& printOnTerminal, int row, int col, int firstR, SpreadSheet& table);
 
+    // Copies the numeric value of the cell at (row, col) into the column store
+    void publish(int row, int col);
+
+    // Copies the numeric value of a cell into the column store and describes the change in 'change'.
+    // Returns false (and changes nothing) for cells that are not in the grid.
+    bool publish(const Cell* cell, CellChange& change);
+
+    // Finds the zero based grid position of a cell. Returns false for cells that are not in the grid.
+    bool locate(const Cell* cell, int& row, int& col) const;
+
+    // Returns the column-major numeric mirror of the grid used by the range kernels
+    const ColumnStore& getStore() const;
+
+    // Returns the id of the range node of a block of cells, creating it if needed
+    int addRange(int row, int col, int lastRow, int lastCol);
+
+    // Registers a formula as a dependent of a range node (one node per block, not one edge per cell)
+    void addRangeDependent(Cell* cell, int range);
+
+    // Returns the cached statistics of a range node, shared by every formula over the same block
+    const AggregateState& getRangeState(int range, bool exactExtremes);
+
+    // Returns the order index of a range node, nullptr if order statistics should gather the block instead
+    const OrderIndex* getRangeOrder(int range);
+
+    // Removes formulas (of this sheet or another one) from the range nodes of the sheet
+    void removeRangeDependents(const unordered_set<Cell*>& cells);
+
+    // Returns the first error value inside a range node, ErrorCode::none if the block has none
+    ErrorCode getRangeError(int range) const;
+
+    // Returns the corners and dependents of a range node
+    const RangeNode& getRange(int range) const;
+
+    // Finds the row of the key in rows row..lastRow of a column through the lookup indexes, -1 if there is none.
+    // A key cell holding text is matched exactly against the texts of the column; any other key is a number.
+    int findRow(int col, int row, int lastRow, const Cell* keyCell, double key, MatchMode mode);
+
+    // Returns the id of a sheet name, adding it undefined if needed
+    int addName(const string& name);
+
+    // Returns the definition of a sheet name
+    const NameDefinition& getName(int id) const;
+
+    // Binds a formula to a sheet name, so it is recompiled when the name is redefined
+    void addNameDependent(Cell* cell, int id);
+
+    // Defines or redefines a sheet name (a block of cells or a constant; an undefined definition removes it).
+    // Only the formulas bound to the name are recompiled, then they and their readers are recalculated once.
+    void defineName(const string& name, const NameDefinition& definition);
+
+    // Returns the template of the family the formula written at (row, col) belongs to: a formula of the sheet
+    // filled from it or to it, like =A2*B2 at C2 for =A1*B1 at C1. Returns nullptr if there is none yet.
+    shared_ptr<const FormulaTemplate> findTemplate(const string& formula, int row, int col);
+
+    // Makes the formula written at (row, col), compiled into 'program', the template of a new family
+    shared_ptr<const FormulaTemplate> addTemplate(const string& formula, int row, int col, CompiledFormula program);
+
+    // Attaches the sheet to a workbook, where it has the given index
+    void setWorkbook(Workbook* book, int sheetIndex);
+
+    // Returns the workbook of the sheet (nullptr for a sheet on its own) and the index of the sheet in it
+    Workbook* getWorkbook() const;
+    int getIndex() const;
+
+    // Returns true if the sheet paints its cells as they are evaluated (it is on screen, and not being
+    // recalculated on a thread of the pool)
+    bool isShown() const;
+
+    // Prints the values of the formulas of the sheet that are on screen
+    void showValues() const;
+
+    // Removes all range dependencies (used when the whole sheet is reset)
+    void clearRangeDependents();
+
+    // Places the cells of the result of an array formula below and right of it. The cells must be on the sheet
+    // and empty; otherwise the formula is remembered as blocked and returns false (it evaluates to #SPILL!).
+    bool placeSpill(FormulaCell* anchor);
+
 private:
     // Stores labels for the columns (e.g., A, B, C, ...)
     Container<string> colsLabel;
@@ -70,6 +189,95 @@ private:
     // The main grid of the spreadsheet, represented as a 2D CONTAINER of Cell objects
     Container<Container<shared_ptr<Cell>>> grid;
 
+    // Numeric values of the grid stored column by column
+    ColumnStore store;
+
+    // Formulas that depend on blocks of cells
+    RangeIndex ranges;
+
+    // Hash and sorted indexes of the columns read by lookup functions
+    LookupIndex lookups;
+
+    // Sheet-level names and the formulas bound to each
+    NameTable names;
+
+    // Templates of the formula families of the sheet, by R1C1 text. A template lives as long as its family.
+    unordered_map<string, weak_ptr<const FormulaTemplate>> templates;
+    size_t liveTemplates = 0; // Number of templates after the last sweep of the dead ones
+
+    // Workbook the sheet belongs to, nullptr if none, and the index of the sheet in it
+    Workbook* workbook = nullptr;
+    int index = 0;
+
+    // Pivot tables, refreshed after every recalculation that changed their sources
+    vector<unique_ptr<PivotTable>> pivots;
+
+    // A refresh of the pivot tables is running (their writes recalculate the sheet too)
+    bool refreshingPivots = false;
+
+    // Columns read by at least this many different ranges get a prefix-sum / segment-tree index,
+    // so range functions over them (like running totals filled down a column) answer in O(log n)
+    static const int COLUMN_INDEX_THRESHOLD = 32;
+
+    // Array formulas whose result was blocked, by position; an edit that empties their area spills them again
+    vector<pair<int, int>> blockedSpills;
+
+    // Removes the edges that the given formulas have on cells and range nodes of other sheets
+    void removeSheetDependents(const unordered_set<Cell*>& formulas);
+
+    // Gives a formula the error value #CYCLE! and publishes it
+    void setCycle(Cell* cell);
+
+    // Creates an empty cell of the type that holds the given content
+    static shared_ptr<Cell> makeCell(const string& str);
+
+    // Prepares the cell at (row, col) to be replaced. The result of a spilled array formula is removed;
+    // a cell of such a result blocks its formula, which then evaluates to #SPILL!.
+    // The cells that changed are added to 'changed' (they must be recalculated before the cell is replaced).
+    void releaseSpill(int row, int col, vector<Cell*>& changed);
+
+    // Replaces the cells of the result of the array formula at (row, col) with empty cells
+    void removeSpill(int row, int col, FormulaCell* anchor, vector<Cell*>& changed);
+
+    // Writes the elements of a spilled array formula into the cells of its result; the cells that changed are
+    // published, and the formulas that read them are added to 'readers' when it is given
+    void writeSpill(FormulaCell* anchor, int row, int col, vector<Cell*>* readers);
+
+    // Writes the result of the cell if it is a spilled array formula (after it was evaluated)
+    void writeSpill(Cell* cell);
+
+    // Spills the blocked array formulas whose result covers the emptied cell at (row, col)
+    void retrySpills(int row, int col);
+
+    // Returns the aggregate instruction of a compiled moving function formula (like @MAVG(A1..A20)),
+    // nullptr for any other cell
+    static const Instruction* windowOf(const Cell* cell);
+
+    // Evaluates moving function formulas that are ready in the same recalculation. Copies of one formula
+    // filled down a column, on consecutive rows, are computed by one sliding window pass (see WindowKernels);
+    // the others, and runs whose cells hold error values, are evaluated one by one.
+    void evaluateWindows(const vector<Cell*>& cells);
+
+    // Moving function formulas on consecutive rows are batched from this many on
+    static const int WINDOW_BATCH = 2;
+
+    // Returns true for a formula of a family (see FormulaTemplate) that can be evaluated with the others
+    static bool inFamily(const Cell* cell);
+
+    // Evaluates formulas of families that are ready in the same recalculation. Members of one family on
+    // consecutive rows of a column are computed together, by one run of the shared program over spans of the
+    // column store (see CompiledFormula::evaluateFamily); the others are evaluated one by one.
+    void evaluateFamilies(const vector<Cell*>& cells);
+
+    // Formulas of a family on consecutive rows are batched from this many on
+    static const int FAMILY_BATCH = 8;
+
+    // Writes plain contents into cells and recalculates once, like fill does for its targets
+    void writeCells(const vector<PivotCell>& cells);
+
+    // Writes the changes of every pivot table whose source changed, until none is left
+    void refreshPivots();
+
     // Initializes the column labels (for example, A, B, C...)
     void initCols();
 
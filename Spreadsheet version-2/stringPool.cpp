@@ -0,0 +1,50 @@
+#include "stringPool.h"
+#include <cctype>
+
+namespace utils {
+
+// Returns the id of the text, adding it the first time
+int StringPool::intern(const string& text) {
+    lock_guard<mutex> held(guard());
+    auto found = ids().find(text);
+    if (found != ids().end())
+        return found->second;
+    int id = texts().size();
+    texts().push_back(text);
+    ids().emplace(text, id);
+    return id;
+}
+
+// Returns the text of an id
+const string& StringPool::get(int id) {
+    lock_guard<mutex> held(guard());
+    return texts()[id];
+}
+
+// Returns the text in lower case
+string StringPool::fold(const string& text) {
+    string result = text;
+    for (char& ch : result)
+        ch = tolower((unsigned char)ch);
+    return result;
+}
+
+// Texts in id order, created with the empty text as id 0 on first use
+deque<string>& StringPool::texts() {
+    static deque<string> pool(1, "");
+    return pool;
+}
+
+// Id of every interned text
+unordered_map<string, int>& StringPool::ids() {
+    static unordered_map<string, int> pool = {{"", 0}};
+    return pool;
+}
+
+// Lock of the pool
+mutex& StringPool::guard() {
+    static mutex lock;
+    return lock;
+}
+
+}
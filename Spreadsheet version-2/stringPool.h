@@ -0,0 +1,38 @@
+#ifndef STRING_POOL_H
+#define STRING_POOL_H
+
+#include <string>
+#include <deque>
+#include <unordered_map>
+#include <mutex>
+
+using namespace std;
+
+namespace utils {
+
+// Program wide table of interned texts. Every distinct text gets a small integer id once,
+// so texts can be stored in columns and compared as integers (id 0 is reserved for "no text").
+// The pool is shared by the sheets of a workbook, which recalculate concurrently, so it is guarded by a lock.
+class StringPool {
+public:
+    // Returns the id of the text, adding it to the pool the first time it is seen
+    static int intern(const string& text);
+
+    // Returns the text of an id
+    static const string& get(int id);
+
+    // Returns the text in lower case, the form used to compare texts without case
+    static string fold(const string& text);
+
+private:
+    // Texts in id order (a deque never moves its elements, so references stay valid) and their ids
+    static deque<string>& texts();
+    static unordered_map<string, int>& ids();
+
+    // Lock taken by intern and get
+    static mutex& guard();
+};
+
+}
+
+#endif
@@ -0,0 +1,95 @@
+#include "threadPool.h"
+
+namespace utils {
+
+// Returns the shared pool
+ThreadPool& ThreadPool::instance() {
+    static ThreadPool pool(thread::hardware_concurrency() > 1 ? thread::hardware_concurrency() - 1 : 0);
+    return pool;
+}
+
+// Starts the worker threads
+ThreadPool::ThreadPool(int count) {
+    for (int i = 0; i < count; i++)
+        workers.emplace_back(&ThreadPool::workerLoop, this);
+}
+
+// Stops and joins the workers
+ThreadPool::~ThreadPool() {
+    {
+        lock_guard<mutex> guard(lock);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (thread& t : workers)
+        t.join();
+}
+
+// Number of threads that take part in parallelFor
+int ThreadPool::size() const {
+    return workers.size() + 1;
+}
+
+// Runs all tasks of a job and waits for them. Small jobs and nested calls run on the calling thread.
+void ThreadPool::parallelFor(int count, const function<void(int)>& task) {
+    unique_lock<mutex> caller(callerLock, try_to_lock);
+    if (count <= 1 || workers.empty() || !caller.owns_lock()) {
+        for (int i = 0; i < count; i++)
+            task(i);
+        return;
+    }
+
+    {
+        lock_guard<mutex> guard(lock);
+        job = &task;
+        jobSize = count;
+        nextTask = 0;
+        doneTasks = 0;
+        generation++;
+    }
+    wake.notify_all();
+
+    runTasks(); // The caller works too
+
+    unique_lock<mutex> guard(lock);
+    finished.wait(guard, [this] { return doneTasks == jobSize; });
+    job = nullptr;
+}
+
+// Loop run by every worker thread
+void ThreadPool::workerLoop() {
+    long long seen = 0;
+    while (true) {
+        {
+            unique_lock<mutex> guard(lock);
+            wake.wait(guard, [&] { return stopping || (generation != seen && job != nullptr); });
+            if (stopping)
+                return;
+            seen = generation;
+        }
+        runTasks();
+    }
+}
+
+// Takes task indexes of the current job until none are left
+void ThreadPool::runTasks() {
+    while (true) {
+        int index;
+        const function<void(int)>* current;
+        {
+            lock_guard<mutex> guard(lock);
+            if (job == nullptr || nextTask >= jobSize)
+                return;
+            index = nextTask++;
+            current = job;
+        }
+
+        (*current)(index);
+
+        lock_guard<mutex> guard(lock);
+        if (++doneTasks == jobSize)
+            finished.notify_one();
+    }
+}
+
+}
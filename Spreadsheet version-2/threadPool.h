@@ -0,0 +1,55 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+using namespace std;
+
+namespace utils {
+
+// Fixed set of worker threads shared by the whole program.
+// parallelFor hands out task indexes to the workers and the calling thread, and returns when all are done.
+class ThreadPool {
+public:
+    // Returns the shared pool, created with one worker per hardware thread on first use
+    static ThreadPool& instance();
+
+    // Runs task(0) .. task(count - 1), possibly concurrently, and waits for all of them
+    void parallelFor(int count, const function<void(int)>& task);
+
+    // Number of threads that take part in parallelFor (workers plus the caller)
+    int size() const;
+
+    // Stops and joins the workers
+    ~ThreadPool();
+
+private:
+    explicit ThreadPool(int workers);
+
+    // Loop run by every worker thread
+    void workerLoop();
+
+    // Takes task indexes of the current job until none are left
+    void runTasks();
+
+    vector<thread> workers;
+    mutex lock;
+    condition_variable wake;      // Signals workers that a job is available
+    condition_variable finished;  // Signals the caller that the job is complete
+
+    const function<void(int)>* job = nullptr; // Current job
+    int jobSize = 0;          // Number of tasks of the current job
+    int nextTask = 0;         // Next task index to hand out
+    int doneTasks = 0;        // Number of tasks completed
+    long long generation = 0; // Incremented for every new job
+    bool stopping = false;
+    mutex callerLock;         // Only one parallelFor runs at a time
+};
+
+}
+
+#endif
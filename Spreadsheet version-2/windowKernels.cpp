@@ -0,0 +1,72 @@
+#include "windowKernels.h"
+#include <vector>
+#include <limits>
+
+namespace utils {
+
+// One pass down the rows first .. first + count + height - 2. Row r enters the window that ends at it; the row
+// that falls out of the window is removed from the running statistics before the result is read.
+// The queues hold row offsets whose row extremes are increasing (lows) or decreasing (highs): a row that
+// enters removes the rows it beats from the back, rows that left the window are dropped from the front,
+// so every row is pushed and popped at most once.
+// Removing values lets rounding errors build up, so the running statistics are rebuilt from the rows of the
+// window each time the window has moved by its own height, which keeps the pass O(n + w).
+void WindowKernels::slide(const spreadsheet::ColumnStore& store, int col, int lastCol, int first, int height, int count,
+                          double (*apply)(const AggregateState&), double* out) {
+    const double inf = numeric_limits<double>::infinity();
+    int rows = count + height - 1;
+    vector<double> rowLow(rows), rowHigh(rows); // Extremes of every row over the columns (+-infinity if none)
+    vector<int> lows(rows), highs(rows);        // The two monotonic queues, as arrays with a front and a back
+    int lowFront = 0, lowBack = 0, highFront = 0, highBack = 0;
+    AggregateState running;
+
+    for (int r = 0; r < rows; r++) {
+        double low = inf, high = -inf;
+        for (int c = col; c <= lastCol; c++) {
+            if (*store.mask(c, first + r)) {
+                double x = *store.values(c, first + r);
+                running.add(x);
+                low = min(low, x);
+                high = max(high, x);
+            }
+        }
+        rowLow[r] = low;
+        rowHigh[r] = high;
+        while (lowBack > lowFront && rowLow[lows[lowBack - 1]] >= low)
+            lowBack--;
+        lows[lowBack++] = r;
+        while (highBack > highFront && rowHigh[highs[highBack - 1]] <= high)
+            highBack--;
+        highs[highBack++] = r;
+
+        int window = r - height + 1;
+        if (window < 0)
+            continue;
+        if (window > 0) {
+            int leaving = window - 1;
+            if (window % height == 0) {
+                running = AggregateState();
+                for (int k = window; k <= r; k++)
+                    for (int c = col; c <= lastCol; c++)
+                        if (*store.mask(c, first + k))
+                            running.add(*store.values(c, first + k));
+            }
+            else {
+                for (int c = col; c <= lastCol; c++)
+                    if (*store.mask(c, first + leaving))
+                        running.remove(*store.values(c, first + leaving));
+            }
+        }
+        while (lows[lowFront] < window)
+            lowFront++;
+        while (highs[highFront] < window)
+            highFront++;
+
+        long long numbers = running.getCount();
+        double m2 = running.getVariance() * numbers;
+        out[window] = apply(AggregateState::fromMoments(numbers, running.getSum(), rowLow[lows[lowFront]],
+                                                        rowHigh[highs[highFront]], m2));
+    }
+}
+
+}
@@ -0,0 +1,27 @@
+#ifndef WINDOW_KERNELS_H
+#define WINDOW_KERNELS_H
+
+#include "aggregateState.h"
+#include "columnStore.h"
+
+using namespace std;
+
+namespace utils {
+
+// Sliding window kernel of the moving functions (MSUM, MAVG, MMIN, MMAX, MSTDDEV).
+// A formula like @MAVG(A1..A20) filled down a column reads windows that move down one row at a time;
+// instead of computing every window on its own (O(n * w)), the kernel slides one window down the block:
+// the row entering is added to running statistics and the row leaving is removed, while two monotonic queues
+// keep the smallest and largest values of the rows in the window. The whole pass is O(n + w).
+class WindowKernels {
+public:
+    // Computes 'count' windows of 'height' rows over the columns col..lastCol of the store. Window i covers the
+    // rows first + i .. first + i + height - 1; out[i] receives 'apply' of its statistics (the result reader of an
+    // aggregate function, see FunctionInfo). Only numbers are read: the caller handles error values.
+    static void slide(const spreadsheet::ColumnStore& store, int col, int lastCol, int first, int height, int count,
+                      double (*apply)(const AggregateState&), double* out);
+};
+
+}
+
+#endif
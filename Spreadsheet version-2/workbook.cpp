@@ -0,0 +1,164 @@
+#include "workbook.h"
+#include "threadPool.h"
+#include <stdexcept>
+#include <cctype>
+
+namespace spreadsheet {
+
+// Sheet hops of the recalculation running on this thread (a full recalculation runs on several threads)
+static thread_local int hops = 0;
+
+// Creates an empty workbook
+Workbook::Workbook(int cols, int rows) : cols(cols), rows(rows) {}
+
+// Adds an empty sheet, which starts in a group of its own
+int Workbook::addSheet(const string& name) {
+    if (!isSheetName(name) || find(name) >= 0)
+        throw invalid_argument("Invalid Sheet.");
+    int index = sheets.size();
+    sheets.push_back(unique_ptr<SpreadSheet>(new SpreadSheet(cols, rows)));
+    sheets.back()->setWorkbook(this, index);
+    names.push_back(name);
+    parents.push_back(index);
+    return index;
+}
+
+// Returns the index of the sheet with the name
+int Workbook::find(const string& name) const {
+    for (size_t i = 0; i < names.size(); i++)
+        if (names[i] == name)
+            return i;
+    return -1;
+}
+
+// Returns the sheet at the index
+SpreadSheet& Workbook::getSheet(int index) {
+    return *sheets[index];
+}
+
+// Returns the name of the sheet at the index
+const string& Workbook::getSheetName(int index) const {
+    return names[index];
+}
+
+// Returns the number of sheets
+int Workbook::size() const {
+    return sheets.size();
+}
+
+// Returns the sheet shown to the user
+SpreadSheet& Workbook::getActive() {
+    return *sheets[active];
+}
+
+// Returns the index of the sheet shown to the user
+int Workbook::getActiveIndex() const {
+    return active;
+}
+
+// Shows another sheet
+void Workbook::setActive(int index) {
+    active = index;
+}
+
+// Joins the groups of two sheets
+void Workbook::link(int a, int b) {
+    a = group(a);
+    b = group(b);
+    if (a != b)
+        parents[max(a, b)] = min(a, b);
+}
+
+// Hands the readers to their sheets. Each sheet evaluates its readers in dependency order and passes
+// the change on to the sheets that read them in turn, so the recursion follows the chain across sheets.
+void Workbook::recalculate(const vector<Cell*>& readers) {
+    if (hops >= MAX_SHEET_HOPS) {
+        markCycle(readers);
+        return;
+    }
+    vector<vector<Cell*>> bySheet = split(readers);
+    hops++;
+    for (size_t i = 0; i < sheets.size(); i++)
+        if (!bySheet[i].empty())
+            sheets[i]->recalculate(bySheet[i], true);
+    hops--;
+}
+
+// Hands the formulas to their sheets, which pass #CYCLE! on to the readers
+void Workbook::markCycle(const vector<Cell*>& cells) {
+    vector<vector<Cell*>> bySheet = split(cells);
+    for (size_t i = 0; i < sheets.size(); i++)
+        if (!bySheet[i].empty())
+            sheets[i]->markCycle(bySheet[i]);
+}
+
+// Evaluates every formula. The sheets of a group read each other, so they run one after the other on one
+// thread; different groups touch different sheets only and run concurrently.
+void Workbook::recalculate() {
+    vector<vector<int>> groups;
+    vector<int> slot(sheets.size(), -1);
+    for (size_t i = 0; i < sheets.size(); i++) {
+        int first = group(i);
+        if (slot[first] < 0) {
+            slot[first] = groups.size();
+            groups.push_back({});
+        }
+        groups[slot[first]].push_back(i);
+    }
+
+    // The terminal is written by the calling thread only
+    painting = false;
+    ThreadPool::instance().parallelFor(groups.size(), [&](int g) {
+        for (int sheet : groups[g])
+            sheets[sheet]->recalculateAll();
+    });
+    painting = true;
+    if (active < (int)sheets.size())
+        sheets[active]->showValues();
+}
+
+// Only the active sheet is on screen
+bool Workbook::paints(int sheet) const {
+    return painting && sheet == active;
+}
+
+// Returns the index of the sheet that holds the cell
+int Workbook::owner(const Cell* cell) const {
+    int row, col;
+    for (size_t i = 0; i < sheets.size(); i++)
+        if (sheets[i]->locate(cell, row, col))
+            return i;
+    return -1;
+}
+
+// A sheet name is a letter followed by letters, digits or '_'
+bool Workbook::isSheetName(const string& name) {
+    if (name.empty() || !isalpha((unsigned char)name[0]))
+        return false;
+    for (char ch : name)
+        if (!isalnum((unsigned char)ch) && ch != '_')
+            return false;
+    return true;
+}
+
+// Sorts the cells by the sheet that holds them
+vector<vector<Cell*>> Workbook::split(const vector<Cell*>& cells) const {
+    vector<vector<Cell*>> bySheet(sheets.size());
+    for (Cell* cell : cells) {
+        int sheet = owner(cell);
+        if (sheet >= 0)
+            bySheet[sheet].push_back(cell);
+    }
+    return bySheet;
+}
+
+// Returns the first sheet of the group, compressing the path to it
+int Workbook::group(int sheet) {
+    while (parents[sheet] != sheet) {
+        parents[sheet] = parents[parents[sheet]];
+        sheet = parents[sheet];
+    }
+    return sheet;
+}
+
+}
@@ -0,0 +1,90 @@
+#ifndef WORKBOOK_H
+#define WORKBOOK_H
+
+#include "spreadSheet.h"
+#include <string>
+#include <vector>
+#include <memory>
+
+using namespace std;
+
+namespace spreadsheet {
+
+// Several sheets of the same size, referenced from each other's formulas as Sheet2!A1 or Sheet2!A1..B5.
+// A formula that reads another sheet has its edge on that sheet (on the cell, or on the sheet's range node),
+// so the cells a sheet changes lead it to the formulas of other sheets that read them; those are handed back
+// to their own sheet, which recalculates them and passes the change on.
+// Sheets whose formulas read each other are linked into groups; groups share nothing, so a full
+// recalculation runs one group per thread of the thread pool.
+class Workbook {
+public:
+    // Creates an empty workbook whose sheets have the given number of columns and rows
+    Workbook(int cols, int rows);
+
+    // Adds an empty sheet and returns its index. The name is a letter followed by letters, digits or '_'.
+    // Throws invalid_argument for a malformed name or one that is taken.
+    int addSheet(const string& name);
+
+    // Returns the index of the sheet with the name, -1 if there is none
+    int find(const string& name) const;
+
+    // Returns the sheet at the index
+    SpreadSheet& getSheet(int index);
+
+    // Returns the name of the sheet at the index
+    const string& getSheetName(int index) const;
+
+    // Returns the number of sheets
+    int size() const;
+
+    // Returns the sheet shown to the user, and changes it
+    SpreadSheet& getActive();
+    int getActiveIndex() const;
+    void setActive(int index);
+
+    // Records that formulas of sheet 'a' read sheet 'b': the two recalculate on the same thread from now on
+    void link(int a, int b);
+
+    // Recalculates formulas of the sheets that read cells another sheet changed, each on its own sheet.
+    // A change going around the sheets more than MAX_SHEET_HOPS times is a cycle through ranges: the
+    // formulas it reaches then get #CYCLE!, and so do the formulas that read them.
+    void recalculate(const vector<Cell*>& readers);
+
+    // Gives the formulas, and every formula that reads them on any sheet, the error value #CYCLE!
+    void markCycle(const vector<Cell*>& cells);
+
+    // Evaluates every formula of every sheet, the groups of linked sheets concurrently on the thread pool.
+    // The sheets do not paint meanwhile; the active sheet is painted once afterwards.
+    void recalculate();
+
+    // Returns true if the cells of the sheet are painted as they are evaluated: it is the active sheet and no
+    // full recalculation is running on the thread pool
+    bool paints(int sheet) const;
+
+    // Returns the index of the sheet that holds the cell, -1 if none does
+    int owner(const Cell* cell) const;
+
+    // Returns true if the text is a valid sheet name
+    static bool isSheetName(const string& name);
+
+private:
+    // Returns the cells held by every sheet, by sheet index
+    vector<vector<Cell*>> split(const vector<Cell*>& cells) const;
+
+    // Returns the first sheet of the group of a sheet (the groups are a union-find forest)
+    int group(int sheet);
+
+    int cols, rows;                        // Size of every sheet
+    vector<unique_ptr<SpreadSheet>> sheets; // Sheets in the order they were added
+    vector<string> names;                  // Name of every sheet
+    vector<int> parents;                   // Parent of every sheet in the union-find forest of the groups
+    int active = 0;                        // Sheet shown to the user
+    bool painting = true;                  // Cells of the active sheet are painted as they are evaluated
+
+    // Times a change may pass from sheet to sheet in one recalculation
+    static const int MAX_SHEET_HOPS = 256;
+};
+
+}
+
+#endif